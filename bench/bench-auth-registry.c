@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file bench-auth-registry.c
+ *@brief 会话索引表查找耗时测试，对比原有的链表线性查找
+ */
+#include <glib.h>
+#include <stdio.h>
+#include "kiran-auth-registry.h"
+
+#define LOOKUP_ROUNDS 200000
+
+typedef struct
+{
+    gchar *sid;
+    gchar *sender;
+} FakeSession;
+
+static void
+fake_session_free(gpointer data)
+{
+    FakeSession *session = data;
+
+    g_free(session->sid);
+    g_free(session->sender);
+    g_free(session);
+}
+
+static FakeSession *
+list_find_by_sid(GList *list, const gchar *sid)
+{
+    for (; list; list = list->next)
+    {
+        FakeSession *session = list->data;
+
+        if (g_strcmp0(session->sid, sid) == 0)
+            return session;
+    }
+
+    return NULL;
+}
+
+static void
+run(guint n_sessions)
+{
+    KiranAuthRegistry *registry = kiran_auth_registry_new(fake_session_free);
+    FakeSession **sessions = g_new0(FakeSession *, n_sessions);
+    GList *list = NULL;
+    GRand *rand = g_rand_new_with_seed(n_sessions);
+    gint64 begin;
+    gdouble registry_ns;
+    gdouble sender_ns;
+    gdouble list_ns;
+    guint found = 0;
+    guint rounds;
+    guint i;
+
+    for (i = 0; i < n_sessions; i++)
+    {
+        FakeSession *session = g_new0(FakeSession, 1);
+
+        session->sid = g_uuid_string_random();
+        session->sender = g_strdup_printf(":1.%u", i);
+        sessions[i] = session;
+        kiran_auth_registry_insert(registry, session->sid, session->sender, session);
+        list = g_list_append(list, session);
+    }
+
+    begin = g_get_monotonic_time();
+    for (i = 0; i < LOOKUP_ROUNDS; i++)
+    {
+        FakeSession *session = sessions[g_rand_int_range(rand, 0, n_sessions)];
+
+        found += kiran_auth_registry_lookup_sid(registry, session->sid) != NULL;
+    }
+    registry_ns = (g_get_monotonic_time() - begin) * 1000.0 / LOOKUP_ROUNDS;
+
+    begin = g_get_monotonic_time();
+    for (i = 0; i < LOOKUP_ROUNDS; i++)
+    {
+        FakeSession *session = sessions[g_rand_int_range(rand, 0, n_sessions)];
+
+        found += kiran_auth_registry_lookup_sender(registry, session->sender) != NULL;
+    }
+    sender_ns = (g_get_monotonic_time() - begin) * 1000.0 / LOOKUP_ROUNDS;
+
+    //链表查找是O(n)的，会话多时减少轮数避免测试时间过长
+    rounds = MAX(LOOKUP_ROUNDS / MAX(n_sessions / 10, 1), 100);
+    begin = g_get_monotonic_time();
+    for (i = 0; i < rounds; i++)
+    {
+        FakeSession *session = sessions[g_rand_int_range(rand, 0, n_sessions)];
+
+        found += list_find_by_sid(list, session->sid) != NULL;
+    }
+    list_ns = (g_get_monotonic_time() - begin) * 1000.0 / rounds;
+
+    printf("%-10u %14.1f %14.1f %14.1f\n", n_sessions, registry_ns, sender_ns, list_ns);
+
+    g_assert(found == LOOKUP_ROUNDS * 2 + rounds);
+
+    g_list_free(list);
+    g_free(sessions);
+    g_rand_free(rand);
+    kiran_auth_registry_free(registry);
+}
+
+int main(int argc, char *argv[])
+{
+    guint sizes[] = {10, 100, 1000, 10000};
+    guint i;
+
+    printf("%-10s %14s %14s %14s\n", "sessions", "sid(ns/op)", "sender(ns/op)", "list(ns/op)");
+    for (i = 0; i < G_N_ELEMENTS(sizes); i++)
+    {
+        run(sizes[i]);
+    }
+
+    return 0;
+}
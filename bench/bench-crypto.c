@@ -0,0 +1,366 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file bench-crypto.c
+ *@brief 每次登录都会经过的加解密及编码路径的性能测试
+ *
+ * 对每种密钥长度和线程数组合分别测试，结果以json格式输出到标准输出，
+ * 包括吞吐量以及p50/p99/p999延迟
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "authentication_i.h"
+
+#define RESPONSE_TEXT "kiran-bench-password"
+#define DECRYPT_BUFFER_LEN 4096
+
+typedef struct _Fixture Fixture;
+typedef struct _Worker Worker;
+typedef gboolean (*BenchOp)(Fixture *fixture);
+
+struct _Fixture
+{
+    int bits;
+    char *public_key;
+    char *private_key;
+    KiranAuthKey *key;
+    unsigned char *encrypted;
+    int encrypted_len;
+    gchar *encoded_response;
+};
+
+struct _Worker
+{
+    BenchOp op;
+    Fixture *fixture;
+    guint iterations;
+    //每次操作的耗时，单位纳秒
+    gint64 *samples;
+};
+
+static gchar *key_sizes_option = NULL;
+static gchar *threads_option = NULL;
+static gint iterations = 2000;
+static gint keygen_iterations = 16;
+
+static GOptionEntry entries[] = {
+    {"key-sizes", 'k', 0, G_OPTION_ARG_STRING, &key_sizes_option, "Comma separated rsa key sizes, default 1024,2048,3072,4096", "BITS"},
+    {"threads", 't', 0, G_OPTION_ARG_STRING, &threads_option, "Comma separated thread counts, default 1,2,4", "N"},
+    {"iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Operations per case, default 2000", "N"},
+    {"keygen-iterations", 'g', 0, G_OPTION_ARG_INT, &keygen_iterations, "Key generations per case, default 16", "N"},
+    {NULL}};
+
+static gint64
+now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+static gboolean
+op_rsa_key_gen(Fixture *fixture)
+{
+    char *public_key = NULL;
+    char *private_key = NULL;
+    int ret;
+
+    ret = kiran_authentication_rsa_key_gen_with_bits(fixture->bits, &public_key, &private_key);
+    free(public_key);
+    free(private_key);
+
+    return ret == 0;
+}
+
+static gboolean
+op_rsa_public_encrypt(Fixture *fixture)
+{
+    unsigned char *encrypted = NULL;
+    int ret;
+
+    ret = kiran_authentication_rsa_public_encrypt(RESPONSE_TEXT,
+                                                  strlen(RESPONSE_TEXT),
+                                                  (unsigned char *)fixture->public_key,
+                                                  &encrypted);
+    free(encrypted);
+
+    return ret > 0;
+}
+
+static gboolean
+op_rsa_private_decrypt(Fixture *fixture)
+{
+    char *decrypted = NULL;
+    int ret;
+
+    ret = kiran_authentication_rsa_private_decrypt(fixture->encrypted,
+                                                   fixture->encrypted_len,
+                                                   (unsigned char *)fixture->private_key,
+                                                   &decrypted);
+    free(decrypted);
+
+    return ret == (int)strlen(RESPONSE_TEXT);
+}
+
+static gboolean
+op_key_decrypt(Fixture *fixture)
+{
+    char buf[DECRYPT_BUFFER_LEN];
+
+    return kiran_authentication_key_decrypt(fixture->key,
+                                            fixture->encrypted,
+                                            fixture->encrypted_len,
+                                            buf,
+                                            sizeof(buf)) == (int)strlen(RESPONSE_TEXT);
+}
+
+static gboolean
+op_base64_encode_pem(Fixture *fixture)
+{
+    gchar *encode;
+    gboolean ok;
+
+    encode = g_base64_encode((const guchar *)fixture->public_key, strlen(fixture->public_key));
+    ok = (encode != NULL);
+    g_free(encode);
+
+    return ok;
+}
+
+static gboolean
+op_base64_decode_response(Fixture *fixture)
+{
+    guchar *decode;
+    gsize len = 0;
+
+    decode = g_base64_decode(fixture->encoded_response, &len);
+    g_free(decode);
+
+    return len == (gsize)fixture->encrypted_len;
+}
+
+static gpointer
+worker_run(gpointer data)
+{
+    Worker *worker = data;
+    guint i;
+
+    for (i = 0; i < worker->iterations; i++)
+    {
+        gint64 begin = now_ns();
+
+        if (!worker->op(worker->fixture))
+        {
+            g_error("benchmark operation failed");
+        }
+        worker->samples[i] = now_ns() - begin;
+    }
+
+    return NULL;
+}
+
+static gint
+sample_compare(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a;
+    gint64 y = *(const gint64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+static gint64
+percentile(gint64 *samples, guint n, gdouble q)
+{
+    guint index = (guint)(q * n);
+
+    return samples[MIN(index, n - 1)];
+}
+
+static void
+run_case(const char *name,
+         BenchOp op,
+         Fixture *fixture,
+         guint n_threads,
+         guint total,
+         gboolean *first)
+{
+    Worker *workers = g_new0(Worker, n_threads);
+    GThread **threads = g_new0(GThread *, n_threads);
+    guint per_thread = MAX(total / n_threads, 1);
+    guint n_samples = per_thread * n_threads;
+    gint64 *samples = g_new0(gint64, n_samples);
+    gint64 begin;
+    gint64 elapsed;
+    guint i;
+
+    begin = now_ns();
+    for (i = 0; i < n_threads; i++)
+    {
+        workers[i].op = op;
+        workers[i].fixture = fixture;
+        workers[i].iterations = per_thread;
+        workers[i].samples = samples + i * per_thread;
+        threads[i] = g_thread_new(name, worker_run, &workers[i]);
+    }
+
+    for (i = 0; i < n_threads; i++)
+    {
+        g_thread_join(threads[i]);
+    }
+    elapsed = MAX(now_ns() - begin, 1);
+
+    qsort(samples, n_samples, sizeof(gint64), (int (*)(const void *, const void *))sample_compare);
+
+    printf("%s\n    {\"op\": \"%s\", \"key_bits\": %d, \"threads\": %u, \"iterations\": %u, "
+           "\"throughput_ops\": %.1f, \"p50_ns\": %" G_GINT64_FORMAT ", \"p99_ns\": %" G_GINT64_FORMAT
+           ", \"p999_ns\": %" G_GINT64_FORMAT "}",
+           *first ? "" : ",",
+           name,
+           fixture->bits,
+           n_threads,
+           n_samples,
+           n_samples * 1e9 / elapsed,
+           percentile(samples, n_samples, 0.50),
+           percentile(samples, n_samples, 0.99),
+           percentile(samples, n_samples, 0.999));
+    fflush(stdout);
+    *first = FALSE;
+
+    g_free(samples);
+    g_free(threads);
+    g_free(workers);
+}
+
+static GArray *
+parse_int_list(const gchar *option,
+               const gchar *default_value)
+{
+    GArray *array = g_array_new(FALSE, FALSE, sizeof(guint));
+    gchar **items;
+    guint i;
+
+    items = g_strsplit(option ? option : default_value, ",", -1);
+    for (i = 0; items[i]; i++)
+    {
+        guint value = (guint)g_ascii_strtoull(items[i], NULL, 10);
+
+        if (value > 0)
+        {
+            g_array_append_val(array, value);
+        }
+    }
+    g_strfreev(items);
+
+    return array;
+}
+
+static gboolean
+fixture_init(Fixture *fixture,
+             int bits)
+{
+    fixture->bits = bits;
+
+    if (kiran_authentication_rsa_key_gen_with_bits(bits, &fixture->public_key, &fixture->private_key) != 0)
+    {
+        return FALSE;
+    }
+
+    fixture->key = kiran_authentication_key_new_private(fixture->private_key);
+    fixture->encrypted_len = kiran_authentication_rsa_public_encrypt(RESPONSE_TEXT,
+                                                                     strlen(RESPONSE_TEXT),
+                                                                     (unsigned char *)fixture->public_key,
+                                                                     &fixture->encrypted);
+    if (fixture->key == NULL || fixture->encrypted_len <= 0)
+    {
+        return FALSE;
+    }
+
+    fixture->encoded_response = g_base64_encode(fixture->encrypted, fixture->encrypted_len);
+
+    return TRUE;
+}
+
+static void
+fixture_clear(Fixture *fixture)
+{
+    free(fixture->public_key);
+    free(fixture->private_key);
+    free(fixture->encrypted);
+    kiran_authentication_key_free(fixture->key);
+    g_free(fixture->encoded_response);
+}
+
+int main(int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    GArray *key_sizes;
+    GArray *thread_counts;
+    gboolean first = TRUE;
+    guint i;
+    guint j;
+
+    context = g_option_context_new("- kiran authentication crypto benchmarks");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    key_sizes = parse_int_list(key_sizes_option, "1024,2048,3072,4096");
+    thread_counts = parse_int_list(threads_option, "1,2,4");
+
+    printf("{\n  \"benchmarks\": [");
+    for (i = 0; i < key_sizes->len; i++)
+    {
+        Fixture fixture = {0};
+
+        if (!fixture_init(&fixture, g_array_index(key_sizes, guint, i)))
+        {
+            fprintf(stderr, "prepare %u bits key failed\n", g_array_index(key_sizes, guint, i));
+            fixture_clear(&fixture);
+            continue;
+        }
+
+        for (j = 0; j < thread_counts->len; j++)
+        {
+            guint n_threads = g_array_index(thread_counts, guint, j);
+
+            run_case("rsa_key_gen", op_rsa_key_gen, &fixture, n_threads, keygen_iterations, &first);
+            run_case("rsa_public_encrypt", op_rsa_public_encrypt, &fixture, n_threads, iterations, &first);
+            run_case("rsa_private_decrypt", op_rsa_private_decrypt, &fixture, n_threads, iterations, &first);
+            run_case("key_decrypt", op_key_decrypt, &fixture, n_threads, iterations, &first);
+            run_case("base64_encode_pem", op_base64_encode_pem, &fixture, n_threads, iterations * 10, &first);
+            run_case("base64_decode_response", op_base64_decode_response, &fixture, n_threads, iterations * 10, &first);
+        }
+
+        fixture_clear(&fixture);
+    }
+    printf("\n  ]\n}\n");
+
+    g_array_free(key_sizes, TRUE);
+    g_array_free(thread_counts, TRUE);
+
+    return 0;
+}
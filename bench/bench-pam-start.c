@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file bench-pam-start.c
+ *@brief 会话取得可用pam句柄的耗时测试，对比每次pam_start与使用备用句柄池，
+ *       这段时间决定了StartAuth到第一个AuthMessages信号的延迟。
+ *       用法: bench-pam-start [pam服务名] [用户名]
+ */
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "kiran-auth-pam-pool.h"
+
+#define START_ROUNDS 200
+#define POOL_SIZE 2
+
+static int
+bench_conv_cb(int msg_length,
+              const struct pam_message **msg,
+              struct pam_response **resp,
+              void *app_data)
+{
+    return PAM_CONV_ERR;
+}
+
+static int
+compare_double(gconstpointer a, gconstpointer b)
+{
+    gdouble x = *(const gdouble *)a;
+    gdouble y = *(const gdouble *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void
+report(const gchar *name, gdouble *samples, guint n)
+{
+    gdouble total = 0;
+    guint i;
+
+    for (i = 0; i < n; i++)
+    {
+        total += samples[i];
+    }
+    qsort(samples, n, sizeof(gdouble), compare_double);
+
+    printf("%-10s %12.1f %12.1f %12.1f\n",
+           name,
+           total / n,
+           samples[n / 2],
+           samples[MIN(n * 99 / 100, n - 1)]);
+}
+
+/*
+ * 等待后台线程补满备用句柄，模拟会话之间的间隔
+ */
+static void
+wait_pool_ready(KiranAuthPamPool *pool)
+{
+    KiranAuthPamPoolStats stats;
+
+    do
+    {
+        g_usleep(1000);
+        kiran_auth_pam_pool_get_stats(pool, &stats);
+    } while (stats.available < POOL_SIZE && stats.failures == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    const gchar *service = argc > 1 ? argv[1] : "kiran-auth-service";
+    const gchar *username = argc > 2 ? argv[2] : g_get_user_name();
+    struct pam_conv conversation = {bench_conv_cb, NULL};
+    gdouble cold[START_ROUNDS];
+    gdouble warm[START_ROUNDS];
+    KiranAuthPamPool *pool;
+    KiranAuthPamPoolStats stats;
+    pam_handle_t *pamh;
+    gint64 begin;
+    guint i;
+    int ret;
+
+    for (i = 0; i < START_ROUNDS; i++)
+    {
+        begin = g_get_monotonic_time();
+        ret = pam_start(service, username, &conversation, &pamh);
+        cold[i] = g_get_monotonic_time() - begin;
+        if (ret != PAM_SUCCESS)
+        {
+            fprintf(stderr, "pam_start %s failed: %s\n", service, pam_strerror(NULL, ret));
+            return 1;
+        }
+        pam_end(pamh, PAM_SUCCESS);
+    }
+
+    pool = kiran_auth_pam_pool_new(service, POOL_SIZE);
+    for (i = 0; i < START_ROUNDS; i++)
+    {
+        wait_pool_ready(pool);
+
+        begin = g_get_monotonic_time();
+        ret = kiran_auth_pam_pool_acquire(pool, username, &conversation, &pamh);
+        warm[i] = g_get_monotonic_time() - begin;
+        g_assert(ret == PAM_SUCCESS);
+        pam_end(pamh, PAM_SUCCESS);
+    }
+
+    kiran_auth_pam_pool_get_stats(pool, &stats);
+    kiran_auth_pam_pool_free(pool);
+
+    printf("service: %s, rounds: %d, standby hits: %" G_GUINT64_FORMAT "\n",
+           service, START_ROUNDS, stats.hits);
+    printf("%-10s %12s %12s %12s\n", "mode", "mean(us)", "p50(us)", "p99(us)");
+    report("pam_start", cold, START_ROUNDS);
+    report("standby", warm, START_ROUNDS);
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file bench-rsa-decrypt.c
+ *@brief 应答消息解密耗时及内存增长测试
+ *
+ * legacy: 原有实现，每次应答解析PEM，BIO和RSA对象不释放
+ * pem:    kiran_authentication_rsa_private_decrypt，每次应答解析PEM
+ * handle: kiran_authentication_key_decrypt，会话创建时解析一次
+ */
+#include <glib.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "authentication_i.h"
+
+#define ROUNDS 2000
+#define BUFFER_LEN 4096
+
+static long
+get_rss_kb()
+{
+    FILE *fp;
+    long size = 0;
+    long resident = 0;
+
+    fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        return 0;
+
+    if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int
+legacy_decrypt(unsigned char *enc_data, int data_len, const char *key, char *out)
+{
+    RSA *rsa = NULL;
+    BIO *keybio;
+
+    keybio = BIO_new_mem_buf(key, -1);
+    rsa = PEM_read_bio_RSAPrivateKey(keybio, &rsa, NULL, NULL);
+
+    return RSA_private_decrypt(data_len, enc_data, (unsigned char *)out, rsa, RSA_PKCS1_PADDING);
+}
+
+static void
+report(const char *name, gint64 begin, gint64 end, long rss_begin, long rss_end)
+{
+    printf("%-8s %12.1f %12ld\n", name, (end - begin) / (gdouble)ROUNDS, rss_end - rss_begin);
+}
+
+int main(int argc, char *argv[])
+{
+    char *public_key = NULL;
+    char *private_key = NULL;
+    unsigned char *encrypted = NULL;
+    char buf[BUFFER_LEN];
+    KiranAuthKey *key;
+    gint64 begin;
+    long rss;
+    int enc_len;
+    int i;
+
+    if (kiran_authentication_rsa_key_gen(&public_key, &private_key) != 0)
+    {
+        fprintf(stderr, "rsa key gen failed\n");
+        return 1;
+    }
+
+    enc_len = kiran_authentication_rsa_public_encrypt("password", 8, (unsigned char *)public_key, &encrypted);
+    g_assert(enc_len > 0);
+
+    printf("%-8s %12s %12s\n", "mode", "us/response", "rss_grow_kb");
+
+    rss = get_rss_kb();
+    begin = g_get_monotonic_time();
+    for (i = 0; i < ROUNDS; i++)
+    {
+        g_assert(legacy_decrypt(encrypted, enc_len, private_key, buf) == 8);
+    }
+    report("legacy", begin, g_get_monotonic_time(), rss, get_rss_kb());
+
+    rss = get_rss_kb();
+    begin = g_get_monotonic_time();
+    for (i = 0; i < ROUNDS; i++)
+    {
+        char *decrypted = NULL;
+
+        g_assert(kiran_authentication_rsa_private_decrypt(encrypted, enc_len, (unsigned char *)private_key, &decrypted) == 8);
+        free(decrypted);
+    }
+    report("pem", begin, g_get_monotonic_time(), rss, get_rss_kb());
+
+    key = kiran_authentication_key_new_private(private_key);
+    g_assert(key != NULL);
+    rss = get_rss_kb();
+    begin = g_get_monotonic_time();
+    for (i = 0; i < ROUNDS; i++)
+    {
+        g_assert(kiran_authentication_key_decrypt(key, encrypted, enc_len, buf, sizeof(buf)) == 8);
+    }
+    report("handle", begin, g_get_monotonic_time(), rss, get_rss_kb());
+
+    kiran_authentication_key_free(key);
+    free(encrypted);
+    free(public_key);
+    free(private_key);
+
+    return 0;
+}
@@ -30,8 +30,16 @@ extern "C"
 #define AUTH_SERVICE_OBJECT_PATH "/com/kylinsec/Kiran/SystemDaemon/Authentication"
 #define ASK_AUTH_SID "ReqSessionId"
 
+/* 认证线程都在使用并且排队已满，调用者应稍后重试StartAuth */
+#define AUTH_SERVICE_ERROR_BUSY "com.kylinsec.Kiran.SystemDaemon.Authentication.Error.Busy"
+
 #define MAX_RSA_TEXT_LEN 256 /* 最大可以加密的数据长度 */
 
+#define X25519_KEY_LEN 32     /* X25519公钥长度 */
+#define AEAD_NONCE_LEN 12     /* AEAD随机数长度 */
+#define AEAD_TAG_LEN 16       /* AEAD认证标签长度 */
+#define AEAD_OVERHEAD_LEN (X25519_KEY_LEN + AEAD_NONCE_LEN + AEAD_TAG_LEN)
+
     /* 消息类型 */
 #define AUTH_SERVICE_PROMPT_ECHO_OFF 1 /* 请求密文应答信息 */
 #define AUTH_SERVICE_PROMPT_ECHO_ON 2  /* 请求明文应答信息 */
@@ -66,6 +74,23 @@ extern "C"
         SESSION_AUTH_FAIL = 1,
     };
 
+    /**
+     * 应答消息的加密方式
+     *
+     * X25519方式下CreateAuthWithTransport返回的公钥为base64编码的32字节X25519公钥，
+     * 应答消息格式为: 客户端临时公钥(32) | 随机数(12) | 密文 | 认证标签(16)，
+     * 对称密钥由ECDH共享密钥经HKDF-SHA256导出
+     */
+    enum AuthTransport
+    {
+        //rsa-2048 PKCS#1加密，CreateAuth使用的方式
+        AUTH_TRANSPORT_RSA = 0,
+        //X25519密钥协商 + ChaCha20-Poly1305
+        AUTH_TRANSPORT_X25519_CHACHA20_POLY1305 = 1,
+        //X25519密钥协商 + AES-256-GCM
+        AUTH_TRANSPORT_X25519_AES_256_GCM = 2,
+    };
+
     enum SessionAuthMethod
     {
         // 没有任何验证方式
@@ -79,6 +104,22 @@ extern "C"
         SESSION_AUTH_METHOD_LAST = (1 << 3),
     };
 
+    /**
+     * 会话类别，等待认证线程以及多个会话同时使用指纹设备时按类别排队，数值越大越优先
+     */
+    enum SessionAuthClass
+    {
+        //未指定，与授权类会话同等对待
+        SESSION_AUTH_CLASS_DEFAULT = 0,
+        //polkit、sudo等授权认证
+        SESSION_AUTH_CLASS_AUTHORIZATION = 1,
+        //锁屏
+        SESSION_AUTH_CLASS_LOCK_SCREEN = 2,
+        //登录界面
+        SESSION_AUTH_CLASS_GREETER = 3,
+        SESSION_AUTH_CLASS_LAST,
+    };
+
     /**
      * @brief rsa公钥对数据进行加密
      *
@@ -117,6 +158,171 @@ extern "C"
      */
     int kiran_authentication_rsa_key_gen(char **public_key, char **private_key);
 
+    /**
+     * @brief 生成给定长度的rsa公私钥
+     *
+     * @param[in] bits 密钥长度
+     * @param[out] public_key 公钥内存地址
+     * @param [out] private_key 私钥内存地址
+     *
+     * @return 返回公私钥生成结果，当等于-1时表示生成失败
+     */
+    int kiran_authentication_rsa_key_gen_with_bits(int bits, char **public_key, char **private_key);
+
+    typedef struct _KiranAuthKey KiranAuthKey;
+
+    /**
+     * @brief 解析PEM格式的rsa私钥，返回可重复使用的私钥句柄
+     *
+     * @param[in] key 私钥内容
+     * @return 返回私钥句柄，失败时返回NULL
+     */
+    KiranAuthKey *kiran_authentication_key_new_private(const char *key);
+
+    /**
+     * @brief 解析PEM格式的rsa公钥，返回可重复使用的公钥句柄
+     *
+     * @param[in] key 公钥内容
+     * @return 返回公钥句柄，失败时返回NULL
+     */
+    KiranAuthKey *kiran_authentication_key_new_public(const char *key);
+
+    /**
+     * @brief 生成临时的X25519私钥句柄
+     *
+     * @param[in] transport 加密方式，参见AuthTransport，不能为AUTH_TRANSPORT_RSA
+     * @return 返回私钥句柄，失败时返回NULL
+     */
+    KiranAuthKey *kiran_authentication_key_new_x25519(int transport);
+
+    /**
+     * @brief 获取密钥句柄的加密方式，参见AuthTransport
+     */
+    int kiran_authentication_key_get_transport(KiranAuthKey *key);
+
+    /**
+     * @brief 获取X25519私钥句柄对应的原始公钥
+     *
+     * @param[out] public_key 公钥缓冲区
+     * @param[in] public_key_size 缓冲区大小，不能小于X25519_KEY_LEN
+     * @return 返回公钥长度，当等于-1时表示失败
+     */
+    int kiran_authentication_key_get_raw_public(KiranAuthKey *key,
+                                                unsigned char *public_key,
+                                                int public_key_size);
+
+    /**
+     * @brief 使用服务端X25519公钥对数据进行加密，供客户端使用
+     *
+     * @param[in] transport 加密方式，参见AuthTransport，不能为AUTH_TRANSPORT_RSA
+     * @param[in] data 要加密的数据
+     * @param[in] data_len 要加密的数据长度，没有长度限制
+     * @param[in] public_key 服务端的原始公钥
+     * @param[in] key_len 公钥长度，必须为X25519_KEY_LEN
+     * @param[out] encrypted 加密后数据的内存地址，使用free释放
+     * @return 返回加密后的数据长度(data_len + AEAD_OVERHEAD_LEN)，当等于-1时表示加密失败
+     */
+    int kiran_authentication_aead_encrypt(int transport,
+                                          const char *data,
+                                          int data_len,
+                                          const unsigned char *public_key,
+                                          int key_len,
+                                          unsigned char **encrypted);
+
+    /**
+     * @brief 使用公钥句柄对数据进行加密，不分配内存
+     *
+     * @param[in] data 要加密的数据
+     * @param[in] data_len 要加密的数据长度
+     * @param[out] encrypted 加密后数据的缓冲区
+     * @param[in] encrypted_size 缓冲区大小，不能小于密钥长度
+     * @return 返回加密后的数据长度，当等于-1时表示加密失败
+     */
+    int kiran_authentication_key_encrypt(KiranAuthKey *key,
+                                         const char *data,
+                                         int data_len,
+                                         unsigned char *encrypted,
+                                         int encrypted_size);
+
+    /**
+     * @brief 使用私钥句柄对数据进行解密，不分配内存，支持rsa和X25519句柄
+     *
+     * @param[in] enc_data 要解密的加密数据
+     * @param[in] data_len 要解密的加密数据长度
+     * @param[out] decrypted 解密后数据的缓冲区
+     * @param[in] decrypted_size 缓冲区大小，rsa不能小于密钥长度，X25519不能小于data_len - AEAD_OVERHEAD_LEN
+     * @return 返回解密后的数据长度，当等于-1时表示解密失败
+     */
+    int kiran_authentication_key_decrypt(KiranAuthKey *key,
+                                         const unsigned char *enc_data,
+                                         int data_len,
+                                         char *decrypted,
+                                         int decrypted_size);
+
+    /**
+     * @brief 释放密钥句柄
+     */
+    void kiran_authentication_key_free(KiranAuthKey *key);
+
+    typedef struct _KiranAuthKeyPool KiranAuthKeyPool;
+
+    /**
+     * 公私钥池统计信息
+     */
+    typedef struct _KiranAuthKeyPoolStats
+    {
+        //池中可用的密钥对数量
+        int available;
+        //正在后台生成的密钥对数量
+        int generating;
+        //后台生成的密钥对总数
+        unsigned long generated;
+        //直接从池中取到的次数
+        unsigned long hits;
+        //池为空时同步生成的次数
+        unsigned long misses;
+        //触发后台补充的次数
+        unsigned long refills;
+        //后台生成失败的次数
+        unsigned long failures;
+    } KiranAuthKeyPoolStats;
+
+    /**
+     * @brief 创建预生成的rsa公私钥池
+     *
+     * 后台线程在可用数量低于low_watermark时开始补充，直到达到high_watermark
+     *
+     * @param[in] low_watermark 开始补充的水位
+     * @param[in] high_watermark 补充的上限，小于等于0时不启用后台生成
+     * @param[in] n_threads 后台生成线程数
+     * @return 返回创建的公私钥池，失败时返回NULL
+     */
+    KiranAuthKeyPool *kiran_authentication_key_pool_new(int low_watermark,
+                                                        int high_watermark,
+                                                        int n_threads);
+
+    /**
+     * @brief 从池中取出一对公私钥，池为空时同步生成
+     *
+     * @param[out] public_key 公钥内存地址，使用free释放
+     * @param[out] private_key 私钥内存地址，使用free释放
+     * @return 返回获取结果，当等于-1时表示失败
+     */
+    int kiran_authentication_key_pool_pop(KiranAuthKeyPool *pool,
+                                          char **public_key,
+                                          char **private_key);
+
+    /**
+     * @brief 获取公私钥池统计信息
+     */
+    void kiran_authentication_key_pool_get_stats(KiranAuthKeyPool *pool,
+                                                 KiranAuthKeyPoolStats *stats);
+
+    /**
+     * @brief 停止后台线程并释放公私钥池
+     */
+    void kiran_authentication_key_pool_free(KiranAuthKeyPool *pool);
+
 #ifdef __cplusplus
 }
 #endif
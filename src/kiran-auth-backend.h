@@ -0,0 +1,79 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-backend.h
+ *@brief 认证后端模块接口。模块是认证服务从模块目录加载的共享库，导出
+ *       KIRAN_AUTH_BACKEND_MODULE_ENTRY函数，返回模块描述。每个模块提供一种认证方式，
+ *       由认证服务按会话的认证策略调用start和cancel，模块通过host->report直接报告结果。
+ *       密码和生物认证服务的指纹、人脸认证是以同样方式注册的内置模块，
+ *       加载的模块提供相同的认证方式时替换内置模块
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_BACKEND_H__
+#define __KIRAN_AUTH_BACKEND_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+//接口版本，结构体有不兼容的修改时增加
+#define KIRAN_AUTH_BACKEND_ABI_VERSION 1
+//模块导出的入口函数名
+#define KIRAN_AUTH_BACKEND_MODULE_ENTRY "kiran_auth_backend_module"
+
+/*
+ * 认证服务提供给模块的回调，handle为会话，在start到cancel或者report之间有效
+ */
+typedef struct _KiranAuthBackendHost
+{
+    guint abi_version;
+    //报告认证结果，可以在任意线程调用，username为认证通过的用户，可以为NULL
+    void (*report)(gpointer handle, gint method, gboolean success, const gchar *username);
+    //向调用者发送提示消息，type为PAM_TEXT_INFO或者PAM_ERROR_MSG
+    void (*message)(gpointer handle, const gchar *message, gint type);
+    const gchar *(*get_sid)(gpointer handle);
+    //会话认证的用户名，未指定用户时为NULL
+    const gchar *(*get_username)(gpointer handle);
+} KiranAuthBackendHost;
+
+/*
+ * 模块描述，在模块卸载前必须一直有效
+ */
+typedef struct _KiranAuthBackendModule
+{
+    //KIRAN_AUTH_BACKEND_ABI_VERSION
+    guint abi_version;
+    const gchar *name;
+    //认证方式，SessionAuthMethod中的一位，新的认证方式使用SESSION_AUTH_METHOD_LAST及之后的位
+    gint method;
+    //加载后调用一次，失败时返回FALSE，模块被卸载，可以为NULL
+    gboolean (*init)(const KiranAuthBackendHost *host, gpointer *module_data);
+    //卸载前调用，可以为NULL
+    void (*finalize)(gpointer module_data);
+    //是否可以为会话认证，在主循环中调用，为NULL时总是可以
+    gboolean (*available)(gpointer handle, gpointer module_data);
+    //开始认证，不能阻塞，结果通过host->report报告，失败时返回FALSE
+    gboolean (*start)(gpointer handle, gpointer module_data);
+    //取消认证，之后不能再使用handle，对已经报告结果的会话调用时不做任何事
+    void (*cancel)(gpointer handle, gpointer module_data);
+} KiranAuthBackendModule;
+
+//入口函数类型
+typedef const KiranAuthBackendModule *(*KiranAuthBackendModuleFunc)(void);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_BACKEND_H__ */
@@ -0,0 +1,694 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-fprint-arbiter.h"
+
+//启动后这么久之内设备就结束视为立即结束，单位毫秒
+#define REARM_QUICK_STOP_MS 1000
+//连续立即结束时重新启动的间隔从最小值开始加倍
+#define REARM_BACKOFF_MIN_MS 500
+#define REARM_BACKOFF_MAX_MS 30000
+//没有会话使用时连续立即结束这么多次后不再重新启动
+#define REARM_MAX_QUICK_STOPS 3
+
+typedef struct _ArbiterEntry ArbiterEntry;
+
+struct _ArbiterEntry
+{
+    gpointer session;
+    gint priority;
+    //请求顺序，同优先级按请求顺序排队，被抢占的会话保留原来的顺序
+    guint64 seq;
+    //上一次通知的排队位置，0表示还没有通知过
+    guint position;
+};
+
+typedef enum
+{
+    //会话获得设备，需要时先启动设备
+    ARBITER_OP_GRANT,
+    ARBITER_OP_STOP,
+    ARBITER_OP_WAITING,
+    //后台重新启动设备
+    ARBITER_OP_ARM,
+    ARBITER_OP_DISARM,
+} ArbiterOpType;
+
+/*
+ * 在锁内决定、在锁外执行的设备操作，设备操作是同步的dbus调用，
+ * 在锁内执行会让主循环查询当前使用者时等待其它线程的dbus调用
+ */
+typedef struct _ArbiterOp
+{
+    ArbiterOpType type;
+    gpointer session;
+    gboolean handoff;
+    //获得设备前需要先启动设备
+    gboolean arm;
+    //通过抢占获得设备，或者刚被抢占
+    gboolean preempted;
+    guint position;
+} ArbiterOp;
+
+struct _KiranAuthFprintArbiter
+{
+    //认证线程和主循环都会使用
+    GMutex mutex;
+
+    KiranAuthFprintArbiterFuncs funcs;
+    gpointer user_data;
+
+    //当前使用设备的会话
+    ArbiterEntry *owner;
+    //等待队列，按优先级从高到低排列
+    GQueue waiters;
+    guint64 next_seq;
+
+    guint64 grants;
+    guint64 preemptions;
+    guint64 handoffs;
+
+    //租用模式下设备空闲多久后停止，单位秒，小于0时关闭租用模式
+    gint idle_grace;
+    //设备正在运行或者已经决定启动，只在提供了arm时使用
+    gboolean armed;
+    GSource *idle_source;
+    //空闲期的截止时间，0表示不在空闲期，空闲期内设备重新启动不延长截止时间
+    gint64 idle_deadline;
+    //设备自行结束后在主循环中重新启动
+    GSource *rearm_source;
+    //上次启动设备的时间和启动后连续立即结束的次数
+    gint64 armed_time;
+    guint quick_stops;
+    guint64 arms;
+    guint64 lease_reuses;
+    guint64 idle_stops;
+};
+
+static gint
+entry_compare(gconstpointer a,
+              gconstpointer b,
+              gpointer user_data)
+{
+    const ArbiterEntry *x = a;
+    const ArbiterEntry *y = b;
+
+    if (x->priority != y->priority)
+        return y->priority - x->priority;
+
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static GList *
+find_waiter(KiranAuthFprintArbiter *arbiter,
+            gpointer session)
+{
+    GList *iter;
+
+    for (iter = arbiter->waiters.head; iter; iter = iter->next)
+    {
+        ArbiterEntry *entry = iter->data;
+
+        if (entry->session == session)
+            return iter;
+    }
+
+    return NULL;
+}
+
+static ArbiterOp *
+push_op(GQueue *ops,
+        ArbiterOpType type,
+        gpointer session)
+{
+    ArbiterOp *op = g_new0(ArbiterOp, 1);
+
+    op->type = type;
+    op->session = session;
+    g_queue_push_tail(ops, op);
+
+    return op;
+}
+
+/*
+ * 排队位置发生变化时通知等待的会话
+ */
+static void
+notify_waiters_locked(KiranAuthFprintArbiter *arbiter,
+                      ArbiterEntry *preempted,
+                      GQueue *ops)
+{
+    GList *iter;
+    guint position = 1;
+
+    for (iter = arbiter->waiters.head; iter; iter = iter->next, position++)
+    {
+        ArbiterEntry *entry = iter->data;
+
+        if (entry->position != position || entry == preempted)
+        {
+            ArbiterOp *op = push_op(ops, ARBITER_OP_WAITING, entry->session);
+
+            entry->position = position;
+            op->position = position;
+            op->preempted = (entry == preempted);
+        }
+    }
+}
+
+static void
+clear_source(GSource **source)
+{
+    if (*source)
+    {
+        g_source_destroy(*source);
+        g_source_unref(*source);
+        *source = NULL;
+    }
+}
+
+/*
+ * 会话获得设备，租用模式下设备已经在运行时直接交给会话
+ */
+static void
+grant_locked(KiranAuthFprintArbiter *arbiter,
+             ArbiterEntry *entry,
+             gboolean handoff,
+             gboolean preempted,
+             GQueue *ops)
+{
+    ArbiterOp *op;
+
+    arbiter->owner = entry;
+
+    op = push_op(ops, ARBITER_OP_GRANT, entry->session);
+    op->handoff = handoff;
+    op->preempted = preempted;
+
+    if (arbiter->funcs.arm)
+    {
+        clear_source(&arbiter->idle_source);
+        arbiter->idle_deadline = 0;
+        if (arbiter->armed)
+        {
+            arbiter->lease_reuses++;
+        }
+        else
+        {
+            //启动失败时在执行后恢复
+            arbiter->armed = TRUE;
+            op->arm = TRUE;
+        }
+    }
+}
+
+static void
+disarm_locked(KiranAuthFprintArbiter *arbiter,
+              GQueue *ops)
+{
+    clear_source(&arbiter->idle_source);
+    arbiter->idle_deadline = 0;
+    if (arbiter->armed)
+    {
+        arbiter->armed = FALSE;
+        push_op(ops, ARBITER_OP_DISARM, NULL);
+    }
+}
+
+/*
+ * 会话失去设备，关闭租用模式时同时停止设备
+ */
+static void
+revoke_locked(KiranAuthFprintArbiter *arbiter,
+              ArbiterEntry *entry,
+              GQueue *ops)
+{
+    push_op(ops, ARBITER_OP_STOP, entry->session);
+
+    if (arbiter->funcs.arm && arbiter->idle_grace < 0)
+    {
+        disarm_locked(arbiter, ops);
+    }
+}
+
+static gboolean idle_timeout_cb(gpointer user_data);
+
+/*
+ * 没有会话使用设备时开始计算空闲时间
+ */
+static void
+settle_locked(KiranAuthFprintArbiter *arbiter,
+              GQueue *ops)
+{
+    gint64 now;
+
+    if (arbiter->owner || arbiter->idle_source)
+        return;
+
+    now = g_get_monotonic_time();
+    if (arbiter->idle_deadline == 0 && arbiter->idle_grace > 0 &&
+        (arbiter->armed || arbiter->rearm_source))
+    {
+        arbiter->idle_deadline = now + (gint64)arbiter->idle_grace * G_USEC_PER_SEC;
+    }
+
+    //设备正在等待重新启动时只开始计算空闲期，启动后再设置定时器
+    if (!arbiter->armed)
+        return;
+
+    if (arbiter->idle_grace <= 0 || arbiter->idle_deadline <= now)
+    {
+        disarm_locked(arbiter, ops);
+        arbiter->idle_stops++;
+        return;
+    }
+
+    //重新启动后只等待空闲期剩余的时间
+    arbiter->idle_source = g_timeout_source_new((arbiter->idle_deadline - now + 999) / 1000);
+    g_source_set_callback(arbiter->idle_source, idle_timeout_cb, arbiter, NULL);
+    g_source_attach(arbiter->idle_source, NULL);
+}
+
+/*
+ * 设备空闲后交给等待队列中优先级最高的会话
+ */
+static void
+handoff_next_locked(KiranAuthFprintArbiter *arbiter,
+                    GQueue *ops)
+{
+    ArbiterEntry *entry;
+
+    entry = g_queue_pop_head(&arbiter->waiters);
+    if (entry)
+    {
+        grant_locked(arbiter, entry, TRUE, FALSE, ops);
+    }
+
+    notify_waiters_locked(arbiter, NULL, ops);
+}
+
+/*
+ * 会话开始认证后记录结果，失败时设备交给等待队列中的下一个会话
+ */
+static gboolean
+finish_grant_locked(KiranAuthFprintArbiter *arbiter,
+                    ArbiterOp *op,
+                    gboolean armed,
+                    gboolean started,
+                    GQueue *ops)
+{
+    if (op->arm)
+    {
+        if (armed)
+        {
+            arbiter->arms++;
+            arbiter->armed_time = g_get_monotonic_time();
+        }
+        else
+        {
+            arbiter->armed = FALSE;
+        }
+    }
+
+    if (started)
+    {
+        arbiter->grants++;
+        if (op->handoff)
+            arbiter->handoffs++;
+        if (op->preempted)
+            arbiter->preemptions++;
+        return TRUE;
+    }
+
+    //执行期间会话可能已经释放了设备
+    if (arbiter->owner && arbiter->owner->session == op->session)
+    {
+        g_clear_pointer(&arbiter->owner, g_free);
+        handoff_next_locked(arbiter, ops);
+    }
+    settle_locked(arbiter, ops);
+
+    return FALSE;
+}
+
+/*
+ * 在锁外按决定的顺序执行设备操作，执行结果可能决定新的操作
+ *
+ * @param[in] session 请求设备的会话，它获得设备后启动失败时把result设为失败，可以为NULL
+ */
+static void
+run_ops(KiranAuthFprintArbiter *arbiter,
+        GQueue *ops,
+        gpointer session,
+        KiranAuthFprintAcquireResult *result)
+{
+    ArbiterOp *op;
+
+    while ((op = g_queue_pop_head(ops)) != NULL)
+    {
+        gboolean armed = TRUE;
+        gboolean started;
+
+        switch (op->type)
+        {
+        case ARBITER_OP_GRANT:
+            if (op->arm)
+            {
+                armed = arbiter->funcs.arm(op->session, op->handoff, arbiter->user_data);
+            }
+            started = armed && arbiter->funcs.start(op->session, op->handoff, arbiter->user_data);
+
+            g_mutex_lock(&arbiter->mutex);
+            if (!finish_grant_locked(arbiter, op, armed, started, ops) && op->session == session && result)
+            {
+                *result = KIRAN_AUTH_FPRINT_FAILED;
+            }
+            g_mutex_unlock(&arbiter->mutex);
+            break;
+        case ARBITER_OP_STOP:
+            arbiter->funcs.stop(op->session, arbiter->user_data);
+            break;
+        case ARBITER_OP_WAITING:
+            arbiter->funcs.waiting(op->session, op->position, op->preempted, arbiter->user_data);
+            break;
+        case ARBITER_OP_ARM:
+            armed = arbiter->funcs.arm(op->session, FALSE, arbiter->user_data);
+
+            g_mutex_lock(&arbiter->mutex);
+            if (armed)
+            {
+                arbiter->arms++;
+                arbiter->armed_time = g_get_monotonic_time();
+                settle_locked(arbiter, ops);
+            }
+            else
+            {
+                arbiter->armed = FALSE;
+            }
+            g_mutex_unlock(&arbiter->mutex);
+            break;
+        case ARBITER_OP_DISARM:
+            arbiter->funcs.disarm(arbiter->user_data);
+            break;
+        }
+        g_free(op);
+    }
+}
+
+static gboolean
+idle_timeout_cb(gpointer user_data)
+{
+    KiranAuthFprintArbiter *arbiter = user_data;
+    GQueue ops = G_QUEUE_INIT;
+
+    g_mutex_lock(&arbiter->mutex);
+    //等待锁期间可能已经有会话获得了设备
+    if (arbiter->idle_source == g_main_current_source())
+    {
+        g_source_unref(arbiter->idle_source);
+        arbiter->idle_source = NULL;
+
+        if (arbiter->owner == NULL && arbiter->armed)
+        {
+            disarm_locked(arbiter, &ops);
+            arbiter->idle_stops++;
+        }
+        arbiter->idle_deadline = 0;
+    }
+    g_mutex_unlock(&arbiter->mutex);
+
+    run_ops(arbiter, &ops, NULL, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * 有会话使用设备，或者仍在空闲期内时才需要保持设备运行
+ */
+static gboolean
+rearm_needed_locked(KiranAuthFprintArbiter *arbiter)
+{
+    if (arbiter->owner || !g_queue_is_empty(&arbiter->waiters))
+        return TRUE;
+
+    return arbiter->idle_deadline > g_get_monotonic_time();
+}
+
+static gboolean
+rearm_cb(gpointer user_data)
+{
+    KiranAuthFprintArbiter *arbiter = user_data;
+    GQueue ops = G_QUEUE_INIT;
+
+    g_mutex_lock(&arbiter->mutex);
+    if (arbiter->rearm_source == g_main_current_source())
+    {
+        g_source_unref(arbiter->rearm_source);
+        arbiter->rearm_source = NULL;
+
+        //等待期间空闲期可能已经结束
+        if (!arbiter->armed && rearm_needed_locked(arbiter))
+        {
+            arbiter->armed = TRUE;
+            push_op(&ops, ARBITER_OP_ARM, arbiter->owner ? arbiter->owner->session : NULL);
+        }
+        else if (!arbiter->armed)
+        {
+            arbiter->idle_deadline = 0;
+        }
+    }
+    g_mutex_unlock(&arbiter->mutex);
+
+    run_ops(arbiter, &ops, NULL, NULL);
+
+    return G_SOURCE_REMOVE;
+}
+
+KiranAuthFprintArbiter *
+kiran_auth_fprint_arbiter_new(const KiranAuthFprintArbiterFuncs *funcs,
+                              gpointer user_data)
+{
+    KiranAuthFprintArbiter *arbiter = g_new0(KiranAuthFprintArbiter, 1);
+
+    g_mutex_init(&arbiter->mutex);
+    arbiter->funcs = *funcs;
+    arbiter->user_data = user_data;
+    g_queue_init(&arbiter->waiters);
+    arbiter->idle_grace = -1;
+
+    return arbiter;
+}
+
+void kiran_auth_fprint_arbiter_free(KiranAuthFprintArbiter *arbiter)
+{
+    if (arbiter == NULL)
+        return;
+
+    clear_source(&arbiter->rearm_source);
+    clear_source(&arbiter->idle_source);
+    if (arbiter->funcs.arm && arbiter->armed)
+    {
+        arbiter->funcs.disarm(arbiter->user_data);
+    }
+
+    g_free(arbiter->owner);
+    g_queue_clear_full(&arbiter->waiters, g_free);
+    g_mutex_clear(&arbiter->mutex);
+    g_free(arbiter);
+}
+
+KiranAuthFprintAcquireResult
+kiran_auth_fprint_arbiter_acquire(KiranAuthFprintArbiter *arbiter,
+                                  gpointer session,
+                                  gint priority,
+                                  gboolean occupy)
+{
+    KiranAuthFprintAcquireResult result;
+    ArbiterEntry *entry;
+    ArbiterEntry *preempted;
+    GQueue ops = G_QUEUE_INIT;
+
+    g_mutex_lock(&arbiter->mutex);
+
+    if (arbiter->owner && arbiter->owner->session == session)
+    {
+        g_mutex_unlock(&arbiter->mutex);
+        return KIRAN_AUTH_FPRINT_GRANTED;
+    }
+
+    if (find_waiter(arbiter, session))
+    {
+        g_mutex_unlock(&arbiter->mutex);
+        return KIRAN_AUTH_FPRINT_QUEUED;
+    }
+
+    entry = g_new0(ArbiterEntry, 1);
+    entry->session = session;
+    entry->priority = priority;
+    entry->seq = arbiter->next_seq++;
+
+    if (arbiter->owner == NULL)
+    {
+        grant_locked(arbiter, entry, FALSE, FALSE, &ops);
+        result = KIRAN_AUTH_FPRINT_GRANTED;
+    }
+    else if (priority > arbiter->owner->priority ||
+             (occupy && priority >= arbiter->owner->priority))
+    {
+        //抢占设备，被抢占的会话回到等待队列，抢占失败时设备还给等待的会话
+        preempted = arbiter->owner;
+        arbiter->owner = NULL;
+        revoke_locked(arbiter, preempted, &ops);
+        preempted->position = 0;
+        g_queue_insert_sorted(&arbiter->waiters, preempted, entry_compare, NULL);
+
+        grant_locked(arbiter, entry, FALSE, TRUE, &ops);
+        notify_waiters_locked(arbiter, preempted, &ops);
+        result = KIRAN_AUTH_FPRINT_GRANTED;
+    }
+    else
+    {
+        g_queue_insert_sorted(&arbiter->waiters, entry, entry_compare, NULL);
+        notify_waiters_locked(arbiter, NULL, &ops);
+        result = KIRAN_AUTH_FPRINT_QUEUED;
+    }
+
+    settle_locked(arbiter, &ops);
+    g_mutex_unlock(&arbiter->mutex);
+
+    run_ops(arbiter, &ops, session, &result);
+
+    return result;
+}
+
+gboolean
+kiran_auth_fprint_arbiter_release(KiranAuthFprintArbiter *arbiter,
+                                  gpointer session)
+{
+    GList *link;
+    gboolean ret = FALSE;
+    GQueue ops = G_QUEUE_INIT;
+
+    g_mutex_lock(&arbiter->mutex);
+
+    if (arbiter->owner && arbiter->owner->session == session)
+    {
+        revoke_locked(arbiter, arbiter->owner, &ops);
+        g_clear_pointer(&arbiter->owner, g_free);
+        handoff_next_locked(arbiter, &ops);
+        ret = TRUE;
+    }
+    else if ((link = find_waiter(arbiter, session)) != NULL)
+    {
+        g_free(link->data);
+        g_queue_delete_link(&arbiter->waiters, link);
+        notify_waiters_locked(arbiter, NULL, &ops);
+        ret = TRUE;
+    }
+
+    settle_locked(arbiter, &ops);
+    g_mutex_unlock(&arbiter->mutex);
+
+    run_ops(arbiter, &ops, NULL, NULL);
+
+    return ret;
+}
+
+void kiran_auth_fprint_arbiter_set_idle_grace(KiranAuthFprintArbiter *arbiter,
+                                              gint seconds)
+{
+    GQueue ops = G_QUEUE_INIT;
+
+    g_mutex_lock(&arbiter->mutex);
+    arbiter->idle_grace = seconds;
+    clear_source(&arbiter->idle_source);
+    settle_locked(arbiter, &ops);
+    g_mutex_unlock(&arbiter->mutex);
+
+    run_ops(arbiter, &ops, NULL, NULL);
+}
+
+void kiran_auth_fprint_arbiter_device_stopped(KiranAuthFprintArbiter *arbiter)
+{
+    guint delay;
+
+    g_mutex_lock(&arbiter->mutex);
+    arbiter->armed = FALSE;
+    clear_source(&arbiter->idle_source);
+
+    if (!arbiter->funcs.arm || arbiter->idle_grace < 0 || arbiter->rearm_source)
+    {
+        g_mutex_unlock(&arbiter->mutex);
+        return;
+    }
+
+    //设备启动后立即结束，例如设备故障，连续发生时逐渐延长重新启动的间隔
+    if (g_get_monotonic_time() - arbiter->armed_time < REARM_QUICK_STOP_MS * 1000)
+    {
+        arbiter->quick_stops++;
+    }
+    else
+    {
+        arbiter->quick_stops = 0;
+    }
+
+    //空闲的设备不再需要，或者一直立即结束时等下次有会话使用再启动
+    if (!rearm_needed_locked(arbiter) ||
+        (arbiter->owner == NULL && arbiter->quick_stops >= REARM_MAX_QUICK_STOPS))
+    {
+        arbiter->idle_deadline = 0;
+        g_mutex_unlock(&arbiter->mutex);
+        return;
+    }
+
+    if (arbiter->quick_stops == 0)
+    {
+        arbiter->rearm_source = g_idle_source_new();
+    }
+    else
+    {
+        delay = REARM_BACKOFF_MIN_MS << MIN(arbiter->quick_stops - 1, 6);
+        arbiter->rearm_source = g_timeout_source_new(MIN(delay, REARM_BACKOFF_MAX_MS));
+    }
+    g_source_set_callback(arbiter->rearm_source, rearm_cb, arbiter, NULL);
+    g_source_attach(arbiter->rearm_source, NULL);
+    g_mutex_unlock(&arbiter->mutex);
+}
+
+gpointer
+kiran_auth_fprint_arbiter_get_owner(KiranAuthFprintArbiter *arbiter)
+{
+    gpointer session;
+
+    g_mutex_lock(&arbiter->mutex);
+    session = arbiter->owner ? arbiter->owner->session : NULL;
+    g_mutex_unlock(&arbiter->mutex);
+
+    return session;
+}
+
+void kiran_auth_fprint_arbiter_get_stats(KiranAuthFprintArbiter *arbiter,
+                                         KiranAuthFprintArbiterStats *stats)
+{
+    g_mutex_lock(&arbiter->mutex);
+    stats->waiting = g_queue_get_length(&arbiter->waiters);
+    stats->grants = arbiter->grants;
+    stats->preemptions = arbiter->preemptions;
+    stats->handoffs = arbiter->handoffs;
+    stats->armed = arbiter->armed;
+    stats->arms = arbiter->arms;
+    stats->lease_reuses = arbiter->lease_reuses;
+    stats->idle_stops = arbiter->idle_stops;
+    g_mutex_unlock(&arbiter->mutex);
+}
@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-fprint-arbiter.h
+ *@brief 指纹设备仲裁，多个会话按优先级排队使用同一个指纹设备，
+ *       人脸设备使用另一个仲裁实例。提供arm和disarm时使用租用模式，设备操作
+ *       在会话之间保持运行，识别结果交给当前使用者，空闲一段时间后才停止设备
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_FPRINT_ARBITER_H__
+#define __KIRAN_AUTH_FPRINT_ARBITER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _KiranAuthFprintArbiter KiranAuthFprintArbiter;
+
+/*
+ * 设备操作，在仲裁锁外按决定的顺序调用，回调中不能再调用仲裁接口
+ */
+typedef struct _KiranAuthFprintArbiterFuncs
+{
+    //会话获得设备，开始指纹认证，handoff为TRUE表示排队后获得设备，失败时返回FALSE
+    gboolean (*start)(gpointer session, gboolean handoff, gpointer user_data);
+    //会话失去设备，停止指纹认证
+    void (*stop)(gpointer session, gpointer user_data);
+    //会话正在排队，position从1开始，preempted为TRUE表示刚被高优先级会话抢占
+    void (*waiting)(gpointer session, guint position, gboolean preempted, gpointer user_data);
+    //启动设备，session为触发启动的会话，后台重新启动时为NULL，失败时返回FALSE，可以为NULL
+    gboolean (*arm)(gpointer session, gboolean handoff, gpointer user_data);
+    //停止设备，与arm同时提供
+    void (*disarm)(gpointer user_data);
+} KiranAuthFprintArbiterFuncs;
+
+typedef enum
+{
+    //获得设备并已开始认证
+    KIRAN_AUTH_FPRINT_GRANTED,
+    //设备被占用，已进入等待队列
+    KIRAN_AUTH_FPRINT_QUEUED,
+    //开始认证失败
+    KIRAN_AUTH_FPRINT_FAILED,
+} KiranAuthFprintAcquireResult;
+
+typedef struct _KiranAuthFprintArbiterStats
+{
+    guint waiting;
+    guint64 grants;
+    guint64 preemptions;
+    guint64 handoffs;
+    //设备是否正在运行
+    gboolean armed;
+    //启动设备的次数
+    guint64 arms;
+    //直接使用已运行设备的次数
+    guint64 lease_reuses;
+    //空闲超时后停止设备的次数
+    guint64 idle_stops;
+} KiranAuthFprintArbiterStats;
+
+KiranAuthFprintArbiter *kiran_auth_fprint_arbiter_new(const KiranAuthFprintArbiterFuncs *funcs,
+                                                      gpointer user_data);
+
+/**
+ * @brief 释放仲裁，设备正在运行时调用disarm
+ */
+void kiran_auth_fprint_arbiter_free(KiranAuthFprintArbiter *arbiter);
+
+/**
+ * @brief 设置租用模式下设备空闲多久后停止，只对提供了arm的仲裁有效
+ *
+ * @param[in] seconds 空闲时间，单位秒，0表示没有会话使用时立即停止，
+ *                    小于0时关闭租用模式，每个会话释放设备时都停止设备
+ */
+void kiran_auth_fprint_arbiter_set_idle_grace(KiranAuthFprintArbiter *arbiter,
+                                              gint seconds);
+
+/**
+ * @brief 设备操作已经自行结束，例如识别到指纹后，下次使用时重新启动。
+ *        租用模式下有会话使用设备或者仍在空闲期内时在主循环中重新启动，
+ *        空闲期从没有会话使用时开始计算，重新启动不延长空闲期；设备启动后
+ *        连续立即结束时逐渐延长重新启动的间隔，没有会话使用时不再重新启动
+ */
+void kiran_auth_fprint_arbiter_device_stopped(KiranAuthFprintArbiter *arbiter);
+
+/**
+ * @brief 请求使用指纹设备
+ *
+ * 设备空闲时直接获得设备；优先级高于当前使用者，或者occupy为TRUE且优先级不低于
+ * 当前使用者时抢占设备，被抢占的会话回到等待队列的同优先级队首；否则按优先级排队，
+ * 同优先级先到先得
+ *
+ * @param[in] priority 会话优先级，数值越大越优先
+ * @param[in] occupy 是否抢占同优先级会话
+ */
+KiranAuthFprintAcquireResult kiran_auth_fprint_arbiter_acquire(KiranAuthFprintArbiter *arbiter,
+                                                               gpointer session,
+                                                               gint priority,
+                                                               gboolean occupy);
+
+/**
+ * @brief 会话不再使用指纹设备，使用者释放时设备交给等待队列中的下一个会话
+ *
+ * @return 会话正在使用设备或者正在排队时返回TRUE
+ */
+gboolean kiran_auth_fprint_arbiter_release(KiranAuthFprintArbiter *arbiter,
+                                           gpointer session);
+
+/**
+ * @brief 当前使用指纹设备的会话
+ */
+gpointer kiran_auth_fprint_arbiter_get_owner(KiranAuthFprintArbiter *arbiter);
+
+void kiran_auth_fprint_arbiter_get_stats(KiranAuthFprintArbiter *arbiter,
+                                         KiranAuthFprintArbiterStats *stats);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_FPRINT_ARBITER_H__ */
@@ -0,0 +1,205 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-mock-backend.c
+ *@brief 用于测试的认证后端模块，也是编写模块的参考。开始认证后等待一段时间报告
+ *       固定的结果。模块不会被安装，只有开启BUILD_MOCK_AUTH_MODULE构建的认证服务在环境变量
+ *       KIRAN_AUTH_TEST_MODULE_DIR指向构建目录时才会加载，行为由认证服务的环境变量控制：
+ *       KIRAN_AUTH_MOCK_METHOD  认证方式，默认SESSION_AUTH_METHOD_LAST，设为2时替换指纹认证
+ *       KIRAN_AUTH_MOCK_RESULT  success、fail或者none，none时不报告结果，用于测试超时，默认success
+ *       KIRAN_AUTH_MOCK_DELAY   报告结果前等待的时间，单位毫秒，默认100
+ *       KIRAN_AUTH_MOCK_USER    报告的用户名，默认为会话的用户名
+ */
+#include <gmodule.h>
+#include <security/pam_appl.h>
+#include <stdlib.h>
+#include "authentication_i.h"
+#include "kiran-auth-backend.h"
+
+#define MOCK_DEFAULT_DELAY 100
+
+typedef enum
+{
+    MOCK_RESULT_SUCCESS,
+    MOCK_RESULT_FAIL,
+    MOCK_RESULT_NONE,
+} MockResult;
+
+typedef struct _MockBackend
+{
+    const KiranAuthBackendHost *host;
+    MockResult result;
+    guint delay;
+    gchar *username;
+
+    //start和cancel可能在不同线程调用
+    GMutex mutex;
+    //正在等待的会话，值为定时器
+    GHashTable *pending;
+} MockBackend;
+
+typedef struct _MockRequest
+{
+    MockBackend *mock;
+    gpointer handle;
+} MockRequest;
+
+static KiranAuthBackendModule mock_module;
+
+static gboolean
+mock_report_cb(gpointer user_data)
+{
+    MockRequest *request = user_data;
+    MockBackend *mock = request->mock;
+    gboolean success = (mock->result == MOCK_RESULT_SUCCESS);
+
+    g_mutex_lock(&mock->mutex);
+    //等待锁期间可能已经被取消
+    if (g_hash_table_lookup(mock->pending, request->handle) != g_main_current_source())
+    {
+        g_mutex_unlock(&mock->mutex);
+        return G_SOURCE_REMOVE;
+    }
+    g_hash_table_remove(mock->pending, request->handle);
+    g_mutex_unlock(&mock->mutex);
+
+    mock->host->message(request->handle,
+                        success ? "Mock authentication passed" : "Mock authentication failed",
+                        success ? PAM_TEXT_INFO : PAM_ERROR_MSG);
+    mock->host->report(request->handle,
+                       mock_module.method,
+                       success,
+                       mock->username ? mock->username : mock->host->get_username(request->handle));
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+mock_init(const KiranAuthBackendHost *host,
+          gpointer *module_data)
+{
+    MockBackend *mock = g_new0(MockBackend, 1);
+    const gchar *value;
+
+    mock->host = host;
+    mock->result = MOCK_RESULT_SUCCESS;
+    mock->delay = MOCK_DEFAULT_DELAY;
+
+    value = g_getenv("KIRAN_AUTH_MOCK_RESULT");
+    if (g_strcmp0(value, "fail") == 0)
+    {
+        mock->result = MOCK_RESULT_FAIL;
+    }
+    else if (g_strcmp0(value, "none") == 0)
+    {
+        mock->result = MOCK_RESULT_NONE;
+    }
+
+    value = g_getenv("KIRAN_AUTH_MOCK_DELAY");
+    if (value)
+    {
+        mock->delay = strtoul(value, NULL, 10);
+    }
+
+    mock->username = g_strdup(g_getenv("KIRAN_AUTH_MOCK_USER"));
+
+    g_mutex_init(&mock->mutex);
+    mock->pending = g_hash_table_new_full(g_direct_hash,
+                                          g_direct_equal,
+                                          NULL,
+                                          (GDestroyNotify)g_source_unref);
+
+    *module_data = mock;
+
+    return TRUE;
+}
+
+static void
+mock_finalize(gpointer module_data)
+{
+    MockBackend *mock = module_data;
+    GHashTableIter iter;
+    gpointer source;
+
+    g_hash_table_iter_init(&iter, mock->pending);
+    while (g_hash_table_iter_next(&iter, NULL, &source))
+    {
+        g_source_destroy(source);
+    }
+    g_hash_table_destroy(mock->pending);
+    g_mutex_clear(&mock->mutex);
+    g_free(mock->username);
+    g_free(mock);
+}
+
+static gboolean
+mock_start(gpointer handle,
+           gpointer module_data)
+{
+    MockBackend *mock = module_data;
+    MockRequest *request;
+    GSource *source;
+
+    if (mock->result == MOCK_RESULT_NONE)
+        return TRUE;
+
+    request = g_new0(MockRequest, 1);
+    request->mock = mock;
+    request->handle = handle;
+
+    source = g_timeout_source_new(mock->delay);
+    g_source_set_callback(source, mock_report_cb, request, g_free);
+
+    g_mutex_lock(&mock->mutex);
+    g_hash_table_insert(mock->pending, handle, source);
+    g_source_attach(source, NULL);
+    g_mutex_unlock(&mock->mutex);
+
+    return TRUE;
+}
+
+static void
+mock_cancel(gpointer handle,
+            gpointer module_data)
+{
+    MockBackend *mock = module_data;
+    GSource *source;
+
+    g_mutex_lock(&mock->mutex);
+    source = g_hash_table_lookup(mock->pending, handle);
+    if (source)
+    {
+        g_source_destroy(source);
+        g_hash_table_remove(mock->pending, handle);
+    }
+    g_mutex_unlock(&mock->mutex);
+}
+
+G_MODULE_EXPORT const KiranAuthBackendModule *
+kiran_auth_backend_module(void)
+{
+    const gchar *method = g_getenv("KIRAN_AUTH_MOCK_METHOD");
+
+    mock_module.abi_version = KIRAN_AUTH_BACKEND_ABI_VERSION;
+    mock_module.name = "mock";
+    mock_module.method = method ? atoi(method) : SESSION_AUTH_METHOD_LAST;
+    mock_module.init = mock_init;
+    mock_module.finalize = mock_finalize;
+    mock_module.available = NULL;
+    mock_module.start = mock_start;
+    mock_module.cancel = mock_cancel;
+
+    return &mock_module;
+}
@@ -0,0 +1,267 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-modules.h"
+#include <gmodule.h>
+#ifdef ENABLE_ZLOG_EX
+#include <zlog_ex.h>
+#else
+#include <zlog.h>
+#endif
+
+typedef struct _ModuleEntry
+{
+    const KiranAuthBackendModule *module;
+    gpointer module_data;
+    //内置模块为NULL
+    GModule *library;
+} ModuleEntry;
+
+struct _KiranAuthModules
+{
+    const KiranAuthBackendHost *host;
+    //元素为ModuleEntry
+    GArray *entries;
+};
+
+static void
+module_entry_clear(ModuleEntry *entry)
+{
+    if (entry->module->finalize)
+    {
+        entry->module->finalize(entry->module_data);
+    }
+
+    if (entry->library)
+    {
+        g_module_close(entry->library);
+    }
+}
+
+static gboolean
+method_is_valid(gint method)
+{
+    //每个模块只提供一种认证方式
+    return method > 0 && (method & (method - 1)) == 0;
+}
+
+static void
+modules_insert(KiranAuthModules *modules,
+               const ModuleEntry *entry)
+{
+    guint i;
+
+    for (i = 0; i < modules->entries->len; i++)
+    {
+        ModuleEntry *old = &g_array_index(modules->entries, ModuleEntry, i);
+
+        if (old->module->method == entry->module->method)
+        {
+            dzlog_info("Auth module %s replaces %s for method %d",
+                       entry->module->name, old->module->name, entry->module->method);
+            module_entry_clear(old);
+            *old = *entry;
+            return;
+        }
+    }
+
+    g_array_append_val(modules->entries, *entry);
+}
+
+KiranAuthModules *
+kiran_auth_modules_new(const KiranAuthBackendHost *host)
+{
+    KiranAuthModules *modules = g_new0(KiranAuthModules, 1);
+
+    modules->host = host;
+    modules->entries = g_array_new(FALSE, TRUE, sizeof(ModuleEntry));
+
+    return modules;
+}
+
+void kiran_auth_modules_free(KiranAuthModules *modules)
+{
+    guint i;
+
+    if (modules == NULL)
+        return;
+
+    for (i = 0; i < modules->entries->len; i++)
+    {
+        module_entry_clear(&g_array_index(modules->entries, ModuleEntry, i));
+    }
+
+    g_array_free(modules->entries, TRUE);
+    g_free(modules);
+}
+
+void kiran_auth_modules_add(KiranAuthModules *modules,
+                            const KiranAuthBackendModule *module,
+                            gpointer module_data)
+{
+    ModuleEntry entry = {module, module_data, NULL};
+
+    g_return_if_fail(method_is_valid(module->method));
+
+    modules_insert(modules, &entry);
+}
+
+static gboolean
+modules_load_file(KiranAuthModules *modules,
+                  const gchar *path)
+{
+    KiranAuthBackendModuleFunc module_func = NULL;
+    ModuleEntry entry = {0};
+
+    //模块之间的符号互不可见，避免不同模块的同名符号冲突
+    entry.library = g_module_open(path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+    if (entry.library == NULL)
+    {
+        dzlog_error("Open auth module %s failed: %s", path, g_module_error());
+        return FALSE;
+    }
+
+    if (!g_module_symbol(entry.library,
+                         KIRAN_AUTH_BACKEND_MODULE_ENTRY,
+                         (gpointer *)&module_func) ||
+        module_func == NULL)
+    {
+        dzlog_error("Auth module %s has no entry %s", path, KIRAN_AUTH_BACKEND_MODULE_ENTRY);
+        g_module_close(entry.library);
+        return FALSE;
+    }
+
+    entry.module = module_func();
+    if (entry.module == NULL ||
+        entry.module->abi_version != KIRAN_AUTH_BACKEND_ABI_VERSION ||
+        !method_is_valid(entry.module->method) ||
+        entry.module->start == NULL ||
+        entry.module->cancel == NULL)
+    {
+        dzlog_error("Auth module %s is incompatible, abi version: %u",
+                    path, entry.module ? entry.module->abi_version : 0);
+        g_module_close(entry.library);
+        return FALSE;
+    }
+
+    if (entry.module->init && !entry.module->init(modules->host, &entry.module_data))
+    {
+        dzlog_error("Init auth module %s failed", path);
+        g_module_close(entry.library);
+        return FALSE;
+    }
+
+    dzlog_info("Load auth module %s from %s, method: %d",
+               entry.module->name, path, entry.module->method);
+    modules_insert(modules, &entry);
+
+    return TRUE;
+}
+
+static gint
+compare_file_name(gconstpointer a,
+                  gconstpointer b)
+{
+    return g_strcmp0(*(const gchar **)a, *(const gchar **)b);
+}
+
+guint kiran_auth_modules_load_dir(KiranAuthModules *modules,
+                                  const gchar *dir)
+{
+    GPtrArray *files;
+    const gchar *name;
+    GDir *gdir;
+    guint count = 0;
+    guint i;
+
+    gdir = g_dir_open(dir, 0, NULL);
+    if (gdir == NULL)
+        return 0;
+
+    //按文件名排序，提供相同认证方式的模块中文件名靠后的生效
+    files = g_ptr_array_new_with_free_func(g_free);
+    while ((name = g_dir_read_name(gdir)) != NULL)
+    {
+        if (g_str_has_suffix(name, "." G_MODULE_SUFFIX))
+        {
+            g_ptr_array_add(files, g_build_filename(dir, name, NULL));
+        }
+    }
+    g_dir_close(gdir);
+    g_ptr_array_sort(files, compare_file_name);
+
+    for (i = 0; i < files->len; i++)
+    {
+        if (modules_load_file(modules, g_ptr_array_index(files, i)))
+        {
+            count++;
+        }
+    }
+    g_ptr_array_free(files, TRUE);
+
+    return count;
+}
+
+const KiranAuthBackendModule *
+kiran_auth_modules_lookup(KiranAuthModules *modules,
+                          gint method,
+                          gpointer *module_data)
+{
+    guint i;
+
+    for (i = 0; i < modules->entries->len; i++)
+    {
+        ModuleEntry *entry = &g_array_index(modules->entries, ModuleEntry, i);
+
+        if (entry->module->method == method)
+        {
+            if (module_data)
+            {
+                *module_data = entry->module_data;
+            }
+            return entry->module;
+        }
+    }
+
+    return NULL;
+}
+
+gint kiran_auth_modules_get_methods(KiranAuthModules *modules)
+{
+    gint methods = 0;
+    guint i;
+
+    for (i = 0; i < modules->entries->len; i++)
+    {
+        methods |= g_array_index(modules->entries, ModuleEntry, i).module->method;
+    }
+
+    return methods;
+}
+
+guint kiran_auth_modules_get_loaded(KiranAuthModules *modules)
+{
+    guint loaded = 0;
+    guint i;
+
+    for (i = 0; i < modules->entries->len; i++)
+    {
+        if (g_array_index(modules->entries, ModuleEntry, i).library)
+        {
+            loaded++;
+        }
+    }
+
+    return loaded;
+}
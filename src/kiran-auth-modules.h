@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-modules.h
+ *@brief 认证后端模块表，按认证方式记录内置模块和从模块目录加载的模块，
+ *       同一种认证方式后注册的模块替换先注册的模块。只在主循环中使用
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_MODULES_H__
+#define __KIRAN_AUTH_MODULES_H__
+
+#include <glib.h>
+#include "kiran-auth-backend.h"
+
+G_BEGIN_DECLS
+
+typedef struct _KiranAuthModules KiranAuthModules;
+
+/**
+ * @brief 创建模块表
+ *
+ * @param[in] host 传给加载的模块的回调，需要在模块表释放前一直有效
+ */
+KiranAuthModules *kiran_auth_modules_new(const KiranAuthBackendHost *host);
+
+/**
+ * @brief 调用所有模块的finalize并卸载加载的模块，调用前不能再有正在进行的认证
+ */
+void kiran_auth_modules_free(KiranAuthModules *modules);
+
+/**
+ * @brief 注册内置模块，不调用init，module_data直接传给模块的回调
+ */
+void kiran_auth_modules_add(KiranAuthModules *modules,
+                            const KiranAuthBackendModule *module,
+                            gpointer module_data);
+
+/**
+ * @brief 按文件名顺序加载目录中的所有模块，目录不存在时不做任何事
+ *
+ * @return 成功加载的模块数
+ */
+guint kiran_auth_modules_load_dir(KiranAuthModules *modules,
+                                  const gchar *dir);
+
+/**
+ * @brief 查找认证方式对应的模块
+ *
+ * @param[out] module_data 模块数据，可以为NULL
+ * @return 没有对应模块时返回NULL
+ */
+const KiranAuthBackendModule *kiran_auth_modules_lookup(KiranAuthModules *modules,
+                                                        gint method,
+                                                        gpointer *module_data);
+
+/**
+ * @brief 所有已注册的认证方式
+ */
+gint kiran_auth_modules_get_methods(KiranAuthModules *modules);
+
+/**
+ * @brief 从模块目录加载的模块数
+ */
+guint kiran_auth_modules_get_loaded(KiranAuthModules *modules);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_MODULES_H__ */
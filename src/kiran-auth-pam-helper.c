@@ -0,0 +1,281 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-pam-helper.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef ENABLE_ZLOG_EX
+#include <zlog_ex.h>
+#else
+#include <zlog.h>
+#endif
+#include "kiran-auth-pam-proto.h"
+
+struct _KiranAuthPamHelper
+{
+    GPid pid;
+    //与辅助进程通信的socket
+    int fd;
+    //已经执行的认证次数
+    guint uses;
+};
+
+struct _KiranAuthPamHelperPool
+{
+    GMutex mutex;
+
+    gchar *path;
+    gint size;
+    gint max_uses;
+
+    //空闲的辅助进程
+    GQueue idle;
+    guint busy;
+
+    guint64 spawned;
+    guint64 retired;
+    guint64 failures;
+};
+
+/*
+ * 在子进程exec之前调用，只能使用异步信号安全的函数
+ */
+static void
+helper_child_setup(gpointer user_data)
+{
+    int fd = GPOINTER_TO_INT(user_data);
+
+    if (fd == KIRAN_AUTH_PAM_PROTO_FD)
+    {
+        fcntl(fd, F_SETFD, 0);
+    }
+    else
+    {
+        dup2(fd, KIRAN_AUTH_PAM_PROTO_FD);
+    }
+}
+
+static KiranAuthPamHelper *
+helper_spawn(KiranAuthPamHelperPool *pool)
+{
+    KiranAuthPamHelper *helper;
+    gchar *argv[] = {pool->path, NULL};
+    GError *error = NULL;
+    GPid pid;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+    {
+        dzlog_error("Create pam helper socket failed: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    if (!g_spawn_async(NULL,
+                       argv,
+                       NULL,
+                       G_SPAWN_DO_NOT_REAP_CHILD,
+                       helper_child_setup,
+                       GINT_TO_POINTER(sv[1]),
+                       &pid,
+                       &error))
+    {
+        dzlog_error("Spawn pam helper %s failed: %s", pool->path, error->message);
+        g_error_free(error);
+        close(sv[0]);
+        close(sv[1]);
+        return NULL;
+    }
+
+    close(sv[1]);
+
+    helper = g_new0(KiranAuthPamHelper, 1);
+    helper->pid = pid;
+    helper->fd = sv[0];
+
+    dzlog_debug("Spawn pam helper %d", pid);
+
+    return helper;
+}
+
+static void
+helper_retire(KiranAuthPamHelper *helper,
+              gboolean force)
+{
+    //空闲的辅助进程读到EOF后自行退出，正在认证的辅助进程可能阻塞在pam模块中
+    close(helper->fd);
+    if (force)
+    {
+        kill(helper->pid, SIGKILL);
+    }
+
+    while (waitpid(helper->pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+    g_spawn_close_pid(helper->pid);
+
+    dzlog_debug("Retire pam helper %d after %u authentications", helper->pid, helper->uses);
+    g_free(helper);
+}
+
+KiranAuthPamHelperPool *
+kiran_auth_pam_helper_pool_new(const gchar *path,
+                               gint size,
+                               gint max_uses)
+{
+    KiranAuthPamHelperPool *pool = g_new0(KiranAuthPamHelperPool, 1);
+    gint i;
+
+    g_mutex_init(&pool->mutex);
+    g_queue_init(&pool->idle);
+    pool->path = g_strdup(path);
+    pool->size = MAX(size, 0);
+    pool->max_uses = max_uses;
+
+    for (i = 0; i < pool->size; i++)
+    {
+        KiranAuthPamHelper *helper = helper_spawn(pool);
+
+        if (helper == NULL)
+        {
+            pool->failures++;
+            break;
+        }
+        pool->spawned++;
+        g_queue_push_tail(&pool->idle, helper);
+    }
+
+    return pool;
+}
+
+void kiran_auth_pam_helper_pool_free(KiranAuthPamHelperPool *pool)
+{
+    KiranAuthPamHelper *helper;
+
+    if (pool == NULL)
+        return;
+
+    while ((helper = g_queue_pop_head(&pool->idle)) != NULL)
+    {
+        helper_retire(helper, FALSE);
+    }
+
+    g_mutex_clear(&pool->mutex);
+    g_free(pool->path);
+    g_free(pool);
+}
+
+KiranAuthPamHelper *
+kiran_auth_pam_helper_pool_acquire(KiranAuthPamHelperPool *pool)
+{
+    KiranAuthPamHelper *helper;
+
+    g_mutex_lock(&pool->mutex);
+    helper = g_queue_pop_head(&pool->idle);
+    if (helper)
+    {
+        pool->busy++;
+    }
+    g_mutex_unlock(&pool->mutex);
+
+    if (helper)
+        return helper;
+
+    //启动进程比较耗时，不在锁内进行
+    helper = helper_spawn(pool);
+
+    g_mutex_lock(&pool->mutex);
+    if (helper)
+    {
+        pool->spawned++;
+        pool->busy++;
+    }
+    else
+    {
+        pool->failures++;
+    }
+    g_mutex_unlock(&pool->mutex);
+
+    return helper;
+}
+
+void kiran_auth_pam_helper_pool_release(KiranAuthPamHelperPool *pool,
+                                        KiranAuthPamHelper *helper,
+                                        gboolean reusable)
+{
+    KiranAuthPamHelper *replacement = NULL;
+    gboolean retire;
+
+    helper->uses++;
+    retire = !reusable || (pool->max_uses > 0 && helper->uses >= (guint)pool->max_uses);
+
+    g_mutex_lock(&pool->mutex);
+    pool->busy--;
+    if (!retire && g_queue_get_length(&pool->idle) < (guint)pool->size)
+    {
+        g_queue_push_tail(&pool->idle, helper);
+        helper = NULL;
+    }
+    else
+    {
+        pool->retired++;
+    }
+    g_mutex_unlock(&pool->mutex);
+
+    if (helper == NULL)
+        return;
+
+    helper_retire(helper, !reusable);
+
+    //保持预先启动的辅助进程数量
+    g_mutex_lock(&pool->mutex);
+    retire = g_queue_get_length(&pool->idle) + pool->busy >= (guint)pool->size;
+    g_mutex_unlock(&pool->mutex);
+
+    if (!retire)
+    {
+        replacement = helper_spawn(pool);
+    }
+
+    g_mutex_lock(&pool->mutex);
+    if (replacement)
+    {
+        pool->spawned++;
+        g_queue_push_tail(&pool->idle, replacement);
+    }
+    else if (!retire)
+    {
+        pool->failures++;
+    }
+    g_mutex_unlock(&pool->mutex);
+}
+
+int kiran_auth_pam_helper_get_fd(KiranAuthPamHelper *helper)
+{
+    return helper->fd;
+}
+
+void kiran_auth_pam_helper_pool_get_stats(KiranAuthPamHelperPool *pool,
+                                          KiranAuthPamHelperStats *stats)
+{
+    g_mutex_lock(&pool->mutex);
+    stats->idle = g_queue_get_length(&pool->idle);
+    stats->busy = pool->busy;
+    stats->spawned = pool->spawned;
+    stats->retired = pool->retired;
+    stats->failures = pool->failures;
+    g_mutex_unlock(&pool->mutex);
+}
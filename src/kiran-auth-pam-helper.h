@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-pam-helper.h
+ *@brief 预先创建的pam辅助进程池，pam认证在辅助进程中执行，
+ *       进程全局状态和内存泄漏不会影响认证服务，辅助进程使用一定次数后回收
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_PAM_HELPER_H__
+#define __KIRAN_AUTH_PAM_HELPER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _KiranAuthPamHelperPool KiranAuthPamHelperPool;
+typedef struct _KiranAuthPamHelper KiranAuthPamHelper;
+
+typedef struct _KiranAuthPamHelperStats
+{
+    //空闲的辅助进程数
+    guint idle;
+    //正在认证的辅助进程数
+    guint busy;
+    guint64 spawned;
+    guint64 retired;
+    guint64 failures;
+} KiranAuthPamHelperStats;
+
+/**
+ * @brief 创建辅助进程池，并预先启动size个辅助进程
+ *
+ * @param[in] path 辅助进程可执行文件路径
+ * @param[in] size 保持空闲的辅助进程数
+ * @param[in] max_uses 每个辅助进程最多执行的认证次数，小于等于0时不限制
+ */
+KiranAuthPamHelperPool *kiran_auth_pam_helper_pool_new(const gchar *path,
+                                                       gint size,
+                                                       gint max_uses);
+
+/**
+ * @brief 结束所有空闲的辅助进程并释放进程池，调用前所有辅助进程必须已经归还
+ */
+void kiran_auth_pam_helper_pool_free(KiranAuthPamHelperPool *pool);
+
+/**
+ * @brief 取出一个空闲的辅助进程，没有空闲进程时新启动一个，可以在任意线程调用
+ *
+ * @return 启动辅助进程失败时返回NULL
+ */
+KiranAuthPamHelper *kiran_auth_pam_helper_pool_acquire(KiranAuthPamHelperPool *pool);
+
+/**
+ * @brief 归还辅助进程
+ *
+ * @param[in] reusable 认证正常结束时为TRUE，为FALSE时辅助进程会被强制结束
+ */
+void kiran_auth_pam_helper_pool_release(KiranAuthPamHelperPool *pool,
+                                        KiranAuthPamHelper *helper,
+                                        gboolean reusable);
+
+/**
+ * @brief 与辅助进程通信的socket
+ */
+int kiran_auth_pam_helper_get_fd(KiranAuthPamHelper *helper);
+
+void kiran_auth_pam_helper_pool_get_stats(KiranAuthPamHelperPool *pool,
+                                          KiranAuthPamHelperStats *stats);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_PAM_HELPER_H__ */
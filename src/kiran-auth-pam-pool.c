@@ -0,0 +1,185 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-pam-pool.h"
+
+struct _KiranAuthPamPool
+{
+    GMutex mutex;
+    GCond refill_cond;
+
+    gchar *service;
+    gint size;
+
+    //备用句柄，均未设置用户
+    GQueue handles;
+    gboolean stopping;
+    GThread *thread;
+
+    KiranAuthPamPoolStats stats;
+};
+
+/*
+ * 备用句柄在取出前不会进行对话
+ */
+static int
+standby_conv_cb(int msg_length,
+                const struct pam_message **msg,
+                struct pam_response **resp,
+                void *app_data)
+{
+    return PAM_CONV_ERR;
+}
+
+static const struct pam_conv standby_conversation = {standby_conv_cb, NULL};
+
+static gpointer
+pam_pool_worker(gpointer data)
+{
+    KiranAuthPamPool *pool = data;
+    pam_handle_t *pamh;
+    int ret;
+
+    g_mutex_lock(&pool->mutex);
+    while (TRUE)
+    {
+        while (!pool->stopping &&
+               g_queue_get_length(&pool->handles) >= (guint)pool->size)
+        {
+            g_cond_wait(&pool->refill_cond, &pool->mutex);
+        }
+
+        if (pool->stopping)
+            break;
+
+        g_mutex_unlock(&pool->mutex);
+
+        //读取配置并加载模块，这是pam_start的主要耗时
+        pamh = NULL;
+        ret = pam_start(pool->service, NULL, &standby_conversation, &pamh);
+
+        g_mutex_lock(&pool->mutex);
+        if (ret != PAM_SUCCESS)
+        {
+            pool->stats.failures++;
+            if (pamh)
+            {
+                pam_end(pamh, ret);
+            }
+
+            //配置有误时不反复重试，等下次取出句柄时再补充
+            g_cond_wait(&pool->refill_cond, &pool->mutex);
+            continue;
+        }
+
+        g_queue_push_tail(&pool->handles, pamh);
+    }
+    g_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+KiranAuthPamPool *
+kiran_auth_pam_pool_new(const gchar *service,
+                        gint size)
+{
+    KiranAuthPamPool *pool = g_new0(KiranAuthPamPool, 1);
+
+    g_mutex_init(&pool->mutex);
+    g_cond_init(&pool->refill_cond);
+    g_queue_init(&pool->handles);
+    pool->service = g_strdup(service);
+    pool->size = MAX(size, 1);
+    pool->thread = g_thread_new("pam-pool", pam_pool_worker, pool);
+
+    return pool;
+}
+
+void kiran_auth_pam_pool_free(KiranAuthPamPool *pool)
+{
+    pam_handle_t *pamh;
+
+    if (pool == NULL)
+        return;
+
+    g_mutex_lock(&pool->mutex);
+    pool->stopping = TRUE;
+    g_cond_broadcast(&pool->refill_cond);
+    g_mutex_unlock(&pool->mutex);
+
+    g_thread_join(pool->thread);
+
+    while ((pamh = g_queue_pop_head(&pool->handles)) != NULL)
+    {
+        pam_end(pamh, PAM_SUCCESS);
+    }
+
+    g_cond_clear(&pool->refill_cond);
+    g_mutex_clear(&pool->mutex);
+    g_free(pool->service);
+    g_free(pool);
+}
+
+int kiran_auth_pam_pool_acquire(KiranAuthPamPool *pool,
+                                const gchar *username,
+                                const struct pam_conv *conversation,
+                                pam_handle_t **pamh)
+{
+    pam_handle_t *handle;
+    int ret;
+
+    g_mutex_lock(&pool->mutex);
+    handle = g_queue_pop_head(&pool->handles);
+    if (handle)
+    {
+        pool->stats.hits++;
+    }
+    else
+    {
+        pool->stats.misses++;
+    }
+    g_cond_signal(&pool->refill_cond);
+    g_mutex_unlock(&pool->mutex);
+
+    if (handle == NULL)
+    {
+        return pam_start(pool->service, username, conversation, pamh);
+    }
+
+    //pam_set_item会复制对话结构和用户名
+    ret = pam_set_item(handle, PAM_CONV, conversation);
+    if (ret == PAM_SUCCESS && username)
+    {
+        ret = pam_set_item(handle, PAM_USER, username);
+    }
+
+    if (ret != PAM_SUCCESS)
+    {
+        pam_end(handle, ret);
+        return pam_start(pool->service, username, conversation, pamh);
+    }
+
+    *pamh = handle;
+
+    return PAM_SUCCESS;
+}
+
+void kiran_auth_pam_pool_get_stats(KiranAuthPamPool *pool,
+                                   KiranAuthPamPoolStats *stats)
+{
+    g_mutex_lock(&pool->mutex);
+    *stats = pool->stats;
+    stats->available = g_queue_get_length(&pool->handles);
+    g_mutex_unlock(&pool->mutex);
+}
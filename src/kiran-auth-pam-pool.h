@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-pam-pool.h
+ *@brief 预先调用pam_start的备用pam句柄池，会话开始认证时直接取出句柄，
+ *       省去读取pam配置和加载模块的时间。句柄只使用一次，认证结束后由调用者pam_end
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_PAM_POOL_H__
+#define __KIRAN_AUTH_PAM_POOL_H__
+
+#include <glib.h>
+#include <security/pam_appl.h>
+
+G_BEGIN_DECLS
+
+typedef struct _KiranAuthPamPool KiranAuthPamPool;
+
+typedef struct _KiranAuthPamPoolStats
+{
+    //可用的备用句柄数
+    guint available;
+    guint64 hits;
+    guint64 misses;
+    guint64 failures;
+} KiranAuthPamPoolStats;
+
+/**
+ * @brief 创建句柄池，后台线程保持size个备用句柄
+ *
+ * @param[in] service pam服务名
+ * @param[in] size 备用句柄数，必须大于0
+ */
+KiranAuthPamPool *kiran_auth_pam_pool_new(const gchar *service,
+                                          gint size);
+
+/**
+ * @brief 停止后台线程并pam_end所有备用句柄
+ */
+void kiran_auth_pam_pool_free(KiranAuthPamPool *pool);
+
+/**
+ * @brief 取出一个备用句柄并设置用户名和对话函数，没有备用句柄时调用pam_start
+ *
+ * @param[in] username 用户名，可以为NULL
+ * @param[in] conversation 对话函数
+ * @param[out] pamh 句柄，认证结束后调用者负责pam_end
+ * @return 与pam_start相同
+ */
+int kiran_auth_pam_pool_acquire(KiranAuthPamPool *pool,
+                                const gchar *username,
+                                const struct pam_conv *conversation,
+                                pam_handle_t **pamh);
+
+void kiran_auth_pam_pool_get_stats(KiranAuthPamPool *pool,
+                                   KiranAuthPamPoolStats *stats);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_PAM_POOL_H__ */
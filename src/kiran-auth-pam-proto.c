@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-pam-proto.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+gboolean
+kiran_auth_pam_proto_send(int fd,
+                          guint32 type,
+                          gint32 arg,
+                          const void *payload,
+                          gsize len)
+{
+    KiranAuthPamProtoHeader header = {type, arg};
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    ssize_t ret;
+
+    if (len > KIRAN_AUTH_PAM_PROTO_MAX_PAYLOAD)
+        return FALSE;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = payload ? len : 0;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    do
+    {
+        ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret == (ssize_t)(sizeof(header) + iov[1].iov_len);
+}
+
+gboolean
+kiran_auth_pam_proto_recv(int fd,
+                          KiranAuthPamProtoHeader *header,
+                          gchar *payload,
+                          gsize *len)
+{
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    ssize_t ret;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(*header);
+    iov[1].iov_base = payload;
+    iov[1].iov_len = KIRAN_AUTH_PAM_PROTO_MAX_PAYLOAD;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    do
+    {
+        ret = recvmsg(fd, &msg, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    //报文被截断说明对端不是合法的通信方
+    if (ret < (ssize_t)sizeof(*header) || (msg.msg_flags & MSG_TRUNC))
+        return FALSE;
+
+    payload[ret - sizeof(*header)] = '\0';
+    if (len)
+        *len = ret - sizeof(*header);
+
+    return TRUE;
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-pam-proto.h
+ *@brief 认证服务与pam辅助进程之间的通信协议
+ *
+ * 双方通过SOCK_SEQPACKET类型的socketpair通信，每个报文由KiranAuthPamProtoHeader
+ * 和可选的字符串负载组成：
+ *  服务 -> 辅助进程: START(负载为"pam服务名\0用户名")，RESPONSE(arg小于0表示取消对话)
+ *  辅助进程 -> 服务: PROMPT(arg为消息类型)，RESULT(arg为pam返回值，负载为认证通过的用户名)
+ * 一次对话中的所有消息以若干PROMPT加一个PROMPT_END发送，之后辅助进程按顺序为每个提示接收一个RESPONSE
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_PAM_PROTO_H__
+#define __KIRAN_AUTH_PAM_PROTO_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+//辅助进程中通信socket的文件描述符
+#define KIRAN_AUTH_PAM_PROTO_FD 3
+//单个报文负载的最大长度
+#define KIRAN_AUTH_PAM_PROTO_MAX_PAYLOAD 4096
+
+typedef enum
+{
+    KIRAN_AUTH_PAM_PROTO_START = 1,
+    KIRAN_AUTH_PAM_PROTO_RESPONSE = 2,
+    KIRAN_AUTH_PAM_PROTO_PROMPT = 3,
+    KIRAN_AUTH_PAM_PROTO_RESULT = 4,
+    KIRAN_AUTH_PAM_PROTO_PROMPT_END = 5,
+} KiranAuthPamProtoType;
+
+typedef struct _KiranAuthPamProtoHeader
+{
+    guint32 type;
+    gint32 arg;
+} KiranAuthPamProtoHeader;
+
+/**
+ * @brief 发送一个报文
+ *
+ * @param[in] payload 负载，可以为NULL
+ * @param[in] len 负载长度，不能超过KIRAN_AUTH_PAM_PROTO_MAX_PAYLOAD
+ * @return 成功返回TRUE
+ */
+gboolean kiran_auth_pam_proto_send(int fd,
+                                   guint32 type,
+                                   gint32 arg,
+                                   const void *payload,
+                                   gsize len);
+
+/**
+ * @brief 接收一个报文，负载以'\0'结尾
+ *
+ * @param[out] payload 负载缓冲区，大小不能小于KIRAN_AUTH_PAM_PROTO_MAX_PAYLOAD + 1
+ * @param[out] len 负载长度，可以为NULL
+ * @return 成功返回TRUE，对端关闭或者出错时返回FALSE
+ */
+gboolean kiran_auth_pam_proto_recv(int fd,
+                                   KiranAuthPamProtoHeader *header,
+                                   gchar *payload,
+                                   gsize *len);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_PAM_PROTO_H__ */
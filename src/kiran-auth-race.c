@@ -0,0 +1,571 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-race.h"
+
+typedef struct _RaceStep
+{
+    gint methods;
+    gint required;
+    gint fail_fast;
+    gboolean optional;
+    gint timeout;
+} RaceStep;
+
+/*
+ * 在锁内决定、在锁外执行的操作，后端回调会使用自己的锁，在锁内调用可能死锁
+ */
+typedef struct _RaceActions
+{
+    gint cancel;
+    gint start;
+    //开始了新的一步
+    gboolean step;
+    gint methods;
+    gint passed;
+    guint serial;
+    gboolean finish;
+    KiranAuthRaceResult result;
+    gchar *username;
+} RaceActions;
+
+struct _KiranAuthRace
+{
+    //认证线程和主循环都会报告结果
+    GMutex mutex;
+
+    const KiranAuthRaceBackend *backends;
+    guint n_backends;
+    const KiranAuthRaceFuncs *funcs;
+    gpointer session;
+    gpointer user_data;
+
+    GArray *steps;
+    guint current;
+    //每开始一步加一，用于识别过期的启动
+    guint serial;
+    //当前这一步的认证方式，以及其中正在进行、已经成功和已经失败的方式
+    gint methods;
+    gint running;
+    gint succeeded;
+    gint failed;
+    gboolean timed_out;
+    GSource *timeout_source;
+    //已经通过的步数
+    guint passed_steps;
+    //成功的认证方式报告的用户名
+    gchar *username;
+
+    gboolean started;
+    gboolean finished;
+
+    //等待在主循环中执行的操作，元素为RaceActions，按决定的先后顺序执行
+    GQueue pending;
+    //主循环正在执行操作，执行期间新决定的操作由正在执行的循环接着执行
+    gboolean dispatching;
+    //已经向主循环提交了执行操作的回调
+    gboolean dispatch_scheduled;
+};
+
+static gint
+count_methods(gint methods)
+{
+    gint n = 0;
+
+    for (; methods; methods &= methods - 1)
+    {
+        n++;
+    }
+
+    return n;
+}
+
+static const KiranAuthRaceBackend *
+find_backend(KiranAuthRace *race,
+             gint method)
+{
+    guint i;
+
+    for (i = 0; i < race->n_backends; i++)
+    {
+        if (race->backends[i].method == method)
+            return &race->backends[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * 去掉没有后端的认证方式
+ */
+static gint
+available_methods(KiranAuthRace *race,
+                  gint methods)
+{
+    gint available = 0;
+    guint i;
+
+    for (i = 0; i < race->n_backends; i++)
+    {
+        available |= race->backends[i].method;
+    }
+
+    return methods & available;
+}
+
+static void
+remove_timeout_locked(KiranAuthRace *race)
+{
+    if (race->timeout_source)
+    {
+        g_source_destroy(race->timeout_source);
+        g_source_unref(race->timeout_source);
+        race->timeout_source = NULL;
+    }
+}
+
+/*
+ * 结束当前这一步，取消仍在进行的认证方式
+ */
+static void
+end_step_locked(KiranAuthRace *race,
+                RaceActions *actions)
+{
+    actions->cancel |= race->running;
+    race->running = 0;
+    remove_timeout_locked(race);
+}
+
+static void
+finish_locked(KiranAuthRace *race,
+              RaceActions *actions,
+              KiranAuthRaceResult result)
+{
+    end_step_locked(race, actions);
+    race->finished = TRUE;
+
+    actions->finish = TRUE;
+    actions->result = result;
+    actions->username = g_strdup(race->username);
+}
+
+static gboolean race_timeout_cb(gpointer user_data);
+
+/*
+ * 开始下一个有可用认证方式的步骤，没有剩余步骤时结束
+ */
+static void
+next_step_locked(KiranAuthRace *race,
+                 RaceActions *actions)
+{
+    while (race->current < race->steps->len)
+    {
+        RaceStep *step = &g_array_index(race->steps, RaceStep, race->current);
+        gint methods = available_methods(race, step->methods);
+
+        if (methods == 0)
+        {
+            if (!step->optional)
+            {
+                finish_locked(race, actions, KIRAN_AUTH_RACE_FAIL);
+                return;
+            }
+            race->current++;
+            continue;
+        }
+
+        race->serial++;
+        race->methods = methods;
+        race->running = methods;
+        race->succeeded = 0;
+        race->failed = 0;
+        race->timed_out = FALSE;
+
+        if (step->timeout > 0)
+        {
+            race->timeout_source = g_timeout_source_new_seconds(step->timeout);
+            g_source_set_callback(race->timeout_source, race_timeout_cb, race, NULL);
+            g_source_attach(race->timeout_source, NULL);
+        }
+
+        actions->step = TRUE;
+        actions->methods = methods;
+        actions->start = methods;
+        actions->serial = race->serial;
+        return;
+    }
+
+    //必需的步骤都已通过，全部步骤都被跳过时认证失败
+    finish_locked(race,
+                  actions,
+                  race->passed_steps > 0 ? KIRAN_AUTH_RACE_SUCCESS : KIRAN_AUTH_RACE_FAIL);
+}
+
+/*
+ * 根据当前这一步的成功和失败情况决定是否进入下一步
+ */
+static void
+evaluate_locked(KiranAuthRace *race,
+                RaceActions *actions)
+{
+    RaceStep *step = &g_array_index(race->steps, RaceStep, race->current);
+    gint total = count_methods(race->methods);
+    gint required = CLAMP(step->required, 1, total);
+
+    if (count_methods(race->succeeded) >= required)
+    {
+        end_step_locked(race, actions);
+        race->passed_steps++;
+        actions->passed = race->succeeded;
+        race->current++;
+        next_step_locked(race, actions);
+        return;
+    }
+
+    //还能达到需要的成功数量时继续等待
+    if (!(race->failed & step->fail_fast) &&
+        total - count_methods(race->failed) >= required)
+    {
+        return;
+    }
+
+    end_step_locked(race, actions);
+    if (step->optional)
+    {
+        race->current++;
+        next_step_locked(race, actions);
+        return;
+    }
+
+    finish_locked(race, actions, race->timed_out ? KIRAN_AUTH_RACE_TIMEOUT : KIRAN_AUTH_RACE_FAIL);
+}
+
+static gboolean
+start_is_stale(KiranAuthRace *race,
+               guint serial)
+{
+    gboolean stale;
+
+    g_mutex_lock(&race->mutex);
+    stale = race->finished || race->serial != serial;
+    g_mutex_unlock(&race->mutex);
+
+    return stale;
+}
+
+static void
+run_actions(KiranAuthRace *race,
+            RaceActions *actions)
+{
+    const KiranAuthRaceBackend *backend;
+    gint method;
+
+    for (method = 1; method > 0 && method <= actions->cancel; method <<= 1)
+    {
+        if ((actions->cancel & method) && (backend = find_backend(race, method)) != NULL)
+        {
+            backend->cancel(race->session, backend->user_data);
+        }
+    }
+
+    if (actions->step && race->funcs->step)
+    {
+        race->funcs->step(race->session, actions->methods, actions->passed, race->user_data);
+    }
+
+    for (method = 1; method > 0 && method <= actions->start; method <<= 1)
+    {
+        if (!(actions->start & method) || (backend = find_backend(race, method)) == NULL)
+            continue;
+
+        //前面的认证方式启动失败可能已经结束了这一步
+        if (start_is_stale(race, actions->serial))
+            break;
+
+        if (!backend->start(race->session, backend->user_data))
+        {
+            kiran_auth_race_report(race, method, FALSE, NULL);
+            continue;
+        }
+
+        //启动期间其它线程可能已经结束了这一步，不再需要这个认证方式
+        if (start_is_stale(race, actions->serial))
+        {
+            backend->cancel(race->session, backend->user_data);
+        }
+    }
+
+    if (actions->finish)
+    {
+        race->funcs->finish(race->session, actions->result, actions->username, race->user_data);
+    }
+    g_free(actions->username);
+}
+
+/*
+ * 在主循环中依次执行等待的操作
+ */
+static void
+run_pending(KiranAuthRace *race)
+{
+    RaceActions *actions;
+
+    g_mutex_lock(&race->mutex);
+    race->dispatching = TRUE;
+    while ((actions = g_queue_pop_head(&race->pending)) != NULL)
+    {
+        g_mutex_unlock(&race->mutex);
+        run_actions(race, actions);
+        g_free(actions);
+        g_mutex_lock(&race->mutex);
+    }
+    race->dispatching = FALSE;
+    g_mutex_unlock(&race->mutex);
+}
+
+static gboolean
+dispatch_idle_cb(gpointer user_data)
+{
+    KiranAuthRace *race = user_data;
+    gpointer session = race->session;
+
+    g_mutex_lock(&race->mutex);
+    race->dispatch_scheduled = FALSE;
+    g_mutex_unlock(&race->mutex);
+
+    run_pending(race);
+
+    //释放引用后调度可能已经随会话释放
+    race->funcs->unref(session);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * 记录锁内决定的操作，没有需要执行的操作时不做任何事
+ */
+static void
+queue_actions_locked(KiranAuthRace *race,
+                     RaceActions *actions)
+{
+    RaceActions *pending;
+
+    if (actions->cancel == 0 && actions->start == 0 && !actions->step && !actions->finish)
+        return;
+
+    //用户名由队列中的操作持有，执行后释放
+    pending = g_new(RaceActions, 1);
+    *pending = *actions;
+    g_queue_push_tail(&race->pending, pending);
+}
+
+/*
+ * 后端的取消、启动和结束回调都在主循环中执行，认证线程报告的结果交给主循环处理，
+ * 避免后端在不同线程中同时操作会话的状态
+ */
+static void
+dispatch_actions(KiranAuthRace *race)
+{
+    g_mutex_lock(&race->mutex);
+    //主循环正在执行时由正在执行的循环接着执行，保持执行顺序
+    if (g_queue_is_empty(&race->pending) || race->dispatching)
+    {
+        g_mutex_unlock(&race->mutex);
+        return;
+    }
+
+    if (!g_main_context_is_owner(g_main_context_default()))
+    {
+        //回调持有会话的引用，保证执行时调度仍然有效
+        if (!race->dispatch_scheduled)
+        {
+            race->dispatch_scheduled = TRUE;
+            race->funcs->ref(race->session);
+            g_idle_add(dispatch_idle_cb, race);
+        }
+        g_mutex_unlock(&race->mutex);
+        return;
+    }
+    g_mutex_unlock(&race->mutex);
+
+    run_pending(race);
+}
+
+static gboolean
+race_timeout_cb(gpointer user_data)
+{
+    KiranAuthRace *race = user_data;
+    RaceActions actions = {0};
+
+    g_mutex_lock(&race->mutex);
+    //回调等待锁期间这一步可能已经结束
+    if (race->timeout_source != g_main_current_source())
+    {
+        g_mutex_unlock(&race->mutex);
+        return G_SOURCE_REMOVE;
+    }
+
+    race->timed_out = TRUE;
+    race->failed |= race->running;
+    evaluate_locked(race, &actions);
+    queue_actions_locked(race, &actions);
+    g_mutex_unlock(&race->mutex);
+
+    dispatch_actions(race);
+
+    return G_SOURCE_REMOVE;
+}
+
+KiranAuthRace *
+kiran_auth_race_new(const KiranAuthRaceBackend *backends,
+                    guint n_backends,
+                    const KiranAuthRaceFuncs *funcs,
+                    gpointer session,
+                    gpointer user_data)
+{
+    KiranAuthRace *race = g_new0(KiranAuthRace, 1);
+
+    g_mutex_init(&race->mutex);
+    race->backends = backends;
+    race->n_backends = n_backends;
+    race->funcs = funcs;
+    race->session = session;
+    race->user_data = user_data;
+    race->steps = g_array_new(FALSE, TRUE, sizeof(RaceStep));
+    g_queue_init(&race->pending);
+
+    return race;
+}
+
+void kiran_auth_race_free(KiranAuthRace *race)
+{
+    if (race == NULL)
+        return;
+
+    remove_timeout_locked(race);
+    while (!g_queue_is_empty(&race->pending))
+    {
+        RaceActions *actions = g_queue_pop_head(&race->pending);
+
+        g_free(actions->username);
+        g_free(actions);
+    }
+    g_array_free(race->steps, TRUE);
+    g_free(race->username);
+    g_mutex_clear(&race->mutex);
+    g_free(race);
+}
+
+void kiran_auth_race_add_step(KiranAuthRace *race,
+                              gint methods,
+                              gint required,
+                              gint fail_fast,
+                              gboolean optional,
+                              gint timeout)
+{
+    RaceStep step = {methods, required, fail_fast, optional, timeout};
+
+    g_return_if_fail(!race->started);
+
+    g_array_append_val(race->steps, step);
+}
+
+void kiran_auth_race_start(KiranAuthRace *race)
+{
+    RaceActions actions = {0};
+
+    g_mutex_lock(&race->mutex);
+    if (race->started)
+    {
+        g_mutex_unlock(&race->mutex);
+        return;
+    }
+    race->started = TRUE;
+    next_step_locked(race, &actions);
+    queue_actions_locked(race, &actions);
+    g_mutex_unlock(&race->mutex);
+
+    dispatch_actions(race);
+}
+
+void kiran_auth_race_report(KiranAuthRace *race,
+                            gint method,
+                            gboolean success,
+                            const gchar *username)
+{
+    RaceActions actions = {0};
+
+    g_mutex_lock(&race->mutex);
+    if (race->finished || !(race->running & method))
+    {
+        g_mutex_unlock(&race->mutex);
+        return;
+    }
+
+    race->running &= ~method;
+
+    //不同认证方式认证的不是同一个用户
+    if (success && username && race->username && g_strcmp0(username, race->username) != 0)
+    {
+        success = FALSE;
+    }
+
+    if (success)
+    {
+        if (username && race->username == NULL)
+        {
+            race->username = g_strdup(username);
+        }
+        race->succeeded |= method;
+    }
+    else
+    {
+        race->failed |= method;
+    }
+
+    evaluate_locked(race, &actions);
+    queue_actions_locked(race, &actions);
+    g_mutex_unlock(&race->mutex);
+
+    dispatch_actions(race);
+}
+
+void kiran_auth_race_cancel(KiranAuthRace *race)
+{
+    RaceActions actions = {0};
+
+    g_mutex_lock(&race->mutex);
+    if (!race->started || race->finished)
+    {
+        g_mutex_unlock(&race->mutex);
+        return;
+    }
+
+    finish_locked(race, &actions, KIRAN_AUTH_RACE_CANCELLED);
+    queue_actions_locked(race, &actions);
+    g_mutex_unlock(&race->mutex);
+
+    dispatch_actions(race);
+}
+
+gint kiran_auth_race_get_running(KiranAuthRace *race)
+{
+    gint running;
+
+    g_mutex_lock(&race->mutex);
+    running = race->running;
+    g_mutex_unlock(&race->mutex);
+
+    return running;
+}
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-race.h
+ *@brief 多种认证方式的调度，按策略依次执行若干步，每一步中的认证方式并行进行，
+ *       达到需要的成功数量后取消其它认证方式。各认证方式都是异步的，结果通过
+ *       kiran_auth_race_report通知，等待期间不占用线程
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_RACE_H__
+#define __KIRAN_AUTH_RACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _KiranAuthRace KiranAuthRace;
+
+typedef enum
+{
+    KIRAN_AUTH_RACE_SUCCESS,
+    KIRAN_AUTH_RACE_FAIL,
+    //某一步超时
+    KIRAN_AUTH_RACE_TIMEOUT,
+    //调用kiran_auth_race_cancel取消
+    KIRAN_AUTH_RACE_CANCELLED,
+} KiranAuthRaceResult;
+
+/*
+ * 一种认证方式，回调都在主循环中调用，不能持有调用kiran_auth_race_*时需要的锁
+ */
+typedef struct _KiranAuthRaceBackend
+{
+    //认证方式，每种方式占一位
+    gint method;
+    //开始认证，失败时返回FALSE
+    gboolean (*start)(gpointer session, gpointer user_data);
+    //取消认证，对已经结束的认证调用时不做任何事
+    void (*cancel)(gpointer session, gpointer user_data);
+    //传给start和cancel的数据
+    gpointer user_data;
+} KiranAuthRaceBackend;
+
+typedef struct _KiranAuthRaceFuncs
+{
+    //开始新的一步，methods为这一步并行进行的认证方式，passed为上一步成功的认证方式
+    void (*step)(gpointer session, gint methods, gint passed, gpointer user_data);
+    //调度结束，username为认证成功的方式报告的用户名，可以为NULL
+    void (*finish)(gpointer session, KiranAuthRaceResult result, const gchar *username, gpointer user_data);
+    //增加和减少会话的引用，其它线程报告结果后交给主循环处理期间持有会话
+    void (*ref)(gpointer session);
+    void (*unref)(gpointer session);
+} KiranAuthRaceFuncs;
+
+/**
+ * @brief 创建调度，backends需要在调度释放前一直有效
+ */
+KiranAuthRace *kiran_auth_race_new(const KiranAuthRaceBackend *backends,
+                                   guint n_backends,
+                                   const KiranAuthRaceFuncs *funcs,
+                                   gpointer session,
+                                   gpointer user_data);
+
+/**
+ * @brief 释放调度，调用前调度必须已经结束或者被取消，不会再调用后端
+ */
+void kiran_auth_race_free(KiranAuthRace *race);
+
+/**
+ * @brief 在策略末尾增加一步，只能在kiran_auth_race_start之前调用
+ *
+ * 例如"密码、指纹、人脸任意一个"为一步methods=三者，required=1；
+ * "指纹和密码都需要"可以是一步methods=两者，required=2，也可以是依次两步
+ *
+ * @param[in] methods 这一步并行进行的认证方式，没有对应后端的方式被忽略
+ * @param[in] required 需要成功的认证方式数量，超过方式数量时按方式数量计算
+ * @param[in] fail_fast 其中任意一个方式失败时这一步立即失败
+ * @param[in] optional 这一步失败时继续下一步，而不是整个认证失败
+ * @param[in] timeout 这一步的超时时间，单位秒，小于等于0时不限制
+ */
+void kiran_auth_race_add_step(KiranAuthRace *race,
+                              gint methods,
+                              gint required,
+                              gint fail_fast,
+                              gboolean optional,
+                              gint timeout);
+
+/**
+ * @brief 开始执行第一步，没有任何认证方式时直接以失败结束
+ */
+void kiran_auth_race_start(KiranAuthRace *race);
+
+/**
+ * @brief 认证方式报告结果，可以在任意线程调用，不在当前这一步中的报告被忽略。
+ * 由此引起的取消、启动和结束回调在主循环中执行，在其它线程调用时稍后执行
+ *
+ * @param[in] username 认证通过的用户名，可以为NULL，同一次调度中不同方式报告的用户名不一致时认证失败
+ */
+void kiran_auth_race_report(KiranAuthRace *race,
+                            gint method,
+                            gboolean success,
+                            const gchar *username);
+
+/**
+ * @brief 取消所有正在进行的认证方式，并以KIRAN_AUTH_RACE_CANCELLED结束
+ */
+void kiran_auth_race_cancel(KiranAuthRace *race);
+
+/**
+ * @brief 正在进行的认证方式
+ */
+gint kiran_auth_race_get_running(KiranAuthRace *race);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_RACE_H__ */
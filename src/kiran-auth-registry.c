@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-registry.h"
+
+typedef struct _RegistryEntry RegistryEntry;
+
+struct _RegistryEntry
+{
+    const gchar *sid;
+    const gchar *sender;
+    gpointer session;
+};
+
+struct _KiranAuthRegistry
+{
+    //会话ID -> RegistryEntry，持有entry
+    GHashTable *by_sid;
+    //调用者连接名 -> RegistryEntry，不持有entry
+    GHashTable *by_sender;
+    GDestroyNotify session_free;
+};
+
+KiranAuthRegistry *
+kiran_auth_registry_new(GDestroyNotify session_free)
+{
+    KiranAuthRegistry *registry = g_new0(KiranAuthRegistry, 1);
+
+    registry->by_sid = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    registry->by_sender = g_hash_table_new(g_str_hash, g_str_equal);
+    registry->session_free = session_free;
+
+    return registry;
+}
+
+static void
+entry_unlink(KiranAuthRegistry *registry,
+             RegistryEntry *entry)
+{
+    if (entry->sender &&
+        g_hash_table_lookup(registry->by_sender, entry->sender) == entry)
+    {
+        g_hash_table_remove(registry->by_sender, entry->sender);
+    }
+}
+
+void kiran_auth_registry_free(KiranAuthRegistry *registry)
+{
+    GHashTableIter iter;
+    RegistryEntry *entry;
+
+    if (registry == NULL)
+        return;
+
+    //先把会话全部摘下来再释放，避免释放函数中回调索引表
+    g_hash_table_remove_all(registry->by_sender);
+    if (registry->session_free)
+    {
+        g_hash_table_iter_init(&iter, registry->by_sid);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&entry))
+        {
+            gpointer session = entry->session;
+
+            g_hash_table_iter_steal(&iter);
+            g_free(entry);
+            registry->session_free(session);
+        }
+    }
+
+    g_hash_table_destroy(registry->by_sid);
+    g_hash_table_destroy(registry->by_sender);
+    g_free(registry);
+}
+
+gboolean
+kiran_auth_registry_insert(KiranAuthRegistry *registry,
+                           const gchar *sid,
+                           const gchar *sender,
+                           gpointer session)
+{
+    RegistryEntry *entry;
+
+    g_return_val_if_fail(sid != NULL, FALSE);
+
+    if (g_hash_table_contains(registry->by_sid, sid))
+    {
+        return FALSE;
+    }
+
+    entry = g_new0(RegistryEntry, 1);
+    entry->sid = sid;
+    entry->sender = sender;
+    entry->session = session;
+
+    g_hash_table_insert(registry->by_sid, (gpointer)sid, entry);
+    if (sender)
+    {
+        g_hash_table_insert(registry->by_sender, (gpointer)sender, entry);
+    }
+
+    return TRUE;
+}
+
+gpointer
+kiran_auth_registry_lookup_sid(KiranAuthRegistry *registry,
+                               const gchar *sid)
+{
+    RegistryEntry *entry;
+
+    if (sid == NULL)
+        return NULL;
+
+    entry = g_hash_table_lookup(registry->by_sid, sid);
+
+    return entry ? entry->session : NULL;
+}
+
+gpointer
+kiran_auth_registry_lookup_sender(KiranAuthRegistry *registry,
+                                  const gchar *sender)
+{
+    RegistryEntry *entry;
+
+    if (sender == NULL)
+        return NULL;
+
+    entry = g_hash_table_lookup(registry->by_sender, sender);
+
+    return entry ? entry->session : NULL;
+}
+
+gpointer
+kiran_auth_registry_steal(KiranAuthRegistry *registry,
+                          const gchar *sid)
+{
+    RegistryEntry *entry;
+    gpointer session;
+
+    if (sid == NULL)
+        return NULL;
+
+    entry = g_hash_table_lookup(registry->by_sid, sid);
+    if (entry == NULL)
+        return NULL;
+
+    session = entry->session;
+    entry_unlink(registry, entry);
+    //entry由by_sid的value释放函数回收
+    g_hash_table_remove(registry->by_sid, sid);
+
+    return session;
+}
+
+gboolean
+kiran_auth_registry_remove(KiranAuthRegistry *registry,
+                           const gchar *sid)
+{
+    gpointer session;
+
+    session = kiran_auth_registry_steal(registry, sid);
+    if (session == NULL)
+        return FALSE;
+
+    if (registry->session_free)
+        registry->session_free(session);
+
+    return TRUE;
+}
+
+guint kiran_auth_registry_size(KiranAuthRegistry *registry)
+{
+    return g_hash_table_size(registry->by_sid);
+}
+
+void kiran_auth_registry_foreach(KiranAuthRegistry *registry,
+                                 GFunc func,
+                                 gpointer user_data)
+{
+    GHashTableIter iter;
+    RegistryEntry *entry;
+
+    g_hash_table_iter_init(&iter, registry->by_sid);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&entry))
+    {
+        func(entry->session, user_data);
+    }
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-registry.h
+ *@brief 认证会话索引表，按会话ID和调用者连接名双重索引
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_REGISTRY_H__
+#define __KIRAN_AUTH_REGISTRY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _KiranAuthRegistry KiranAuthRegistry;
+
+/**
+ * @brief 创建会话索引表
+ *
+ * @param[in] session_free 会话释放函数，在移除或销毁索引表时调用，可以为NULL
+ * @return 新建的索引表
+ */
+KiranAuthRegistry *kiran_auth_registry_new(GDestroyNotify session_free);
+
+/**
+ * @brief 销毁索引表，并释放其中所有会话
+ */
+void kiran_auth_registry_free(KiranAuthRegistry *registry);
+
+/**
+ * @brief 添加会话
+ *
+ * sid和sender不会被复制，必须由会话自身持有，并且在会话移除前保持不变
+ *
+ * @param[in] sid 会话ID，不能为NULL
+ * @param[in] sender 调用者dbus连接名，可以为NULL
+ * @param[in] session 会话
+ * @return sid已存在时返回FALSE
+ */
+gboolean kiran_auth_registry_insert(KiranAuthRegistry *registry,
+                                    const gchar *sid,
+                                    const gchar *sender,
+                                    gpointer session);
+
+/**
+ * @brief 按会话ID查找会话
+ */
+gpointer kiran_auth_registry_lookup_sid(KiranAuthRegistry *registry,
+                                        const gchar *sid);
+
+/**
+ * @brief 按调用者dbus连接名查找会话
+ */
+gpointer kiran_auth_registry_lookup_sender(KiranAuthRegistry *registry,
+                                           const gchar *sender);
+
+/**
+ * @brief 移除会话但不释放
+ *
+ * @return 被移除的会话，不存在时返回NULL
+ */
+gpointer kiran_auth_registry_steal(KiranAuthRegistry *registry,
+                                   const gchar *sid);
+
+/**
+ * @brief 移除并释放会话
+ *
+ * @return 会话不存在时返回FALSE
+ */
+gboolean kiran_auth_registry_remove(KiranAuthRegistry *registry,
+                                    const gchar *sid);
+
+/**
+ * @brief 当前会话数量
+ */
+guint kiran_auth_registry_size(KiranAuthRegistry *registry);
+
+/**
+ * @brief 遍历所有会话，回调中不能增删会话
+ */
+void kiran_auth_registry_foreach(KiranAuthRegistry *registry,
+                                 GFunc func,
+                                 gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_REGISTRY_H__ */
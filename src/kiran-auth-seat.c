@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-seat.h"
+#ifdef ENABLE_ZLOG_EX
+#include <zlog_ex.h>
+#else
+#include <zlog.h>
+#endif
+
+#define LOGIND_DBUS_NAME "org.freedesktop.login1"
+#define LOGIND_OBJECT_PATH "/org/freedesktop/login1"
+#define LOGIND_MANAGER_INTERFACE "org.freedesktop.login1.Manager"
+#define LOGIND_SESSION_INTERFACE "org.freedesktop.login1.Session"
+
+typedef struct _SeatLookupData
+{
+    GDBusConnection *connection;
+    gchar *sender;
+    KiranAuthSeatCallback callback;
+    gpointer user_data;
+} SeatLookupData;
+
+static void
+seat_lookup_finish(SeatLookupData *data,
+                   const gchar *seat,
+                   const gchar *session_class)
+{
+    data->callback(seat, session_class, data->user_data);
+
+    g_object_unref(data->connection);
+    g_free(data->sender);
+    g_free(data);
+}
+
+/*
+ * 取出返回值，失败时记录日志并结束查询
+ */
+static GVariant *
+seat_lookup_call_finish(SeatLookupData *data,
+                        GAsyncResult *res,
+                        const gchar *step)
+{
+    GError *error = NULL;
+    GVariant *result;
+
+    result = g_dbus_connection_call_finish(data->connection, res, &error);
+    if (result == NULL)
+    {
+        dzlog_debug("Lookup seat of %s failed at %s: %s", data->sender, step, error->message);
+        g_error_free(error);
+        seat_lookup_finish(data, NULL, NULL);
+    }
+
+    return result;
+}
+
+static void
+seat_lookup_get_props_cb(GObject *source_object,
+                         GAsyncResult *res,
+                         gpointer user_data)
+{
+    SeatLookupData *data = user_data;
+    GVariant *result;
+    GVariant *props;
+    const gchar *seat = NULL;
+    const gchar *session_class = NULL;
+
+    result = seat_lookup_call_finish(data, res, "GetAll");
+    if (result == NULL)
+        return;
+
+    //Seat属性为(so)，不在座席上的会话ID为空
+    props = g_variant_get_child_value(result, 0);
+    g_variant_lookup(props, "Seat", "(&s&o)", &seat, NULL);
+    g_variant_lookup(props, "Class", "&s", &session_class);
+
+    seat_lookup_finish(data, seat && seat[0] ? seat : NULL, session_class);
+    g_variant_unref(props);
+    g_variant_unref(result);
+}
+
+static void
+seat_lookup_get_session_cb(GObject *source_object,
+                           GAsyncResult *res,
+                           gpointer user_data)
+{
+    SeatLookupData *data = user_data;
+    GVariant *result;
+    const gchar *path;
+
+    result = seat_lookup_call_finish(data, res, "GetSessionByPID");
+    if (result == NULL)
+        return;
+
+    g_variant_get(result, "(&o)", &path);
+    g_dbus_connection_call(data->connection,
+                           LOGIND_DBUS_NAME,
+                           path,
+                           "org.freedesktop.DBus.Properties",
+                           "GetAll",
+                           g_variant_new("(s)", LOGIND_SESSION_INTERFACE),
+                           G_VARIANT_TYPE("(a{sv})"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           NULL,
+                           seat_lookup_get_props_cb,
+                           data);
+    g_variant_unref(result);
+}
+
+static void
+seat_lookup_get_pid_cb(GObject *source_object,
+                       GAsyncResult *res,
+                       gpointer user_data)
+{
+    SeatLookupData *data = user_data;
+    GVariant *result;
+    guint32 pid;
+
+    result = seat_lookup_call_finish(data, res, "GetConnectionUnixProcessID");
+    if (result == NULL)
+        return;
+
+    g_variant_get(result, "(u)", &pid);
+    g_dbus_connection_call(data->connection,
+                           LOGIND_DBUS_NAME,
+                           LOGIND_OBJECT_PATH,
+                           LOGIND_MANAGER_INTERFACE,
+                           "GetSessionByPID",
+                           g_variant_new("(u)", pid),
+                           G_VARIANT_TYPE("(o)"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           NULL,
+                           seat_lookup_get_session_cb,
+                           data);
+    g_variant_unref(result);
+}
+
+void kiran_auth_seat_lookup(GDBusConnection *connection,
+                            const gchar *sender,
+                            KiranAuthSeatCallback callback,
+                            gpointer user_data)
+{
+    SeatLookupData *data = g_new0(SeatLookupData, 1);
+
+    data->connection = g_object_ref(connection);
+    data->sender = g_strdup(sender);
+    data->callback = callback;
+    data->user_data = user_data;
+
+    g_dbus_connection_call(connection,
+                           "org.freedesktop.DBus",
+                           "/org/freedesktop/DBus",
+                           "org.freedesktop.DBus",
+                           "GetConnectionUnixProcessID",
+                           g_variant_new("(s)", sender),
+                           G_VARIANT_TYPE("(u)"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           NULL,
+                           seat_lookup_get_pid_cb,
+                           data);
+}
@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-seat.h
+ *@brief 查询dbus调用者所在的座席，依次查询调用者进程号、logind会话和会话的座席及类别
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_SEAT_H__
+#define __KIRAN_AUTH_SEAT_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * 查询结果，seat为座席ID，查询失败或者调用者不在任何座席上时为NULL；
+ * session_class为logind会话类别，如user、greeter、lock-screen，查询失败时为NULL
+ */
+typedef void (*KiranAuthSeatCallback)(const gchar *seat, const gchar *session_class, gpointer user_data);
+
+/**
+ * @brief 异步查询调用者所在的座席和会话类别，在主循环中回调
+ *
+ * @param[in] sender 调用者的dbus唯一名
+ */
+void kiran_auth_seat_lookup(GDBusConnection *connection,
+                            const gchar *sender,
+                            KiranAuthSeatCallback callback,
+                            gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_SEAT_H__ */
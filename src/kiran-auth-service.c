@@ -18,9 +18,15 @@
  *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
  *@copyright(c) 2021 KylinSec.All rights reserved.
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "kiran-auth-service.h"
+#include <errno.h>
 #include <glib/gi18n.h>
-#include <json-glib/json-glib.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <kiran-cc-daemon/kiran-system-daemon/accounts-i.h>
 #include <security/pam_appl.h>
 #ifdef ENABLE_ZLOG_EX
@@ -29,19 +35,94 @@
 #include <zlog.h>
 #endif
 #include "authentication_i.h"
+#include "config.h"
 #include "kiran-accounts-gen.h"
+#include "kiran-auth-backend.h"
+#include "kiran-auth-fprint-arbiter.h"
+#include "kiran-auth-modules.h"
+#include "kiran-auth-pam-helper.h"
+#include "kiran-auth-pam-pool.h"
+#include "kiran-auth-pam-proto.h"
+#include "kiran-auth-race.h"
+#include "kiran-auth-registry.h"
+#include "kiran-auth-seat.h"
+#include "kiran-auth-user-cache.h"
 #include "kiran-biometrics-gen.h"
 #include "kiran-user-gen.h"
 
-#define MAX_THREAD_NUM 50
+#define DEFAULT_AUTH_THREADS 50
+#define DEFAULT_AUTH_QUEUE_LIMIT 64
+#define DEFAULT_AUTH_RESERVED_THREADS 2
+#define DEFAULT_AUTH_PRIORITY_AGING 5
+#define DEFAULT_KEY_POOL_LOW_WATERMARK 16
+#define DEFAULT_KEY_POOL_HIGH_WATERMARK 64
+#define DEFAULT_KEY_POOL_THREADS 2
+#define DEFAULT_PAM_HELPER_MAX_USES 32
+#define DEFAULT_PAM_STANDBY_HANDLES 2
+//等待pam辅助进程时检查会话是否停止的间隔，单位毫秒
+#define PAM_HELPER_POLL_INTERVAL 200
+//会话停止后等待pam辅助进程结束对话的时间，超过时强制结束辅助进程
+#define PAM_HELPER_STOP_GRACE 2
+#define RESPONSE_BUFFER_LEN 1024
+//等待应答或者指纹认证结果的超时时间，单位秒，与pam模块的等待时间一致
+#define DEFAULT_CONVERSATION_TIMEOUT 120
+#define DEFAULT_SESSION_TIMEOUT 300
+#define DEFAULT_IDLE_SESSION_TIMEOUT 300
+//最后一个会话释放指纹设备后保持设备运行的时间，单位秒
+#define DEFAULT_FPRINT_LEASE_GRACE 10
+//回收空闲会话的检查间隔，单位秒
+#define SESSION_REAPER_INTERVAL 30
 #define CONF_FILE "/etc/kiran-authentication-service/custom.conf"
 #define SERVICE "kiran-auth-service"
 
 #define KIRAN_BIO_SETTING_FILE "/etc/kiran-biometrics/settings.conf"
+#define BIOMETRICS_DBUS_NAME "com.kylinsec.Kiran.SystemDaemon.Biometrics"
+#define BIOMETRICS_OBJECT_PATH "/com/kylinsec/Kiran/SystemDaemon/Biometrics"
+//custom.conf中座席到指纹读取器的映射
+#define FPRINT_READERS_GROUP "FprintReaders"
+#ifdef AUTH_ENABLE_TEST_MODULES
+//测试时加载测试模块的目录，只从环境变量读取，只在开启BUILD_MOCK_AUTH_MODULE的构建中有效
+#define AUTH_TEST_MODULE_DIR_ENV "KIRAN_AUTH_TEST_MODULE_DIR"
+#endif
 #define SUPPORT_FINGER_KEY "SupportFinger"
 #define SUPPORT_FACE_KEY "SupportFace"
 
 typedef struct _AuthSession AuthSession;
+typedef struct _AuthEvent AuthEvent;
+typedef struct _FprintReader FprintReader;
+typedef struct _PrepareUserData PrepareUserData;
+
+/*
+ * 会话事件，主循环通过事件通道唤醒认证线程
+ */
+typedef enum
+{
+    //收到ResponseMessage应答，data为解密后的明文
+    AUTH_EVENT_RESPONSE = (1 << 0),
+    //会话被停止
+    AUTH_EVENT_CANCEL = (1 << 1),
+    //收到ResponseMessages应答，responses为解密后的明文，与对话中的消息一一对应
+    AUTH_EVENT_RESPONSES = (1 << 2),
+} AuthEventType;
+
+struct _AuthEvent
+{
+    AuthEventType type;
+    gchar *data;
+    gchar **responses;
+};
+
+/*
+ * 指纹读取器，对应生物认证服务中的一个对象，每个读取器有自己的设备仲裁，
+ * 不同读取器上的认证并行进行
+ */
+struct _FprintReader
+{
+    KiranAuthService *service;
+    gchar *object_path;
+    KiranBiometrics *proxy;
+    KiranAuthFprintArbiter *arbiter;
+};
 
 /*
  * 认证会话结构体，保存每个会话的
@@ -60,51 +141,143 @@ struct _AuthSession
     int session_auth_type;
     //是否抢占设备
     gboolean occupy;
-    //绑定指纹的id
-    GList *fprint_ids;
+    //会话类别，决定使用指纹设备以及排队等待认证线程的优先级
+    int auth_class;
+    //在认证线程队列中的调度截止时间，越早越优先，单位微秒
+    gint64 queue_deadline;
+    //在认证线程队列中排队或者正在认证的非交互式认证，计入auth_background
+    gboolean background_job;
+    //进入认证线程队列的时间
+    gint64 queue_time;
+    //整个认证的截止时间，0表示不限制，单位微秒
+    gint64 auth_deadline;
+    //最近一次创建、开始或者结束认证的时间，用于回收空闲会话
+    gint64 last_active;
+    //认证已经结束
+    gint finished;
+    //发送过的认证结果，结束后才关注的连接通过WatchSession补发，只在主循环中访问
+    gboolean have_final_status;
+    gint final_state;
+    gchar *final_username;
+    //各认证方式的调度，开始认证时按会话认证类型创建
+    KiranAuthRace *race;
+    //绑定指纹的id集合，与用户信息缓存共享
+    GHashTable *fprint_ids;
+    //绑定人脸的id集合，与用户信息缓存共享，未开启人脸认证时为NULL
+    GHashTable *face_ids;
+    //本轮还未比对的人脸模板，元素为face_ids中的字符串
+    GList *face_pending;
+    //正在比对的人脸模板id
+    const gchar *face_id;
+    //会话所在座席的指纹读取器，查询座席期间为NULL，通过原子操作访问
+    FprintReader *fprint_reader;
+    //查询座席期间开始了指纹认证，查询结束后再申请设备
+    gint fprint_deferred;
+
+    //一次对话中的所有消息通过AuthMessageBatch信号发送，由ResponseMessages统一应答
+    gboolean message_batch;
+    //PrepareUser正在进行的用户信息预取，只在主循环中访问
+    PrepareUserData *prefetch;
 
     //是否已经开始认证
     gboolean is_start;
+    //是否正在异步查询用户信息
+    gboolean is_pending;
     gboolean have_fingerprint_auth;
 
     //调用者dbus连接
     char *sender;
+    //监视调用者连接，连接断开时停止认证
+    guint sender_watch_id;
+    //通过WatchSession关注认证结果的其它连接，如pam模块，由watchers_mutex保护
+    GPtrArray *watchers;
 
     pam_handle_t *pam_handle;
-    GCond prompt_cond;
-    GMutex prompt_mutex;
-    gchar *respons_msg;
     gboolean stop_auth;
-    GCond stop_cond;
-    GMutex stop_mutex;
+    //事件通道，元素为AuthEvent，认证线程按类型等待
+    GAsyncQueue *events;
+    //会话索引表和认证线程各持有一个引用，停止会话时无需等待认证线程结束
+    gint ref_count;
 
     KiranAuthService *service;
 
-    //解密私钥
-    char *key;
+    //解密私钥，CreateAuth时解析一次，之后每次应答直接使用
+    KiranAuthKey *key;
 
     //是否认证结束
     gboolean auth_completed;
-    GCond auth_cond;
-    GMutex auth_mutex;
 };
 
 struct _KiranAuthServicePrivate
 {
     guint bus_name_id;
 
-    //认证列表
-    GList *auth_list;
+    //认证会话索引表，按sid和sender索引
+    KiranAuthRegistry *auth_registry;
     //认证线程池
     GThreadPool *auth_thread_pool;
+    int auth_threads;
+    //等待空闲线程的会话数上限，小于等于0时不限制
+    int auth_queue_limit;
+    //认证线程栈大小，单位KB，0表示使用系统默认值
+    int auth_thread_stack_size;
+    //正在执行认证的线程数
+    gint auth_running;
+    //因队列已满被拒绝的StartAuth次数
+    guint64 auth_rejected;
+    //为登录界面和锁屏保留的线程数，授权类会话不能使用
+    int auth_reserved_threads;
+    //授权类会话已入队或正在认证的数量
+    gint auth_background;
+    //每降低一个会话类别，调度截止时间推迟的秒数，用于老化避免饥饿
+    int auth_priority_aging;
     //默认的会话认证类型
     int default_session_auth_type;
 
+    //等待用户应答的超时时间，单位秒
+    int conversation_timeout;
+    //从开始认证到得到结果的超时时间，单位秒，小于等于0时不限制
+    int session_timeout;
+    //未开始或者已结束认证的会话空闲多久后回收，单位秒，小于等于0时不回收
+    int idle_session_timeout;
+    guint session_reaper_id;
+    guint64 sessions_reaped;
+
+    //pam辅助进程池，为NULL时在认证线程中执行pam认证
+    KiranAuthPamHelperPool *pam_helper_pool;
+    int pam_helpers;
+    //每个辅助进程最多执行的认证次数，超过后回收
+    int pam_helper_max_uses;
+    //预先pam_start的备用句柄，为NULL时每次认证调用pam_start
+    KiranAuthPamPool *pam_pool;
+    int pam_standby_handles;
+
     KiranBiometrics *biometrics;
     KiranAccounts *accounts;
-
-    //当前进行指纹认证的会话
-    AuthSession *cur_fprint_session;
+    //用户认证信息缓存
+    KiranAuthUserCache *user_cache;
+
+    //指纹读取器，第一个为默认读取器，元素为FprintReader
+    GPtrArray *fprint_readers;
+    //座席ID到读取器的映射，没有配置的座席使用默认读取器
+    GHashTable *seat_readers;
+    //配置的座席读取器对象路径，创建读取器后释放
+    GHashTable *fprint_reader_paths;
+    //人脸设备仲裁，与指纹设备相互独立
+    KiranAuthFprintArbiter *face_arbiter;
+    //指纹设备空闲多久后停止，单位秒，小于0时每个会话结束都停止设备
+    int fprint_lease_grace;
+
+    //认证后端模块，包括内置的密码、指纹、人脸模块和从模块目录加载的模块
+    KiranAuthModules *auth_modules;
+    //由模块生成的调度后端，元素为KiranAuthRaceBackend
+    GArray *auth_backends;
+    //是否从模块目录加载模块
+    gboolean enable_auth_modules;
+
+    //会话信号是否广播，默认只发送给会话的调用者和关注者
+    gboolean broadcast_signals;
+    GMutex watchers_mutex;
 
     GDBusConnection *connection;
 
@@ -112,6 +285,12 @@ struct _KiranAuthServicePrivate
     gboolean support_finger;
     //人脸支持
     gboolean support_face;
+
+    //预生成的公私钥池
+    KiranAuthKeyPool *key_pool;
+    int key_pool_low_watermark;
+    int key_pool_high_watermark;
+    int key_pool_threads;
 };
 
 static void kiran_authentication_gen_init(KiranAuthenticationGenIface *iface);
@@ -124,6 +303,72 @@ G_DEFINE_TYPE_WITH_CODE(KiranAuthService, kiran_auth_service, KIRAN_TYPE_AUTHENT
 
 static void do_session_passwd_auth(KiranAuthService *service,
                                    AuthSession *session);
+static void auth_session_start_race(KiranAuthService *service,
+                                    AuthSession *session);
+
+static int
+get_conf_integer(GKeyFile *key_file,
+                 const char *key,
+                 int default_value)
+{
+    GError *error = NULL;
+    int value;
+
+    value = g_key_file_get_integer(key_file, "daemon", key, &error);
+    if (error != NULL)
+    {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return value;
+}
+
+static gboolean
+get_conf_boolean(GKeyFile *key_file,
+                 const char *key,
+                 gboolean default_value)
+{
+    GError *error = NULL;
+    gboolean value;
+
+    value = g_key_file_get_boolean(key_file, "daemon", key, &error);
+    if (error != NULL)
+    {
+        g_error_free(error);
+        return default_value;
+    }
+
+    return value;
+}
+
+/*
+ * 多座席主机上每个座席的指纹读取器，值为生物认证服务中读取器的对象路径
+ */
+static void
+load_fprint_reader_paths(KiranAuthService *service,
+                         GKeyFile *key_file)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    gchar **seats;
+    gchar *path;
+    gint i;
+
+    seats = g_key_file_get_keys(key_file, FPRINT_READERS_GROUP, NULL, NULL);
+    for (i = 0; seats && seats[i]; i++)
+    {
+        path = g_key_file_get_string(key_file, FPRINT_READERS_GROUP, seats[i], NULL);
+        if (path == NULL || !g_variant_is_object_path(path))
+        {
+            dzlog_error("Invalid fprint reader path for seat %s: %s", seats[i], path ? path : "");
+            g_free(path);
+            continue;
+        }
+
+        g_hash_table_replace(priv->fprint_reader_paths, g_strdup(seats[i]), path);
+    }
+    g_strfreev(seats);
+}
 
 static int
 default_session_auth_setting(KiranAuthService *service)
@@ -131,7 +376,7 @@ default_session_auth_setting(KiranAuthService *service)
     KiranAuthServicePrivate *priv = service->priv;
     GKeyFile *key_file = NULL;
     GError *error = NULL;
-    int session_auth_type;
+    int session_auth_type = SESSION_AUTH_TYPE_ONE;
     gboolean ret;
     int value;
 
@@ -145,6 +390,8 @@ default_session_auth_setting(KiranAuthService *service)
     {
         dzlog_error("Key file load fialed: %s", error->message);
         g_error_free(error);
+        g_key_file_free(key_file);
+        priv->default_session_auth_type = session_auth_type;
         return session_auth_type;
     }
 
@@ -177,10 +424,75 @@ default_session_auth_setting(KiranAuthService *service)
         break;
     }
 
+    //公私钥池水位及后台生成线程数，高水位为0时不预生成
+    priv->key_pool_low_watermark = get_conf_integer(key_file,
+                                                    "KeyPoolLowWatermark",
+                                                    priv->key_pool_low_watermark);
+    priv->key_pool_high_watermark = get_conf_integer(key_file,
+                                                     "KeyPoolHighWatermark",
+                                                     priv->key_pool_high_watermark);
+    priv->key_pool_threads = get_conf_integer(key_file,
+                                              "KeyPoolThreads",
+                                              priv->key_pool_threads);
+
+    //认证线程池大小、排队上限及线程栈大小
+    priv->auth_threads = get_conf_integer(key_file,
+                                          "AuthThreads",
+                                          priv->auth_threads);
+    priv->auth_queue_limit = get_conf_integer(key_file,
+                                              "AuthQueueLimit",
+                                              priv->auth_queue_limit);
+    priv->auth_thread_stack_size = get_conf_integer(key_file,
+                                                    "AuthThreadStackSize",
+                                                    priv->auth_thread_stack_size);
+    priv->auth_reserved_threads = get_conf_integer(key_file,
+                                                   "AuthReservedThreads",
+                                                   priv->auth_reserved_threads);
+    priv->auth_priority_aging = get_conf_integer(key_file,
+                                                 "AuthPriorityAging",
+                                                 priv->auth_priority_aging);
+
+    //对话和认证的超时时间以及空闲会话的回收时间
+    priv->conversation_timeout = get_conf_integer(key_file,
+                                                  "ConversationTimeout",
+                                                  priv->conversation_timeout);
+    priv->session_timeout = get_conf_integer(key_file,
+                                             "SessionTimeout",
+                                             priv->session_timeout);
+    priv->idle_session_timeout = get_conf_integer(key_file,
+                                                  "IdleSessionTimeout",
+                                                  priv->idle_session_timeout);
+
+    //pam认证在预先启动的辅助进程中执行，0表示在认证线程中执行
+    priv->pam_helpers = get_conf_integer(key_file,
+                                         "PamHelpers",
+                                         priv->pam_helpers);
+    priv->pam_helper_max_uses = get_conf_integer(key_file,
+                                                 "PamHelperMaxUses",
+                                                 priv->pam_helper_max_uses);
+    priv->pam_standby_handles = get_conf_integer(key_file,
+                                                 "PamStandbyHandles",
+                                                 priv->pam_standby_handles);
+
+    //兼容只按sid过滤广播信号的旧客户端
+    priv->broadcast_signals = get_conf_boolean(key_file,
+                                               "BroadcastSignals",
+                                               priv->broadcast_signals);
+    priv->fprint_lease_grace = get_conf_integer(key_file,
+                                                "FprintLeaseGrace",
+                                                priv->fprint_lease_grace);
+    priv->enable_auth_modules = get_conf_boolean(key_file,
+                                                 "EnableAuthModules",
+                                                 priv->enable_auth_modules);
+
+    load_fprint_reader_paths(service, key_file);
+
     g_key_file_free(key_file);
     key_file = NULL;
 
     priv->default_session_auth_type = session_auth_type;
+
+    return session_auth_type;
 }
 
 static void
@@ -217,1025 +529,4155 @@ init_bio_support(KiranAuthService *service)
     key_file = NULL;
 }
 
+/*
+ * 清零并释放n条应答，应答中可能包含密码
+ */
 static void
-auth_session_free(gpointer data)
+auth_responses_free(gchar **responses,
+                    gint n)
 {
-    AuthSession *session = data;
-
-    g_mutex_clear(&session->prompt_mutex);
-    g_cond_clear(&session->prompt_cond);
-    g_mutex_clear(&session->stop_mutex);
-    g_cond_clear(&session->stop_cond);
-    g_mutex_clear(&session->auth_mutex);
-    g_cond_clear(&session->auth_cond);
+    gint i;
 
-    g_free(session->username);
-    g_free(session->sender);
-    g_list_free_full(session->fprint_ids, g_free);
-    g_free(session->key);
-    g_free(session);
+    for (i = 0; i < n; i++)
+    {
+        if (responses[i])
+        {
+            memset(responses[i], 0, strlen(responses[i]));
+            g_free(responses[i]);
+        }
+    }
+    g_free(responses);
 }
 
 static void
-kiran_auth_service_finalize(GObject *object)
+auth_event_free(gpointer data)
 {
-    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
-    KiranAuthServicePrivate *priv = service->priv;
-
-    if (priv->bus_name_id > 0)
-    {
-        g_bus_unown_name(priv->bus_name_id);
-        priv->bus_name_id = 0;
-    }
+    AuthEvent *event = data;
 
-    if (priv->biometrics)
+    if (event->data)
     {
-        g_object_unref(priv->biometrics);
-        priv->biometrics = NULL;
+        //应答中可能包含密码
+        memset(event->data, 0, strlen(event->data));
+        g_free(event->data);
     }
-
-    if (priv->accounts)
+    if (event->responses)
     {
-        g_object_unref(priv->accounts);
-        priv->accounts = NULL;
+        auth_responses_free(event->responses, g_strv_length(event->responses));
     }
+    g_free(event);
+}
 
-    g_list_free_full(priv->auth_list, auth_session_free);
-    priv->auth_list = NULL;
-
-    g_thread_pool_free(priv->auth_thread_pool,
-                       TRUE,
-                       TRUE);
+static AuthSession *
+auth_session_new()
+{
+    AuthSession *session = g_new0(AuthSession, 1);
 
-    priv->auth_thread_pool = NULL;
+    session->events = g_async_queue_new_full(auth_event_free);
+    session->ref_count = 1;
+    session->last_active = g_get_monotonic_time();
 
-    G_OBJECT_CLASS(kiran_auth_service_parent_class)->finalize(object);
+    return session;
 }
 
-static gint
-id_compare(const gchar *a, const gchar *b)
+static AuthSession *
+auth_session_ref(AuthSession *session)
 {
-    return g_strcmp0(a, b);
+    g_atomic_int_inc(&session->ref_count);
+
+    return session;
 }
 
 static void
-verify_fprint_status_cb(KiranBiometrics *object,
-                        const gchar *arg_result,
-                        gboolean arg_done,
-                        gboolean arg_found,
-                        const gchar *arg_id,
-                        gpointer user_data)
+auth_session_unref(gpointer data)
 {
-    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
-    KiranAuthServicePrivate *priv = service->priv;
-    AuthSession *session = priv->cur_fprint_session;
+    AuthSession *session = data;
 
-    //认证结束
-    if (!session || session->auth_completed)
-    {
+    if (!g_atomic_int_dec_and_test(&session->ref_count))
         return;
-    }
 
-    dzlog_debug("verify_fprint_status: %s, %d, %d, %s\n",
-                arg_result,
-                arg_done,
-                arg_found,
-                arg_id);
+    g_async_queue_unref(session->events);
+    g_free(session->sid);
+    g_free(session->username);
+    g_free(session->final_username);
+    if (session->sender_watch_id > 0)
+        g_bus_unwatch_name(session->sender_watch_id);
+    g_free(session->sender);
+    if (session->watchers)
+        g_ptr_array_free(session->watchers, TRUE);
+    if (session->fprint_ids)
+        g_hash_table_unref(session->fprint_ids);
+    kiran_auth_race_free(session->race);
+    g_list_free(session->face_pending);
+    if (session->face_ids)
+        g_hash_table_unref(session->face_ids);
+    kiran_authentication_key_free(session->key);
+    g_free(session);
+}
 
-    if (!arg_found)
-    {
-        //发送指纹认证提示消息
-        kiran_authentication_gen_emit_auth_messages(KIRAN_AUTHENTICATION_GEN(service),
-                                                    arg_result,
-                                                    PAM_TEXT_INFO,
-                                                    session->sid);
-        return;
-    }
+static void
+auth_session_post_event(AuthSession *session,
+                        AuthEventType type,
+                        gchar *data)
+{
+    AuthEvent *event = g_new0(AuthEvent, 1);
 
-    if (session->session_auth_type == SESSION_AUTH_TYPE_TOGETHER)
-    {
-        KiranAccountsUser *user = NULL;
-        GError *error = NULL;
-        gchar *path = NULL;
+    event->type = type;
+    event->data = data;
+    g_async_queue_push(session->events, event);
+}
+
+/*
+ * 停止会话的认证，唤醒正在等待事件的认证线程
+ */
+static void
+auth_session_cancel(gpointer data,
+                    gpointer user_data)
+{
+    AuthSession *session = data;
+
+    session->stop_auth = TRUE;
+    auth_session_post_event(session, AUTH_EVENT_CANCEL, NULL);
+}
 
-        //查找绑定的用户
-        kiran_accounts_call_find_user_by_auth_data_sync(priv->accounts,
-                                                        ACCOUNTS_AUTH_MODE_FINGERPRINT,
-                                                        arg_id,
-                                                        &path,
-                                                        NULL,
-                                                        &error);
+/*
+ * 等待给定类型的事件，期间收到的其它事件保留在通道中，
+ * AUTH_EVENT_CANCEL总是会被返回并且不从通道中移除，保证后续等待也能立即返回
+ *
+ * @param[in] types 等待的事件类型集合
+ * @param[in] timeout_us 超时时间，小于0时一直等待
+ * @return 超时返回NULL，返回的事件由调用者释放
+ */
+static AuthEvent *
+auth_session_wait_event(AuthSession *session,
+                        guint types,
+                        gint64 timeout_us)
+{
+    gint64 deadline = timeout_us < 0 ? -1 : g_get_monotonic_time() + timeout_us;
+    GList *deferred = NULL;
+    GList *iter;
+    AuthEvent *event = NULL;
 
-        if (path == NULL)
+    while (TRUE)
+    {
+        if (deadline < 0)
         {
-            dzlog_error("find fingerprint id with user fail: %s", error->message);
-            g_error_free(error);
-            kiran_authentication_gen_emit_auth_messages(KIRAN_AUTHENTICATION_GEN(service),
-                                                        _("The fingerprint is not bound to a user, place again!"),
-                                                        PAM_TEXT_INFO,
-                                                        session->sid);
+            event = g_async_queue_pop(session->events);
         }
         else
         {
-            dzlog_debug("find fingerprint id  %s with user path %s\n", arg_id, path);
-
-            error = NULL;
-            user = kiran_accounts_user_proxy_new_sync(priv->connection,
-                                                      G_BUS_NAME_WATCHER_FLAGS_NONE,
-                                                      ACCOUNTS_DBUS_INTERFACE_NAME,
-                                                      path,
-                                                      NULL,
-                                                      &error);
-
-            if (user == NULL)
-            {
-                dzlog_error("Error with getting the bus: %s", error->message);
-                g_error_free(error);
-            }
-            else
-            {
-                const gchar *username;
-                gint authmode;
-
-                username = kiran_accounts_user_get_user_name(user);
-                authmode = kiran_accounts_user_get_auth_modes(user);
+            gint64 remaining = deadline - g_get_monotonic_time();
 
-                if (username)
-                {
-                    dzlog_debug("get fingerprint user name %s", username);
-
-                    //该用户支持指纹登录
-                    if (authmode & ACCOUNTS_AUTH_MODE_FINGERPRINT)
-                    {
-                        //停止指纹认证
-                        kiran_biometrics_call_verify_fprint_stop_sync(priv->biometrics, NULL, NULL);
-                        priv->cur_fprint_session = NULL;
-                        //指纹认证成功
-                        kiran_authentication_gen_emit_auth_status(KIRAN_AUTHENTICATION_GEN(service),
-                                                                  username,
-                                                                  SESSION_AUTH_SUCCESS,
-                                                                  session->sid);
-                    }
-                    else
-                    {
-                        char *msg;
-
-                        dzlog_debug("User %s does not turn on fingerprint authentication", username);
-
-                        msg = g_strdup_printf(_("User %s does not turn on fingerprint authentication, place again!"), username);
-                        kiran_authentication_gen_emit_auth_messages(KIRAN_AUTHENTICATION_GEN(service),
-                                                                    msg,
-                                                                    PAM_TEXT_INFO,
-                                                                    session->sid);
-                        g_free(msg);
-                    }
-                }
-                g_object_unref(user);
-            }
+            event = remaining > 0 ? g_async_queue_timeout_pop(session->events, remaining) : NULL;
         }
 
-        g_free(path);
-    }
-    else
-    {
-        if (g_list_find_custom(session->fprint_ids, arg_id, (GCompareFunc)id_compare) == NULL)
-        {
-            dzlog_debug("User %s and fprint id %s not math", session->username, arg_id);
-            kiran_authentication_gen_emit_auth_messages(KIRAN_AUTHENTICATION_GEN(service),
-                                                        _("User and fprint not math, place again!"),
-                                                        PAM_TEXT_INFO,
-                                                        session->sid);
-            return;
-        }
+        if (event == NULL)
+            break;
 
-        if (session->session_auth_type == SESSION_AUTH_TYPE_TOGETHER_WITH_USER)
+        if (event->type == AUTH_EVENT_CANCEL)
         {
-            //停止指纹认证
-            kiran_biometrics_call_verify_fprint_stop_sync(priv->biometrics, NULL, NULL);
-            priv->cur_fprint_session = NULL;
-            //指纹认证成功
-            kiran_authentication_gen_emit_auth_status(KIRAN_AUTHENTICATION_GEN(service),
-                                                      session->username,
-                                                      SESSION_AUTH_SUCCESS,
-                                                      session->sid);
+            deferred = g_list_prepend(deferred, event);
+            event = g_new0(AuthEvent, 1);
+            event->type = AUTH_EVENT_CANCEL;
+            break;
         }
-        else
-        {
-            //停止指纹认证
-            kiran_biometrics_call_verify_fprint_stop_sync(priv->biometrics, NULL, NULL);
-            priv->cur_fprint_session = NULL;
 
-            if (session->user_auth_mode & ACCOUNTS_AUTH_MODE_PASSWORD)
-            {
-                //进行串行认证，指纹通过
-                kiran_authentication_gen_emit_auth_method_changed(KIRAN_AUTHENTICATION_GEN(service),
-                                                                  SESSION_AUTH_METHOD_PASSWORD,
-                                                                  session->sid);
-                kiran_authentication_gen_emit_auth_messages(KIRAN_AUTHENTICATION_GEN(service),
-                                                            _("Fingerprint auth successed!"),
-                                                            PAM_TEXT_INFO,
-                                                            session->sid);
-                g_mutex_lock(&session->auth_mutex);
-                g_cond_signal(&session->auth_cond);
-                g_mutex_unlock(&session->auth_mutex);
-            }
-            else
-            {
-                //只需要指纹认证
-                kiran_authentication_gen_emit_auth_status(KIRAN_AUTHENTICATION_GEN(service),
-                                                          session->username,
-                                                          SESSION_AUTH_SUCCESS,
-                                                          session->sid);
-            }
-        }
+        if (event->type & types)
+            break;
+
+        deferred = g_list_prepend(deferred, event);
     }
+
+    //按原来的顺序放回通道
+    for (iter = deferred; iter; iter = iter->next)
+    {
+        g_async_queue_push_front(session->events, iter->data);
+    }
+    g_list_free(deferred);
+
+    return event;
 }
 
-static AuthSession *
-find_auth_session_by_sender(KiranAuthService *service,
-                            const char *sender)
+/*
+ * 单次等待的超时时间，单位微秒，不超过会话的认证截止时间
+ */
+static gint64
+auth_session_wait_timeout(AuthSession *session)
 {
-    KiranAuthServicePrivate *priv = service->priv;
-    GList *iter = priv->auth_list;
+    KiranAuthServicePrivate *priv = session->service->priv;
+    gint64 timeout = (gint64)priv->conversation_timeout * G_USEC_PER_SEC;
 
-    for (; iter; iter = iter->next)
+    if (session->auth_deadline > 0)
     {
-        AuthSession *session = iter->data;
-
-        if (g_strcmp0(session->sender, sender) == 0)
-        {
-            return session;
-        }
+        timeout = MIN(timeout, MAX(session->auth_deadline - g_get_monotonic_time(), 0));
     }
 
-    return NULL;
+    return timeout;
 }
 
 static void
-auth_session_stop(KiranAuthService *service,
-                  AuthSession *session)
+kiran_auth_service_finalize(GObject *object)
 {
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
     KiranAuthServicePrivate *priv = service->priv;
 
-    dzlog_debug("Session %s stop begin", session->sid);
-
-    session->auth_completed = TRUE;
-
-    if (session == priv->cur_fprint_session)
+    if (priv->bus_name_id > 0)
     {
-        //停止指纹认证
-        kiran_biometrics_call_verify_fprint_stop_sync(priv->biometrics, NULL, NULL);
-        priv->cur_fprint_session = NULL;
-        g_mutex_lock(&session->auth_mutex);
-        g_cond_signal(&session->auth_cond);
-        g_mutex_unlock(&session->auth_mutex);
+        g_bus_unown_name(priv->bus_name_id);
+        priv->bus_name_id = 0;
     }
 
-    //停止密码认证
-    if (session->pam_handle)
+    if (priv->session_reaper_id > 0)
     {
-        g_mutex_lock(&session->prompt_mutex);
-        g_cond_signal(&session->prompt_cond);
-        g_mutex_unlock(&session->prompt_mutex);
-        session->stop_auth = TRUE;
-
-        //如果还没有关闭pam
-        if (session->pam_handle != NULL)
-        {
-            g_mutex_lock(&session->stop_mutex);
-            g_cond_wait(&session->stop_cond, &session->stop_mutex);
-            g_mutex_unlock(&session->stop_mutex);
-        }
+        g_source_remove(priv->session_reaper_id);
+        priv->session_reaper_id = 0;
     }
 
-    dzlog_debug("Session %s stop end", session->sid);
+    //唤醒所有认证线程，等待线程结束后再释放其它资源
+    kiran_auth_registry_foreach(priv->auth_registry, auth_session_cancel, NULL);
+    g_thread_pool_free(priv->auth_thread_pool,
+                       TRUE,
+                       TRUE);
 
-    //删除该会话
-    priv->auth_list = g_list_remove(priv->auth_list, session);
-    auth_session_free(session);
-}
+    priv->auth_thread_pool = NULL;
 
-static void
-on_name_lost(GDBusConnection *connection,
-             const gchar *sender_name,
-             const gchar *object_path,
-             const gchar *interface_name,
-             const gchar *signal_name,
-             GVariant *parameters,
-             gpointer user_data)
-{
-    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
-    KiranAuthServicePrivate *priv = service->priv;
-    AuthSession *session = NULL;
-    GVariant *value;
-    const gchar *first;
-    const gchar *last;
-    gsize length;
-    gsize i;
+    //仲裁释放时停止仍在运行的设备，需要在释放生物认证代理之前
+    g_hash_table_destroy(priv->seat_readers);
+    priv->seat_readers = NULL;
+    g_ptr_array_free(priv->fprint_readers, TRUE);
+    priv->fprint_readers = NULL;
+    kiran_auth_fprint_arbiter_free(priv->face_arbiter);
+    priv->face_arbiter = NULL;
+
+    if (priv->biometrics)
+    {
+        g_object_unref(priv->biometrics);
+        priv->biometrics = NULL;
+    }
 
-    length = g_variant_n_children(parameters);
+    kiran_auth_user_cache_free(priv->user_cache);
+    priv->user_cache = NULL;
 
-    if (length < 1)
-        return;
+    if (priv->accounts)
+    {
+        g_object_unref(priv->accounts);
+        priv->accounts = NULL;
+    }
 
-    value = g_variant_get_child_value(parameters, 0);
-    first = g_variant_get_string(value, NULL);
+    kiran_auth_registry_free(priv->auth_registry);
+    priv->auth_registry = NULL;
 
-    value = g_variant_get_child_value(parameters, length - 1);
-    last = g_variant_get_string(value, NULL);
+    //所有会话都已释放，不会再调用模块
+    kiran_auth_modules_free(priv->auth_modules);
+    priv->auth_modules = NULL;
+    g_array_free(priv->auth_backends, TRUE);
+    priv->auth_backends = NULL;
+    g_mutex_clear(&priv->watchers_mutex);
 
-    session = find_auth_session_by_sender(service, first);
+    kiran_authentication_key_pool_free(priv->key_pool);
+    priv->key_pool = NULL;
 
-    if (session && (g_strcmp0(last, "") == 0))
-    {
-        //dbus连接断开，停止本次认证
-        auth_session_stop(service, session);
-    }
+    kiran_auth_pam_helper_pool_free(priv->pam_helper_pool);
+    priv->pam_helper_pool = NULL;
+
+    kiran_auth_pam_pool_free(priv->pam_pool);
+    priv->pam_pool = NULL;
+
+    G_OBJECT_CLASS(kiran_auth_service_parent_class)->finalize(object);
 }
 
+/*
+ * 将会话信号单播给调用者，to_watchers为TRUE时同时发送给关注者
+ */
 static void
-bus_acquired_cb(GDBusConnection *connection,
-                const char *name,
-                gpointer user_data)
+auth_session_emit_signal(KiranAuthService *service,
+                         AuthSession *session,
+                         const gchar *signal_name,
+                         GVariant *parameters,
+                         gboolean to_watchers)
 {
-    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
     KiranAuthServicePrivate *priv = service->priv;
-    GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON(service);
+    const gchar *interface_name = kiran_authentication_gen_interface_info()->name;
     GError *error = NULL;
+    guint i;
 
-    priv->connection = connection;
-    g_dbus_interface_skeleton_export(skeleton,
-                                     connection,
-                                     AUTH_SERVICE_OBJECT_PATH,
-                                     &error);
+    g_variant_ref_sink(parameters);
 
+    g_dbus_connection_emit_signal(priv->connection,
+                                  session->sender,
+                                  AUTH_SERVICE_OBJECT_PATH,
+                                  interface_name,
+                                  signal_name,
+                                  parameters,
+                                  &error);
     if (error != NULL)
     {
-        dzlog_error("Failed export interface: %s", error->message);
-        g_error_free(error);
+        dzlog_error("Emit %s to %s failed: %s", signal_name, session->sender, error->message);
+        g_clear_error(&error);
     }
 
-    error = NULL;
-    priv->biometrics = kiran_biometrics_proxy_new_sync(connection,
-                                                       G_BUS_NAME_WATCHER_FLAGS_NONE,
-                                                       "com.kylinsec.Kiran.SystemDaemon.Biometrics",
-                                                       "/com/kylinsec/Kiran/SystemDaemon/Biometrics",
-                                                       NULL,
-                                                       &error);
-    if (priv->biometrics)
-    {
-        g_signal_connect(priv->biometrics,
-                         "verify-fprint-status",
-                         G_CALLBACK(verify_fprint_status_cb),
-                         service);
-    }
-    else
+    g_mutex_lock(&priv->watchers_mutex);
+    for (i = 0; to_watchers && session->watchers && i < session->watchers->len; i++)
     {
-        dzlog_error("Failed biometrics new: %s", error->message);
-        g_error_free(error);
+        const gchar *watcher = g_ptr_array_index(session->watchers, i);
+
+        g_dbus_connection_emit_signal(priv->connection,
+                                      watcher,
+                                      AUTH_SERVICE_OBJECT_PATH,
+                                      interface_name,
+                                      signal_name,
+                                      parameters,
+                                      &error);
+        if (error != NULL)
+        {
+            dzlog_error("Emit %s to %s failed: %s", signal_name, watcher, error->message);
+            g_clear_error(&error);
+        }
     }
+    g_mutex_unlock(&priv->watchers_mutex);
 
-    error = NULL;
-    priv->accounts = kiran_accounts_proxy_new_sync(connection,
-                                                   G_BUS_NAME_WATCHER_FLAGS_NONE,
-                                                   ACCOUNTS_DBUS_NAME,
-                                                   ACCOUNTS_OBJECT_PATH,
-                                                   NULL,
-                                                   &error);
-    if (priv->accounts == NULL)
+    g_variant_unref(parameters);
+}
+
+static void
+auth_session_emit_auth_messages(KiranAuthService *service,
+                                AuthSession *session,
+                                const gchar *message,
+                                gint type)
+{
+    if (service->priv->broadcast_signals || session->sender == NULL)
     {
-        dzlog_error("Error with getting the bus: %s", error->message);
-        g_error_free(error);
+        kiran_authentication_gen_emit_auth_messages(KIRAN_AUTHENTICATION_GEN(service),
+                                                    message,
+                                                    type,
+                                                    session->sid);
+        return;
     }
 
-    //监听bus总线信号
-    g_dbus_connection_signal_subscribe(connection,
-                                       "org.freedesktop.DBus",
-                                       "org.freedesktop.DBus",
-                                       NULL,
-                                       "/org/freedesktop/DBus",
-                                       NULL,
-                                       G_DBUS_SIGNAL_FLAGS_NONE,
-                                       (GDBusSignalCallback)on_name_lost,
-                                       service, NULL);
+    //提示信息只发送给调用者，避免泄露给其它进程
+    auth_session_emit_signal(service,
+                             session,
+                             "AuthMessages",
+                             g_variant_new("(sis)", message, type, session->sid),
+                             FALSE);
 }
 
-static AuthSession *
-find_auth_session_by_sid(KiranAuthService *service,
-                         const char *sid)
+static void
+auth_session_emit_auth_message_batch(KiranAuthService *service,
+                                     AuthSession *session,
+                                     gint n_messages,
+                                     const struct pam_message **msg)
 {
-    KiranAuthServicePrivate *priv = service->priv;
-    GList *iter = priv->auth_list;
+    GVariantBuilder builder;
+    GVariant *messages;
+    gint i;
 
-    for (; iter; iter = iter->next)
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a(is)"));
+    for (i = 0; i < n_messages; i++)
     {
-        AuthSession *session = iter->data;
+        g_variant_builder_add(&builder, "(is)", msg[i]->msg_style, msg[i]->msg ? msg[i]->msg : "");
+    }
+    messages = g_variant_builder_end(&builder);
 
-        if (g_strcmp0(session->sid, sid) == 0)
-        {
-            return session;
-        }
+    if (service->priv->broadcast_signals || session->sender == NULL)
+    {
+        kiran_authentication_gen_emit_auth_message_batch(KIRAN_AUTHENTICATION_GEN(service),
+                                                         messages,
+                                                         session->sid);
+        return;
     }
 
-    return NULL;
+    auth_session_emit_signal(service,
+                             session,
+                             "AuthMessageBatch",
+                             g_variant_new("(@a(is)s)", messages, session->sid),
+                             FALSE);
 }
 
-static gboolean
-kiran_auth_service_handle_create_auth(KiranAuthenticationGen *object,
-                                      GDBusMethodInvocation *invocation)
+static void
+auth_session_emit_auth_status(KiranAuthService *service,
+                              AuthSession *session,
+                              const gchar *username,
+                              gint state)
 {
-    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
-    KiranAuthServicePrivate *priv = service->priv;
-    AuthSession *new_auth_session = NULL;
-    AuthSession *session = NULL;
-    gchar *sid = g_uuid_string_random();
-    char *public_key = NULL;
-    char *private_key = NULL;
-    const gchar *sender;
-    gchar *encode = NULL;
-    gsize len = 0;
-
-    dzlog_debug("Handle create auth message");
-    sender = g_dbus_method_invocation_get_sender(invocation);
+    //在主循环中发送，记录下来补发给之后才关注的连接
+    g_free(session->final_username);
+    session->final_username = g_strdup(username);
+    session->final_state = state;
+    session->have_final_status = TRUE;
 
-    session = find_auth_session_by_sender(service, sender);
-    if (session)
+    if (service->priv->broadcast_signals || session->sender == NULL)
     {
-        //每个连接只允许创建一个认证
-        g_dbus_method_invocation_return_error(invocation,
-                                              G_DBUS_ERROR,
-                                              G_DBUS_ERROR_INVALID_ARGS,
-                                              "Have create a auth with connection");
-        return TRUE;
+        kiran_authentication_gen_emit_auth_status(KIRAN_AUTHENTICATION_GEN(service),
+                                                  username ? username : "",
+                                                  state,
+                                                  session->sid);
+        return;
     }
 
-    //创建通信的公私秘钥
-    kiran_authentication_rsa_key_gen(&public_key, &private_key);
-    if (public_key == NULL || private_key == NULL)
-    {
-        g_dbus_method_invocation_return_error(invocation,
-                                              G_DBUS_ERROR,
-                                              G_DBUS_ERROR_INVALID_ARGS,
-                                              "Create ras key failed!");
-        g_free(public_key);
-        g_free(private_key);
-        return TRUE;
-    }
+    auth_session_emit_signal(service,
+                             session,
+                             "AuthStatus",
+                             g_variant_new("(sis)", username ? username : "", state, session->sid),
+                             TRUE);
+}
 
-    session = find_auth_session_by_sid(service, sid);
-    while (session != NULL)
+static void
+auth_session_emit_auth_method_changed(KiranAuthService *service,
+                                      AuthSession *session,
+                                      gint method)
+{
+    if (service->priv->broadcast_signals || session->sender == NULL)
     {
-        //如果生成sid已经被占用，则重新生成
-        g_free(sid);
-        sid = g_uuid_string_random();
-        session = find_auth_session_by_sid(service, sid);
+        kiran_authentication_gen_emit_auth_method_changed(KIRAN_AUTHENTICATION_GEN(service),
+                                                          method,
+                                                          session->sid);
+        return;
     }
 
-    new_auth_session = g_new0(AuthSession, 1);
-    new_auth_session->sid = sid;
-    new_auth_session->key = private_key;
-
-    if (sender)
-        new_auth_session->sender = g_strdup(sender);
-
-    //添加到会话列表中
-    priv->auth_list = g_list_append(priv->auth_list, new_auth_session);
+    auth_session_emit_signal(service,
+                             session,
+                             "AuthMethodChanged",
+                             g_variant_new("(is)", method, session->sid),
+                             FALSE);
+}
 
-    encode = g_base64_encode(public_key,
-                             strlen(public_key));
-    kiran_authentication_gen_complete_create_auth(object,
-                                                  invocation,
-                                                  sid,
-                                                  encode);
+/*
+ * 指纹认证通过，设备交给下一个等待的会话，由调度决定结束认证还是继续其它认证方式
+ */
+static void
+fprint_auth_succeed(KiranAuthService *service,
+                    AuthSession *session,
+                    const gchar *username)
+{
+    kiran_auth_fprint_arbiter_release(session->fprint_reader->arbiter, session);
+    kiran_auth_race_report(session->race, SESSION_AUTH_METHOD_FINGERPRINT, TRUE, username);
+}
 
-    g_free(public_key);
-    g_free(encode);
+/*
+ * 多路并行认证时按指纹模板查找绑定用户
+ */
+typedef struct _FprintLookupData
+{
+    KiranAuthService *service;
+    FprintReader *reader;
+    gchar *sid;
+} FprintLookupData;
 
-    return TRUE;
+static void
+fprint_lookup_data_free(FprintLookupData *data)
+{
+    g_object_unref(data->service);
+    g_free(data->sid);
+    g_free(data);
 }
 
-static GList *
-parser_auth_items_json_data(const char *data)
+/*
+ * 查询期间会话可能已经结束或者指纹设备已经被其他会话使用
+ */
+static AuthSession *
+fprint_lookup_data_get_session(FprintLookupData *data)
 {
-    JsonParser *jparse = json_parser_new();
-    JsonNode *root;
-    JsonReader *reader;
-    GList *ids = NULL;
-    GError *error = NULL;
-    gboolean ret;
+    KiranAuthServicePrivate *priv = data->service->priv;
+    AuthSession *session;
 
-    ret = json_parser_load_from_data(jparse,
-                                     data,
-                                     -1,
-                                     &error);
-    if (!ret)
+    session = kiran_auth_registry_lookup_sid(priv->auth_registry, data->sid);
+    if (session == NULL ||
+        session != kiran_auth_fprint_arbiter_get_owner(data->reader->arbiter) ||
+        session->auth_completed)
     {
-        dzlog_error("Error with parse json data: %s", error->message);
-        g_error_free(error);
+        dzlog_debug("Session %s finished while looking up fingerprint user", data->sid);
         return NULL;
     }
 
-    root = json_parser_get_root(jparse);
-    if (json_node_get_node_type(root) == JSON_NODE_ARRAY)
+    return session;
+}
+
+static void
+fprint_together_not_bound(KiranAuthService *service,
+                          AuthSession *session)
+{
+    auth_session_emit_auth_messages(service,
+                                    session,
+                                    _("The fingerprint is not bound to a user, place again!"),
+                                    PAM_TEXT_INFO);
+}
+
+static void
+fprint_together_matched(KiranAuthService *service,
+                        AuthSession *session,
+                        const gchar *username,
+                        gint authmode)
+{
+    dzlog_debug("get fingerprint user name %s", username);
+
+    //该用户支持指纹登录
+    if (authmode & ACCOUNTS_AUTH_MODE_FINGERPRINT)
+    {
+        fprint_auth_succeed(service, session, username);
+    }
+    else
     {
-        JsonArray *array = json_node_get_array(root);
-        GList *list = json_array_get_elements(array);
-        GList *iter;
+        char *msg;
 
-        reader = json_reader_new(NULL);
-        for (iter = list; iter; iter = iter->next)
-        {
-            const gchar *data_id;
+        dzlog_debug("User %s does not turn on fingerprint authentication", username);
 
-            json_reader_set_root(reader, iter->data);
-            json_reader_read_member(reader, "data_id");
-            data_id = json_reader_get_string_value(reader);
-            ids = g_list_append(ids, g_strdup(data_id));
-        }
-        g_object_unref(reader);
+        msg = g_strdup_printf(_("User %s does not turn on fingerprint authentication, place again!"), username);
+        auth_session_emit_auth_messages(service,
+                                        session,
+                                        msg,
+                                        PAM_TEXT_INFO);
+        g_free(msg);
     }
+}
 
-    g_object_unref(jparse);
+static void
+fprint_lookup_load_cb(const gchar *username,
+                      gint auth_modes,
+                      gpointer user_data)
+{
+    FprintLookupData *data = user_data;
+    AuthSession *session;
 
-    return ids;
+    session = fprint_lookup_data_get_session(data);
+    if (session)
+    {
+        if (username)
+            fprint_together_matched(data->service, session, username, auth_modes);
+        else
+            dzlog_error("Error with loading the fingerprint user of session %s", data->sid);
+    }
+
+    fprint_lookup_data_free(data);
 }
 
-static gboolean
-get_user_account_info(KiranAuthService *service,
-                      AuthSession *session)
+static void
+fprint_lookup_find_user_cb(GObject *source_object,
+                           GAsyncResult *res,
+                           gpointer user_data)
 {
-    KiranAuthServicePrivate *priv = service->priv;
-    KiranAccountsUser *user = NULL;
+    FprintLookupData *data = user_data;
+    KiranAuthServicePrivate *priv = data->service->priv;
+    AuthSession *session;
     GError *error = NULL;
     gchar *path = NULL;
-    gchar *auth = NULL;
-    gchar *auth_items = NULL;
-    gboolean ret = TRUE;
 
-    session->user_auth_mode = ACCOUNTS_AUTH_MODE_NONE;
-    path = NULL;
-    error = NULL;
+    kiran_accounts_call_find_user_by_auth_data_finish(KIRAN_ACCOUNTS(source_object),
+                                                      &path,
+                                                      res,
+                                                      &error);
 
-    ret = kiran_accounts_call_find_user_by_name_sync(priv->accounts,
-                                                     session->username,
-                                                     &path,
-                                                     NULL,
-                                                     &error);
-    if (!ret)
+    session = fprint_lookup_data_get_session(data);
+    if (session == NULL)
     {
-        dzlog_error("Error with find the user object path: %s with %s", error->message, session->username);
-        g_error_free(error);
+        g_clear_error(&error);
+        g_free(path);
+        fprint_lookup_data_free(data);
+        return;
+    }
 
-        return FALSE;
+    if (path == NULL)
+    {
+        dzlog_error("find fingerprint id with user fail: %s", error ? error->message : "");
+        g_clear_error(&error);
+        fprint_together_not_bound(data->service, session);
+        fprint_lookup_data_free(data);
+        return;
     }
 
-    error = NULL;
-    user = kiran_accounts_user_proxy_new_sync(priv->connection,
-                                              G_BUS_NAME_WATCHER_FLAGS_NONE,
-                                              ACCOUNTS_DBUS_INTERFACE_NAME,
-                                              path,
-                                              NULL,
-                                              &error);
+    dzlog_debug("find fingerprint id with user path %s\n", path);
+
+    //加载用户信息的同时补全反向索引
+    kiran_auth_user_cache_load_path(priv->user_cache, path, fprint_lookup_load_cb, data);
     g_free(path);
+}
 
-    if (user == NULL)
+static void
+verify_fprint_status_cb(KiranBiometrics *object,
+                        const gchar *arg_result,
+                        gboolean arg_done,
+                        gboolean arg_found,
+                        const gchar *arg_id,
+                        gpointer user_data)
+{
+    FprintReader *reader = user_data;
+    KiranAuthService *service = reader->service;
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *session;
+
+    //设备的识别操作已经结束，租用模式下重新启动供后续会话使用
+    if (arg_done)
     {
-        dzlog_error("Error with getting the bus: %s", error->message);
-        g_error_free(error);
+        kiran_auth_fprint_arbiter_device_stopped(reader->arbiter);
+    }
 
-        return FALSE;
+    //识别结果交给当前使用该读取器的会话，没有会话使用时忽略
+    session = kiran_auth_fprint_arbiter_get_owner(reader->arbiter);
+    if (!session || session->auth_completed)
+    {
+        return;
     }
 
-    session->user_auth_mode = kiran_accounts_user_get_auth_modes(user);
+    dzlog_debug("verify_fprint_status: %s, %d, %d, %s\n",
+                arg_result,
+                arg_done,
+                arg_found,
+                arg_id);
 
-    error = NULL;
-    ret = kiran_accounts_user_call_get_auth_items_sync(user,
-                                                       ACCOUNTS_AUTH_MODE_FINGERPRINT,
-                                                       &auth_items,
-                                                       NULL,
-                                                       &error);
-    if (!ret || !auth_items)
+    if (!arg_found)
     {
-        dzlog_error("Error with getting the auth item: %s", error->message);
-        g_error_free(error);
-        ret = FALSE;
+        //发送指纹认证提示消息
+        auth_session_emit_auth_messages(service,
+                                        session,
+                                        arg_result,
+                                        PAM_TEXT_INFO);
+        return;
     }
-    else
+
+    if (session->session_auth_type == SESSION_AUTH_TYPE_TOGETHER)
     {
-        session->fprint_ids = parser_auth_items_json_data(auth_items);
-        dzlog_debug("Get fprint_ids %p with %s", session->fprint_ids, session->username);
-    }
+        const KiranAuthUserProfile *profile = NULL;
+        FprintLookupData *data;
+
+        //先查指纹模板反向索引，未命中时再异步查询accounts服务
+        if (priv->user_cache)
+        {
+            profile = kiran_auth_user_cache_lookup_fprint(priv->user_cache, arg_id);
+        }
 
-    g_object_unref(user);
+        if (profile)
+        {
+            dzlog_debug("find fingerprint id %s with cached user %s\n", arg_id, profile->username);
+            fprint_together_matched(service, session, profile->username, profile->auth_modes);
+            return;
+        }
+
+        data = g_new0(FprintLookupData, 1);
+        data->service = g_object_ref(service);
+        data->reader = reader;
+        data->sid = g_strdup(session->sid);
+        kiran_accounts_call_find_user_by_auth_data(priv->accounts,
+                                                   ACCOUNTS_AUTH_MODE_FINGERPRINT,
+                                                   arg_id,
+                                                   NULL,
+                                                   fprint_lookup_find_user_cb,
+                                                   data);
+    }
+    else
+    {
+        if (session->fprint_ids == NULL ||
+            !g_hash_table_contains(session->fprint_ids, arg_id))
+        {
+            dzlog_debug("User %s and fprint id %s not math", session->username, arg_id);
+            auth_session_emit_auth_messages(service,
+                                            session,
+                                            _("User and fprint not math, place again!"),
+                                            PAM_TEXT_INFO);
+            return;
+        }
 
-    return ret;
+        fprint_auth_succeed(service, session, session->username);
+    }
 }
 
+/*
+ * VerifyFaceStart每次只比对一个模板，依次比对用户绑定的人脸模板，一轮结束后重新开始
+ */
 static gboolean
-kiran_auth_service_handle_start_auth(KiranAuthenticationGen *object,
-                                     GDBusMethodInvocation *invocation,
-                                     const gchar *arg_username,
-                                     const gchar *arg_sid,
-                                     gint arg_type_op,
-                                     gboolean arg_occupy)
+face_verify_next(KiranAuthService *service,
+                 AuthSession *session)
 {
-    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
     KiranAuthServicePrivate *priv = service->priv;
-    AuthSession *session = NULL;
+    GList *head;
     GError *error = NULL;
-    gboolean ret = FALSE;
-
-    dzlog_debug("Handle start auth with sid: %s, username: %s", arg_sid, arg_username);
 
-    session = find_auth_session_by_sid(service, arg_sid);
-    if (session == NULL)
+    if (session->face_pending == NULL)
     {
-        //不存在对应的会话
-        g_dbus_method_invocation_return_error(invocation,
-                                              G_DBUS_ERROR,
-                                              G_DBUS_ERROR_INVALID_ARGS,
-                                              "The auth session id %s not existed",
-                                              arg_sid);
-        return TRUE;
+        session->face_pending = g_hash_table_get_keys(session->face_ids);
     }
 
-    if (session->is_start)
+    head = session->face_pending;
+    if (head == NULL)
+        return FALSE;
+
+    session->face_pending = g_list_remove_link(session->face_pending, head);
+    session->face_id = head->data;
+    g_list_free(head);
+
+    kiran_biometrics_call_verify_face_start_sync(priv->biometrics,
+                                                 session->face_id,
+                                                 NULL,
+                                                 &error);
+    if (error != NULL)
     {
-        //该会话正在进行中
-        g_dbus_method_invocation_return_error(invocation,
-                                              G_DBUS_ERROR,
-                                              G_DBUS_ERROR_INVALID_ARGS,
-                                              "The auth session already runnig");
-        return TRUE;
+        dzlog_error("call verify face start with %s failed: %s", session->face_id, error->message);
+        g_error_free(error);
+        return FALSE;
     }
 
-    g_free(session->username);
-    session->username = g_strdup(arg_username);
+    return TRUE;
+}
 
-    ret = get_user_account_info(service, session);
-    if (!ret)
+/*
+ * 当前模板不匹配或者不属于该用户，继续比对下一个模板
+ */
+static void
+face_verify_continue(KiranAuthService *service,
+                     AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+
+    if (session->face_pending == NULL)
     {
-        g_dbus_method_invocation_return_error(invocation,
-                                              G_DBUS_ERROR,
-                                              G_DBUS_ERROR_INVALID_ARGS,
-                                              "Get user %s accout info failed",
-                                              session->username);
-        return TRUE;
+        //所有模板都不匹配
+        auth_session_emit_auth_messages(service,
+                                        session,
+                                        _("Face not match, try again!"),
+                                        PAM_TEXT_INFO);
     }
 
-    if (arg_type_op == SESSION_AUTH_TYPE_ONE ||
-        arg_type_op == SESSION_AUTH_TYPE_TOGETHER ||
-        arg_type_op == SESSION_AUTH_TYPE_TOGETHER_WITH_USER)
+    if (!face_verify_next(service, session))
+    {
+        //人脸设备出错，继续其它认证方式
+        kiran_auth_fprint_arbiter_release(priv->face_arbiter, session);
+        kiran_auth_race_report(session->race, SESSION_AUTH_METHOD_FACE, FALSE, NULL);
+    }
+}
+
+/*
+ * 比对通过的模板属于owner时认证成功，否则继续比对
+ */
+static void
+face_verify_matched(KiranAuthService *service,
+                    AuthSession *session,
+                    const gchar *owner)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+
+    if (owner && g_strcmp0(owner, session->username) == 0)
+    {
+        //人脸认证成功，设备交给下一个等待的会话
+        kiran_auth_fprint_arbiter_release(priv->face_arbiter, session);
+        kiran_auth_race_report(session->race, SESSION_AUTH_METHOD_FACE, TRUE, session->username);
+        return;
+    }
+
+    dzlog_warn("Face id %s is bound to user %s instead of %s",
+               session->face_id,
+               owner ? owner : "none",
+               session->username);
+    face_verify_continue(service, session);
+}
+
+/*
+ * 反向索引中没有比对通过的模板时，模板可能正在重新绑定或者删除，查询模板当前的用户后再确认
+ */
+typedef struct _FaceLookupData
+{
+    KiranAuthService *service;
+    gchar *sid;
+} FaceLookupData;
+
+static void
+face_lookup_data_free(FaceLookupData *data)
+{
+    g_object_unref(data->service);
+    g_free(data->sid);
+    g_free(data);
+}
+
+static void
+face_lookup_finish(FaceLookupData *data,
+                   const gchar *owner)
+{
+    KiranAuthServicePrivate *priv = data->service->priv;
+    AuthSession *session;
+
+    //查询期间会话可能已经结束或者人脸设备已经被其他会话使用
+    session = kiran_auth_registry_lookup_sid(priv->auth_registry, data->sid);
+    if (session == NULL ||
+        session != kiran_auth_fprint_arbiter_get_owner(priv->face_arbiter) ||
+        session->auth_completed)
+    {
+        dzlog_debug("Session %s finished while looking up face user", data->sid);
+    }
+    else
+    {
+        face_verify_matched(data->service, session, owner);
+    }
+
+    face_lookup_data_free(data);
+}
+
+static void
+face_lookup_load_cb(const gchar *username,
+                    gint auth_modes,
+                    gpointer user_data)
+{
+    face_lookup_finish(user_data, username);
+}
+
+static void
+face_lookup_find_user_cb(GObject *source_object,
+                         GAsyncResult *res,
+                         gpointer user_data)
+{
+    FaceLookupData *data = user_data;
+    GError *error = NULL;
+    gchar *path = NULL;
+
+    kiran_accounts_call_find_user_by_auth_data_finish(KIRAN_ACCOUNTS(source_object),
+                                                      &path,
+                                                      res,
+                                                      &error);
+    if (path == NULL)
+    {
+        dzlog_warn("Find user of face id failed: %s", error ? error->message : "");
+        g_clear_error(&error);
+        face_lookup_finish(data, NULL);
+        return;
+    }
+
+    //加载用户信息的同时补全反向索引
+    kiran_auth_user_cache_load_path(data->service->priv->user_cache, path, face_lookup_load_cb, data);
+    g_free(path);
+}
+
+static void
+face_lookup_owner(KiranAuthService *service,
+                  AuthSession *session)
+{
+    FaceLookupData *data = g_new0(FaceLookupData, 1);
+
+    data->service = g_object_ref(service);
+    data->sid = g_strdup(session->sid);
+    kiran_accounts_call_find_user_by_auth_data(service->priv->accounts,
+                                               ACCOUNTS_AUTH_MODE_FACE,
+                                               session->face_id,
+                                               NULL,
+                                               face_lookup_find_user_cb,
+                                               data);
+}
+
+static void
+verify_face_status_cb(KiranBiometrics *object,
+                      const gchar *arg_result,
+                      gboolean arg_done,
+                      gboolean arg_match,
+                      gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *session = kiran_auth_fprint_arbiter_get_owner(priv->face_arbiter);
+    const KiranAuthUserProfile *profile = NULL;
+
+    //认证结束
+    if (!session || session->auth_completed)
+    {
+        return;
+    }
+
+    dzlog_debug("verify_face_status: %s, %d, %d, %s\n",
+                arg_result,
+                arg_done,
+                arg_match,
+                session->face_id);
+
+    if (!arg_done)
+    {
+        //发送人脸认证提示消息
+        auth_session_emit_auth_messages(service,
+                                        session,
+                                        arg_result,
+                                        PAM_TEXT_INFO);
+        return;
+    }
+
+    if (!arg_match)
+    {
+        face_verify_continue(service, session);
+        return;
+    }
+
+    //通过反向索引确认模板仍然属于该用户，模板在认证期间被重新绑定时不认可
+    if (priv->user_cache == NULL)
+    {
+        //没有缓存时模板集合是开始认证时查询的
+        face_verify_matched(service,
+                            session,
+                            g_hash_table_contains(session->face_ids, session->face_id) ? session->username : NULL);
+        return;
+    }
+
+    profile = kiran_auth_user_cache_lookup_face(priv->user_cache, session->face_id);
+    if (profile == NULL)
+    {
+        //索引失效后还没有重新加载，不能直接认可
+        face_lookup_owner(service, session);
+        return;
+    }
+
+    face_verify_matched(service, session, profile->username);
+}
+
+static AuthSession *
+find_auth_session_by_sender(KiranAuthService *service,
+                            const char *sender)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+
+    return kiran_auth_registry_lookup_sender(priv->auth_registry, sender);
+}
+
+static void
+auth_session_stop(KiranAuthService *service,
+                  AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+
+    dzlog_debug("Session %s stop", session->sid);
+
+    session->auth_completed = TRUE;
+    session->stop_auth = TRUE;
+
+    //取消所有认证方式，停止指纹和人脸认证或者退出等待队列
+    if (session->race)
+    {
+        kiran_auth_race_cancel(session->race);
+    }
+
+    //唤醒认证线程，不等待pam结束，认证线程持有会话的引用
+    auth_session_post_event(session, AUTH_EVENT_CANCEL, NULL);
+
+    //删除该会话
+    kiran_auth_registry_remove(priv->auth_registry, session->sid);
+}
+
+static void
+on_sender_vanished(GDBusConnection *connection,
+                   const gchar *name,
+                   gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    AuthSession *session = NULL;
+
+    session = find_auth_session_by_sender(service, name);
+    if (session)
+    {
+        //dbus连接断开，停止本次认证
+        dzlog_debug("Sender %s vanished, stop session %s", name, session->sid);
+        auth_session_stop(service, session);
+    }
+}
+
+/*
+ * 默认读取器与人脸认证共用生物认证服务的主对象，其它读取器各自创建代理
+ */
+static void
+connect_fprint_readers(KiranAuthService *service,
+                       GDBusConnection *connection)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    GError *error = NULL;
+    guint i;
+
+    for (i = 0; i < priv->fprint_readers->len; i++)
+    {
+        FprintReader *reader = g_ptr_array_index(priv->fprint_readers, i);
+
+        if (g_strcmp0(reader->object_path, BIOMETRICS_OBJECT_PATH) == 0)
+        {
+            reader->proxy = priv->biometrics ? g_object_ref(priv->biometrics) : NULL;
+        }
+        else
+        {
+            reader->proxy = kiran_biometrics_proxy_new_sync(connection,
+                                                            G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                            BIOMETRICS_DBUS_NAME,
+                                                            reader->object_path,
+                                                            NULL,
+                                                            &error);
+            if (reader->proxy == NULL)
+            {
+                dzlog_error("Failed fprint reader %s new: %s", reader->object_path, error->message);
+                g_clear_error(&error);
+            }
+        }
+
+        if (reader->proxy)
+        {
+            g_signal_connect(reader->proxy,
+                             "verify-fprint-status",
+                             G_CALLBACK(verify_fprint_status_cb),
+                             reader);
+        }
+    }
+}
+
+static void
+bus_acquired_cb(GDBusConnection *connection,
+                const char *name,
+                gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    KiranAuthServicePrivate *priv = service->priv;
+    GDBusInterfaceSkeleton *skeleton = G_DBUS_INTERFACE_SKELETON(service);
+    GError *error = NULL;
+
+    priv->connection = connection;
+    g_dbus_interface_skeleton_export(skeleton,
+                                     connection,
+                                     AUTH_SERVICE_OBJECT_PATH,
+                                     &error);
+
+    if (error != NULL)
+    {
+        dzlog_error("Failed export interface: %s", error->message);
+        g_error_free(error);
+    }
+
+    error = NULL;
+    priv->biometrics = kiran_biometrics_proxy_new_sync(connection,
+                                                       G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                       BIOMETRICS_DBUS_NAME,
+                                                       BIOMETRICS_OBJECT_PATH,
+                                                       NULL,
+                                                       &error);
+    if (priv->biometrics)
+    {
+        g_signal_connect(priv->biometrics,
+                         "verify-face-status",
+                         G_CALLBACK(verify_face_status_cb),
+                         service);
+    }
+    else
+    {
+        dzlog_error("Failed biometrics new: %s", error->message);
+        g_error_free(error);
+    }
+
+    connect_fprint_readers(service, connection);
+
+    error = NULL;
+    priv->accounts = kiran_accounts_proxy_new_sync(connection,
+                                                   G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                   ACCOUNTS_DBUS_NAME,
+                                                   ACCOUNTS_OBJECT_PATH,
+                                                   NULL,
+                                                   &error);
+    if (priv->accounts == NULL)
+    {
+        dzlog_error("Error with getting the bus: %s", error->message);
+        g_error_free(error);
+    }
+    else
+    {
+        priv->user_cache = kiran_auth_user_cache_new(connection, G_DBUS_PROXY(priv->accounts));
+        //预先建立指纹模板反向索引，多路并行认证时无需再查询accounts服务
+        kiran_auth_user_cache_warm_up(priv->user_cache);
+    }
+}
+
+static AuthSession *
+find_auth_session_by_sid(KiranAuthService *service,
+                         const char *sid)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+
+    return kiran_auth_registry_lookup_sid(priv->auth_registry, sid);
+}
+
+static gboolean fprint_reader_acquire(FprintReader *reader,
+                                      AuthSession *session);
+
+typedef struct _SeatLookupData
+{
+    KiranAuthService *service;
+    gchar *sid;
+} SeatLookupData;
+
+static void
+auth_session_seat_cb(const gchar *seat,
+                     const gchar *session_class,
+                     gpointer user_data)
+{
+    SeatLookupData *data = user_data;
+    KiranAuthServicePrivate *priv = data->service->priv;
+    FprintReader *reader = NULL;
+    AuthSession *session;
+
+    session = find_auth_session_by_sid(data->service, data->sid);
+    if (session == NULL)
+        goto out;
+
+    if (seat)
+    {
+        reader = g_hash_table_lookup(priv->seat_readers, seat);
+    }
+    if (reader == NULL)
+    {
+        reader = g_ptr_array_index(priv->fprint_readers, 0);
+    }
+
+    dzlog_debug("Session %s is on seat %s, use fprint reader %s",
+                session->sid, seat ? seat : "", reader->object_path);
+    g_atomic_pointer_set(&session->fprint_reader, reader);
+
+    //查询期间已经开始指纹认证，现在申请设备
+    if (g_atomic_int_compare_and_exchange(&session->fprint_deferred, TRUE, FALSE))
+    {
+        if (!fprint_reader_acquire(reader, session))
+        {
+            kiran_auth_race_report(session->race, SESSION_AUTH_METHOD_FINGERPRINT, FALSE, NULL);
+        }
+        else if (!(kiran_auth_race_get_running(session->race) & SESSION_AUTH_METHOD_FINGERPRINT))
+        {
+            //申请期间指纹认证已经被取消
+            kiran_auth_fprint_arbiter_release(reader->arbiter, session);
+        }
+    }
+
+out:
+    g_object_unref(data->service);
+    g_free(data->sid);
+    g_free(data);
+}
+
+/*
+ * 只有一个读取器时直接使用，否则按调用者所在座席选择读取器
+ */
+static void
+auth_session_bind_fprint_reader(KiranAuthService *service,
+                                AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    SeatLookupData *data;
+
+    if (priv->fprint_readers->len == 1 || session->sender == NULL || priv->connection == NULL)
+    {
+        session->fprint_reader = g_ptr_array_index(priv->fprint_readers, 0);
+        return;
+    }
+
+    data = g_new0(SeatLookupData, 1);
+    data->service = g_object_ref(service);
+    data->sid = g_strdup(session->sid);
+    kiran_auth_seat_lookup(priv->connection, session->sender, auth_session_seat_cb, data);
+}
+
+/*
+ * 创建认证会话，并生成应答消息的加密密钥
+ * 失败时已经向调用者返回错误，返回NULL
+ * 成功时encode为base64编码的公钥，由调用者释放
+ */
+static AuthSession *
+create_auth_session(KiranAuthService *service,
+                    GDBusMethodInvocation *invocation,
+                    int transport,
+                    gchar **encode)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *new_auth_session = NULL;
+    AuthSession *session = NULL;
+    gchar *sid = NULL;
+    char *public_key = NULL;
+    char *private_key = NULL;
+    KiranAuthKey *key = NULL;
+    const gchar *sender;
+
+    *encode = NULL;
+    sender = g_dbus_method_invocation_get_sender(invocation);
+
+    session = find_auth_session_by_sender(service, sender);
+    if (session)
+    {
+        //每个连接只允许创建一个认证
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "Have create a auth with connection");
+        return NULL;
+    }
+
+    if (transport != AUTH_TRANSPORT_RSA)
+    {
+        //临时的X25519密钥，生成只需要几十微秒
+        key = kiran_authentication_key_new_x25519(transport);
+        if (key != NULL)
+        {
+            guchar raw_public[X25519_KEY_LEN];
+
+            kiran_authentication_key_get_raw_public(key, raw_public, sizeof(raw_public));
+            *encode = g_base64_encode(raw_public, sizeof(raw_public));
+        }
+        else
+        {
+            dzlog_warn("Transport %d not supported, fallback to rsa", transport);
+        }
+    }
+
+    if (key == NULL)
+    {
+        //从预生成的池中取出通信的公私秘钥，池为空时同步生成
+        kiran_authentication_key_pool_pop(priv->key_pool, &public_key, &private_key);
+        if (private_key != NULL)
+        {
+            key = kiran_authentication_key_new_private(private_key);
+            memset(private_key, 0, strlen(private_key));
+            g_free(private_key);
+        }
+
+        if (public_key != NULL && key != NULL)
+        {
+            *encode = g_base64_encode(public_key,
+                                      strlen(public_key));
+        }
+        g_free(public_key);
+    }
+
+    if (*encode == NULL)
+    {
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "Create ras key failed!");
+        kiran_authentication_key_free(key);
+        return NULL;
+    }
+
+    sid = g_uuid_string_random();
+    session = find_auth_session_by_sid(service, sid);
+    while (session != NULL)
+    {
+        //如果生成sid已经被占用，则重新生成
+        g_free(sid);
+        sid = g_uuid_string_random();
+        session = find_auth_session_by_sid(service, sid);
+    }
+
+    new_auth_session = auth_session_new();
+    new_auth_session->sid = sid;
+    new_auth_session->key = key;
+
+    if (sender)
+        new_auth_session->sender = g_strdup(sender);
+
+    //添加到会话索引表中
+    kiran_auth_registry_insert(priv->auth_registry,
+                               new_auth_session->sid,
+                               new_auth_session->sender,
+                               new_auth_session);
+
+    auth_session_bind_fprint_reader(service, new_auth_session);
+
+    //只监视拥有会话的连接，会话释放时取消监视
+    if (sender)
+    {
+        new_auth_session->sender_watch_id = g_bus_watch_name_on_connection(priv->connection,
+                                                                           sender,
+                                                                           G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                                           NULL,
+                                                                           on_sender_vanished,
+                                                                           service,
+                                                                           NULL);
+    }
+
+    return new_auth_session;
+}
+
+static gboolean
+kiran_auth_service_handle_create_auth(KiranAuthenticationGen *object,
+                                      GDBusMethodInvocation *invocation)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    AuthSession *session = NULL;
+    gchar *encode = NULL;
+
+    dzlog_debug("Handle create auth message");
+
+    session = create_auth_session(service, invocation, AUTH_TRANSPORT_RSA, &encode);
+    if (session == NULL)
+    {
+        return TRUE;
+    }
+
+    kiran_authentication_gen_complete_create_auth(object,
+                                                  invocation,
+                                                  session->sid,
+                                                  encode);
+    g_free(encode);
+
+    return TRUE;
+}
+
+static gboolean
+kiran_auth_service_handle_create_auth_with_transport(KiranAuthenticationGen *object,
+                                                     GDBusMethodInvocation *invocation,
+                                                     gint arg_transport)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    AuthSession *session = NULL;
+    gchar *encode = NULL;
+
+    dzlog_debug("Handle create auth message with transport %d", arg_transport);
+
+    session = create_auth_session(service, invocation, arg_transport, &encode);
+    if (session == NULL)
+    {
+        return TRUE;
+    }
+
+    kiran_authentication_gen_complete_create_auth_with_transport(object,
+                                                                 invocation,
+                                                                 session->sid,
+                                                                 encode,
+                                                                 kiran_authentication_key_get_transport(session->key));
+    g_free(encode);
+
+    return TRUE;
+}
+
+/*
+ * StartAuth的异步处理状态，依次完成以下查询后才应答调用者：
+ * FindUserByName -> 创建用户代理 -> GetAuthItems
+ * 查询期间会话可能被停止，每一步都按sid重新查找会话
+ */
+typedef struct _StartAuthData StartAuthData;
+
+struct _StartAuthData
+{
+    KiranAuthService *service;
+    GDBusMethodInvocation *invocation;
+    gchar *sid;
+    gint type_op;
+    gboolean occupy;
+    KiranAccountsUser *user;
+    gchar *object_path;
+    //开始查询时用户信息缓存的版本号
+    guint cache_generation;
+    //由CreateAndStartAuth创建的会话，应答中返回base64编码的公钥，失败时删除会话
+    gchar *encode;
+};
+
+static void
+start_auth_data_free(StartAuthData *data)
+{
+    g_clear_object(&data->user);
+    g_object_unref(data->service);
+    g_free(data->object_path);
+    g_free(data->sid);
+    g_free(data->encode);
+    g_free(data);
+}
+
+/*
+ * 开始认证失败，CreateAndStartAuth创建的会话调用者拿不到sid，直接删除
+ */
+static void
+start_auth_data_drop_session(StartAuthData *data,
+                             AuthSession *session)
+{
+    if (session == NULL)
+        return;
+
+    session->is_pending = FALSE;
+    if (data->encode)
+    {
+        kiran_auth_registry_remove(data->service->priv->auth_registry, session->sid);
+    }
+}
+
+static void
+start_auth_data_return_error(StartAuthData *data,
+                             AuthSession *session,
+                             const gchar *message)
+{
+    start_auth_data_drop_session(data, session);
+
+    g_dbus_method_invocation_return_error_literal(data->invocation,
+                                                  G_DBUS_ERROR,
+                                                  G_DBUS_ERROR_INVALID_ARGS,
+                                                  message);
+    start_auth_data_free(data);
+}
+
+/*
+ * 获取异步查询对应的会话，会话已经被停止时向调用者返回错误
+ */
+static AuthSession *
+start_auth_data_get_session(StartAuthData *data)
+{
+    AuthSession *session;
+
+    session = find_auth_session_by_sid(data->service, data->sid);
+    if (session == NULL)
+    {
+        dzlog_debug("Session %s stopped while looking up account", data->sid);
+        start_auth_data_return_error(data, NULL, "The auth session was stopped");
+    }
+
+    return session;
+}
+
+/*
+ * 登录界面和锁屏是有人在控制台前等待的交互式认证
+ */
+static gboolean
+auth_session_is_interactive(AuthSession *session)
+{
+    return session->auth_class >= SESSION_AUTH_CLASS_LOCK_SCREEN;
+}
+
+/*
+ * 认证线程队列按调度截止时间排序：入队时间加上按会话类别推迟的时间。
+ * 低优先级会话等待足够久后截止时间会早于新入队的高优先级会话，不会饿死
+ */
+static gint
+auth_session_queue_compare(gconstpointer a,
+                           gconstpointer b,
+                           gpointer user_data)
+{
+    const AuthSession *x = a;
+    const AuthSession *y = b;
+
+    return (x->queue_deadline > y->queue_deadline) - (x->queue_deadline < y->queue_deadline);
+}
+
+static void
+auth_session_set_queue_deadline(KiranAuthService *service,
+                                AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    int auth_class = session->auth_class;
+
+    //未指定类别的会话按授权认证调度
+    if (auth_class == SESSION_AUTH_CLASS_DEFAULT)
+    {
+        auth_class = SESSION_AUTH_CLASS_AUTHORIZATION;
+    }
+
+    session->queue_time = g_get_monotonic_time();
+    session->queue_deadline = session->queue_time +
+                              (gint64)(SESSION_AUTH_CLASS_GREETER - auth_class) *
+                                  MAX(priv->auth_priority_aging, 0) * G_USEC_PER_SEC;
+}
+
+static void
+start_auth_return_busy(StartAuthData *data,
+                       AuthSession *session,
+                       const gchar *reason)
+{
+    KiranAuthServicePrivate *priv = data->service->priv;
+
+    priv->auth_rejected++;
+    dzlog_warn("%s, reject session %s", reason, session->sid);
+    g_dbus_method_invocation_return_dbus_error(data->invocation,
+                                               AUTH_SERVICE_ERROR_BUSY,
+                                               "The authentication service is busy, retry later");
+    start_auth_data_drop_session(data, session);
+    start_auth_data_free(data);
+}
+
+static void
+start_auth_push(StartAuthData *data,
+                AuthSession *session)
+{
+    KiranAuthService *service = data->service;
+    KiranAuthServicePrivate *priv = service->priv;
+
+    session->is_pending = FALSE;
+
+    if (!auth_session_is_interactive(session))
+    {
+        //所有线程都在认证并且排队已满时拒绝，调用者稍后重试，交互式认证不受限制
+        if (priv->auth_queue_limit > 0 &&
+            g_thread_pool_unprocessed(priv->auth_thread_pool) >= (guint)priv->auth_queue_limit)
+        {
+            start_auth_return_busy(data, session, "Auth queue is full");
+            return;
+        }
+
+        //保留的线程只给交互式认证使用，保证控制台登录能及时得到提示
+        if (g_atomic_int_get(&priv->auth_background) >= priv->auth_threads - priv->auth_reserved_threads)
+        {
+            start_auth_return_busy(data, session, "Auth threads for background sessions are exhausted");
+            return;
+        }
+    }
+
+    if (data->type_op == SESSION_AUTH_TYPE_ONE ||
+        data->type_op == SESSION_AUTH_TYPE_TOGETHER ||
+        data->type_op == SESSION_AUTH_TYPE_TOGETHER_WITH_USER)
+    {
+        session->session_auth_type = data->type_op;
+    }
+    else
+    {  //使用默认的认证方式
+        session->session_auth_type = priv->default_session_auth_type;
+    }
+
+    session->occupy = data->occupy;
+    session->stop_auth = FALSE;
+    session->service = service;
+    session->auth_completed = FALSE;
+
+    //开始后即视为已开始，避免重复StartAuth导致会话被多次调度
+    session->is_start = TRUE;
+
+    if (data->encode)
+    {
+        kiran_authentication_gen_complete_create_and_start_auth(KIRAN_AUTHENTICATION_GEN(service),
+                                                                data->invocation,
+                                                                session->sid,
+                                                                data->encode,
+                                                                kiran_authentication_key_get_transport(session->key));
+    }
+    else
+    {
+        kiran_authentication_gen_complete_start_auth(KIRAN_AUTHENTICATION_GEN(service), data->invocation);
+    }
+    start_auth_data_free(data);
+
+    //先应答再开始认证，调用者收到的认证消息都在应答之后
+    auth_session_start_race(service, session);
+}
+
+/*
+ * 用户信息查询完成，放入缓存并加入认证线程队列
+ */
+static void
+start_auth_lookup_done(StartAuthData *data,
+                       AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = data->service->priv;
+
+    if (priv->user_cache && session->fprint_ids)
+    {
+        kiran_auth_user_cache_insert(priv->user_cache,
+                                     session->username,
+                                     data->object_path,
+                                     session->user_auth_mode,
+                                     session->fprint_ids,
+                                     session->face_ids,
+                                     data->cache_generation);
+    }
+
+    start_auth_push(data, session);
+}
+
+/*
+ * 获取GetAuthItems的结果，失败时向调用者返回错误
+ */
+static GHashTable *
+start_auth_get_auth_items_finish(StartAuthData *data,
+                                 GObject *source_object,
+                                 GAsyncResult *res,
+                                 AuthSession **session)
+{
+    GHashTable *ids = NULL;
+    GError *error = NULL;
+    gchar *auth_items = NULL;
+    gboolean ret;
+
+    ret = kiran_accounts_user_call_get_auth_items_finish(KIRAN_ACCOUNTS_USER(source_object),
+                                                         &auth_items,
+                                                         res,
+                                                         &error);
+
+    *session = start_auth_data_get_session(data);
+    if (*session == NULL)
+    {
+        g_clear_error(&error);
+        g_free(auth_items);
+        return NULL;
+    }
+
+    if (!ret || !auth_items)
+    {
+        gchar *message;
+
+        dzlog_error("Error with getting the auth item: %s", error ? error->message : "");
+        g_clear_error(&error);
+        message = g_strdup_printf("Get user %s accout info failed", (*session)->username);
+        start_auth_data_return_error(data, *session, message);
+        g_free(message);
+        *session = NULL;
+        return NULL;
+    }
+
+    ids = kiran_auth_user_cache_parse_auth_items(auth_items);
+    g_free(auth_items);
+
+    return ids;
+}
+
+static void
+start_auth_get_face_items_cb(GObject *source_object,
+                             GAsyncResult *res,
+                             gpointer user_data)
+{
+    StartAuthData *data = user_data;
+    AuthSession *session = NULL;
+    GHashTable *face_ids;
+
+    face_ids = start_auth_get_auth_items_finish(data, source_object, res, &session);
+    if (session == NULL)
+        return;
+
+    if (session->face_ids)
+        g_hash_table_unref(session->face_ids);
+    session->face_ids = face_ids;
+    dzlog_debug("Get face_ids %p with %s", session->face_ids, session->username);
+
+    start_auth_lookup_done(data, session);
+}
+
+static void
+start_auth_get_auth_items_cb(GObject *source_object,
+                             GAsyncResult *res,
+                             gpointer user_data)
+{
+    StartAuthData *data = user_data;
+    AuthSession *session = NULL;
+    GHashTable *fprint_ids;
+
+    fprint_ids = start_auth_get_auth_items_finish(data, source_object, res, &session);
+    if (session == NULL)
+        return;
+
+    if (session->fprint_ids)
+        g_hash_table_unref(session->fprint_ids);
+    session->fprint_ids = fprint_ids;
+    dzlog_debug("Get fprint_ids %p with %s", session->fprint_ids, session->username);
+
+    if (session->face_ids)
+        g_hash_table_unref(session->face_ids);
+    session->face_ids = NULL;
+
+    //开启了人脸认证时再查询人脸模板，用于并行认证
+    if (session->user_auth_mode & ACCOUNTS_AUTH_MODE_FACE)
+    {
+        kiran_accounts_user_call_get_auth_items(data->user,
+                                                ACCOUNTS_AUTH_MODE_FACE,
+                                                NULL,
+                                                start_auth_get_face_items_cb,
+                                                data);
+        return;
+    }
+
+    start_auth_lookup_done(data, session);
+}
+
+static void
+start_auth_user_proxy_cb(GObject *source_object,
+                         GAsyncResult *res,
+                         gpointer user_data)
+{
+    StartAuthData *data = user_data;
+    AuthSession *session = NULL;
+    GError *error = NULL;
+    KiranAccountsUser *user;
+
+    user = kiran_accounts_user_proxy_new_finish(res, &error);
+
+    session = start_auth_data_get_session(data);
+    if (session == NULL)
+    {
+        g_clear_error(&error);
+        g_clear_object(&user);
+        return;
+    }
+
+    if (user == NULL)
+    {
+        gchar *message;
+
+        dzlog_error("Error with getting the bus: %s", error->message);
+        g_error_free(error);
+        message = g_strdup_printf("Get user %s accout info failed", session->username);
+        start_auth_data_return_error(data, session, message);
+        g_free(message);
+        return;
+    }
+
+    data->user = user;
+    session->user_auth_mode = kiran_accounts_user_get_auth_modes(user);
+
+    kiran_accounts_user_call_get_auth_items(user,
+                                            ACCOUNTS_AUTH_MODE_FINGERPRINT,
+                                            NULL,
+                                            start_auth_get_auth_items_cb,
+                                            data);
+}
+
+static void
+start_auth_find_user_cb(GObject *source_object,
+                        GAsyncResult *res,
+                        gpointer user_data)
+{
+    StartAuthData *data = user_data;
+    KiranAuthServicePrivate *priv = data->service->priv;
+    AuthSession *session = NULL;
+    GError *error = NULL;
+    gchar *path = NULL;
+    gboolean ret;
+
+    ret = kiran_accounts_call_find_user_by_name_finish(KIRAN_ACCOUNTS(source_object),
+                                                       &path,
+                                                       res,
+                                                       &error);
+
+    session = start_auth_data_get_session(data);
+    if (session == NULL)
+    {
+        g_clear_error(&error);
+        g_free(path);
+        return;
+    }
+
+    if (!ret)
+    {
+        gchar *message;
+
+        dzlog_error("Error with find the user object path: %s with %s", error->message, session->username);
+        g_error_free(error);
+        message = g_strdup_printf("Get user %s accout info failed", session->username);
+        start_auth_data_return_error(data, session, message);
+        g_free(message);
+        return;
+    }
+
+    data->object_path = path;
+    kiran_accounts_user_proxy_new(priv->connection,
+                                  G_DBUS_PROXY_FLAGS_NONE,
+                                  ACCOUNTS_DBUS_INTERFACE_NAME,
+                                  path,
+                                  NULL,
+                                  start_auth_user_proxy_cb,
+                                  data);
+}
+
+static void start_auth_lookup(StartAuthData *data,
+                              AuthSession *session);
+
+/*
+ * 记录用户名并查询用户信息，完成后将会话加入认证线程队列
+ */
+static void
+start_auth_begin(StartAuthData *data,
+                 AuthSession *session,
+                 const gchar *username)
+{
+    KiranAuthServicePrivate *priv = data->service->priv;
+
+    if (priv->accounts == NULL)
+    {
+        gchar *message = g_strdup_printf("Get user %s accout info failed", username);
+
+        start_auth_data_return_error(data, session, message);
+        g_free(message);
+        return;
+    }
+
+    g_free(session->username);
+    session->username = g_strdup(username);
+    session->user_auth_mode = ACCOUNTS_AUTH_MODE_NONE;
+    session->is_pending = TRUE;
+
+    start_auth_lookup(data, session);
+}
+
+/*
+ * PrepareUser的预取状态，会话开始认证前在后台查询用户信息并放入缓存，
+ * 预取完成前到达的同一用户的StartAuth挂在waiter上，预取结束后继续
+ */
+struct _PrepareUserData
+{
+    KiranAuthService *service;
+    gchar *sid;
+    gchar *username;
+    StartAuthData *waiter;
+};
+
+static void
+prepare_user_data_free(PrepareUserData *data)
+{
+    g_object_unref(data->service);
+    g_free(data->sid);
+    g_free(data->username);
+    g_free(data);
+}
+
+/*
+ * 预取结束，不论成功与否都继续等待的StartAuth，失败时由StartAuth自己查询
+ */
+static void
+prepare_user_finish(PrepareUserData *data)
+{
+    StartAuthData *waiter = data->waiter;
+    AuthSession *session;
+
+    session = find_auth_session_by_sid(data->service, data->sid);
+    if (session && session->prefetch == data)
+    {
+        session->prefetch = NULL;
+    }
+
+    if (waiter)
+    {
+        session = start_auth_data_get_session(waiter);
+        if (session)
+        {
+            start_auth_lookup(waiter, session);
+        }
+    }
+
+    prepare_user_data_free(data);
+}
+
+static void
+prepare_user_load_cb(const gchar *username,
+                     gint auth_modes,
+                     gpointer user_data)
+{
+    PrepareUserData *data = user_data;
+
+    dzlog_debug("Prefetch profile of user %s %s", data->username, username ? "done" : "failed");
+    prepare_user_finish(data);
+}
+
+static void
+prepare_user_find_user_cb(GObject *source_object,
+                          GAsyncResult *res,
+                          gpointer user_data)
+{
+    PrepareUserData *data = user_data;
+    KiranAuthServicePrivate *priv = data->service->priv;
+    GError *error = NULL;
+    gchar *path = NULL;
+
+    kiran_accounts_call_find_user_by_name_finish(KIRAN_ACCOUNTS(source_object),
+                                                 &path,
+                                                 res,
+                                                 &error);
+    if (path == NULL)
+    {
+        dzlog_debug("Prefetch user %s failed: %s", data->username, error ? error->message : "");
+        g_clear_error(&error);
+        prepare_user_finish(data);
+        return;
+    }
+
+    //会话已经停止的提示直接丢弃，不再加载用户信息
+    if (data->waiter == NULL && find_auth_session_by_sid(data->service, data->sid) == NULL)
+    {
+        g_free(path);
+        prepare_user_finish(data);
+        return;
+    }
+
+    kiran_auth_user_cache_load_path(priv->user_cache, path, prepare_user_load_cb, data);
+    g_free(path);
+}
+
+/*
+ * 先查找用户信息缓存，未命中时异步查询accounts服务
+ */
+static void
+start_auth_lookup(StartAuthData *data,
+                  AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = data->service->priv;
+    const KiranAuthUserProfile *profile = NULL;
+
+    if (priv->user_cache)
+    {
+        profile = kiran_auth_user_cache_lookup(priv->user_cache, session->username);
+        data->cache_generation = kiran_auth_user_cache_get_generation(priv->user_cache);
+    }
+
+    if (profile)
+    {
+        //命中缓存，不需要任何dbus调用
+        dzlog_debug("Use cached profile of user %s", session->username);
+        session->user_auth_mode = profile->auth_modes;
+        if (session->fprint_ids)
+            g_hash_table_unref(session->fprint_ids);
+        session->fprint_ids = g_hash_table_ref(profile->fprint_ids);
+        if (session->face_ids)
+            g_hash_table_unref(session->face_ids);
+        session->face_ids = profile->face_ids ? g_hash_table_ref(profile->face_ids) : NULL;
+        start_auth_push(data, session);
+        return;
+    }
+
+    //同一用户正在预取时等待预取结果，避免重复查询
+    if (session->prefetch &&
+        session->prefetch->waiter == NULL &&
+        g_strcmp0(session->prefetch->username, session->username) == 0)
+    {
+        dzlog_debug("Wait for prefetching profile of user %s", session->username);
+        session->prefetch->waiter = data;
+        return;
+    }
+
+    //异步查询用户信息，查询完成后才应答调用者，不阻塞主循环
+    kiran_accounts_call_find_user_by_name(priv->accounts,
+                                          session->username,
+                                          NULL,
+                                          start_auth_find_user_cb,
+                                          data);
+}
+
+static gboolean
+kiran_auth_service_handle_start_auth(KiranAuthenticationGen *object,
+                                     GDBusMethodInvocation *invocation,
+                                     const gchar *arg_username,
+                                     const gchar *arg_sid,
+                                     gint arg_type_op,
+                                     gboolean arg_occupy)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    AuthSession *session = NULL;
+    StartAuthData *data = NULL;
+
+    dzlog_debug("Handle start auth with sid: %s, username: %s", arg_sid, arg_username);
+
+    session = find_auth_session_by_sid(service, arg_sid);
+    if (session == NULL)
+    {
+        //不存在对应的会话
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "The auth session id %s not existed",
+                                              arg_sid);
+        return TRUE;
+    }
+
+    if (session->is_start || session->is_pending)
+    {
+        //该会话正在进行中
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "The auth session already runnig");
+        return TRUE;
+    }
+
+    data = g_new0(StartAuthData, 1);
+    data->service = g_object_ref(service);
+    data->invocation = invocation;
+    data->sid = g_strdup(arg_sid);
+    data->type_op = arg_type_op;
+    data->occupy = arg_occupy;
+    start_auth_begin(data, session, arg_username);
+
+    return TRUE;
+}
+
+static gboolean
+kiran_auth_service_handle_prepare_user(KiranAuthenticationGen *object,
+                                       GDBusMethodInvocation *invocation,
+                                       const gchar *arg_sid,
+                                       const gchar *arg_username)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *session = NULL;
+    PrepareUserData *data = NULL;
+
+    dzlog_debug("Handle prepare user with sid: %s, username: %s", arg_sid, arg_username);
+
+    session = find_auth_session_by_sid(service, arg_sid);
+    if (session == NULL)
+    {
+        //不存在对应的会话
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "The auth session id %s not existed",
+                                              arg_sid);
+        return TRUE;
+    }
+
+    if (session->is_start || session->is_pending)
+    {
+        g_dbus_method_invocation_return_error_literal(invocation,
+                                                      G_DBUS_ERROR,
+                                                      G_DBUS_ERROR_FAILED,
+                                                      "The auth session is already started");
+        return TRUE;
+    }
+
+    //预取只是提示，不需要时直接返回
+    kiran_authentication_gen_complete_prepare_user(object, invocation);
+
+    if (priv->user_cache == NULL ||
+        priv->accounts == NULL ||
+        arg_username[0] == '\0' ||
+        kiran_auth_user_cache_lookup(priv->user_cache, arg_username) != NULL)
+    {
+        return TRUE;
+    }
+
+    if (session->prefetch && g_strcmp0(session->prefetch->username, arg_username) == 0)
+    {
+        return TRUE;
+    }
+
+    //切换用户时之前的预取仍会完成并进入缓存，但不再与会话关联
+    data = g_new0(PrepareUserData, 1);
+    data->service = g_object_ref(service);
+    data->sid = g_strdup(arg_sid);
+    data->username = g_strdup(arg_username);
+    session->prefetch = data;
+
+    kiran_accounts_call_find_user_by_name(priv->accounts,
+                                          arg_username,
+                                          NULL,
+                                          prepare_user_find_user_cb,
+                                          data);
+
+    return TRUE;
+}
+
+/*
+ * 登录界面和锁屏类别不受排队限制并且优先使用指纹设备，需要通过logind确认调用者
+ * 在座席上，登录界面要求greeter会话，锁屏要求用户会话，否则降为授权类别
+ */
+typedef void (*AuthClassCallback)(KiranAuthService *service,
+                                  gint auth_class,
+                                  gpointer user_data);
+
+typedef struct _AuthClassLookupData
+{
+    KiranAuthService *service;
+    gchar *sid;
+    gint auth_class;
+    AuthClassCallback callback;
+    gpointer user_data;
+} AuthClassLookupData;
+
+static void
+auth_class_seat_cb(const gchar *seat,
+                   const gchar *session_class,
+                   gpointer user_data)
+{
+    AuthClassLookupData *data = user_data;
+    gint auth_class = data->auth_class;
+    gboolean allowed = FALSE;
+
+    //登录界面只能在greeter会话中，锁屏在用户会话或者lock-screen会话中，都必须在座席上
+    if (seat != NULL)
+    {
+        if (data->auth_class == SESSION_AUTH_CLASS_GREETER)
+        {
+            allowed = (g_strcmp0(session_class, "greeter") == 0);
+        }
+        else
+        {
+            allowed = (g_strcmp0(session_class, "user") == 0 ||
+                       g_strcmp0(session_class, "lock-screen") == 0);
+        }
+    }
+
+    if (!allowed)
+    {
+        dzlog_warn("Session %s requests class %d from %s session on seat %s, use authorization class",
+                   data->sid,
+                   data->auth_class,
+                   session_class ? session_class : "unknown",
+                   seat ? seat : "none");
+        auth_class = SESSION_AUTH_CLASS_AUTHORIZATION;
+    }
+
+    data->callback(data->service, auth_class, data->user_data);
+
+    g_object_unref(data->service);
+    g_free(data->sid);
+    g_free(data);
+}
+
+static void
+auth_session_verify_class(KiranAuthService *service,
+                          AuthSession *session,
+                          gint auth_class,
+                          AuthClassCallback callback,
+                          gpointer user_data)
+{
+    AuthClassLookupData *data;
+
+    if (auth_class < SESSION_AUTH_CLASS_LOCK_SCREEN)
+    {
+        callback(service, auth_class, user_data);
+        return;
+    }
+
+    data = g_new0(AuthClassLookupData, 1);
+    data->service = g_object_ref(service);
+    data->sid = g_strdup(session->sid);
+    data->auth_class = auth_class;
+    data->callback = callback;
+    data->user_data = user_data;
+    kiran_auth_seat_lookup(service->priv->connection, session->sender, auth_class_seat_cb, data);
+}
+
+/*
+ * CreateAndStartAuth请求的类别确认后再开始认证
+ */
+typedef struct _CreateStartClassData
+{
+    StartAuthData *data;
+    gchar *username;
+} CreateStartClassData;
+
+static void
+create_and_start_class_verified(KiranAuthService *service,
+                                gint auth_class,
+                                gpointer user_data)
+{
+    CreateStartClassData *class_data = user_data;
+    StartAuthData *data = class_data->data;
+    AuthSession *session = find_auth_session_by_sid(service, data->sid);
+
+    if (session == NULL)
+    {
+        //确认期间调用者断开连接，会话已被删除
+        g_dbus_method_invocation_return_error(data->invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_FAILED,
+                                              "The auth session %s is stopped",
+                                              data->sid);
+        start_auth_data_free(data);
+    }
+    else
+    {
+        session->auth_class = auth_class;
+        start_auth_begin(data, session, class_data->username);
+    }
+
+    g_free(class_data->username);
+    g_free(class_data);
+}
+
+static gboolean
+kiran_auth_service_handle_create_and_start_auth(KiranAuthenticationGen *object,
+                                                GDBusMethodInvocation *invocation,
+                                                const gchar *arg_username,
+                                                gint arg_type_op,
+                                                gboolean arg_occupy,
+                                                gint arg_transport,
+                                                GVariant *arg_options)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    AuthSession *session = NULL;
+    StartAuthData *data = NULL;
+    CreateStartClassData *class_data;
+    gint auth_class = SESSION_AUTH_CLASS_DEFAULT;
+    gboolean message_batch = FALSE;
+    gchar *encode = NULL;
+
+    dzlog_debug("Handle create and start auth with username: %s, transport: %d", arg_username, arg_transport);
+
+    //选项与SetAuthClass、SetMessageBatch相同，需要在开始认证前确定
+    g_variant_lookup(arg_options, "auth-class", "i", &auth_class);
+    g_variant_lookup(arg_options, "message-batch", "b", &message_batch);
+    if (auth_class < SESSION_AUTH_CLASS_DEFAULT ||
+        auth_class >= SESSION_AUTH_CLASS_LAST)
+    {
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "Invalid auth class %d",
+                                              auth_class);
+        return TRUE;
+    }
+
+    session = create_auth_session(service, invocation, arg_transport, &encode);
+    if (session == NULL)
+    {
+        return TRUE;
+    }
+    session->message_batch = message_batch;
+
+    data = g_new0(StartAuthData, 1);
+    data->service = g_object_ref(service);
+    data->invocation = invocation;
+    data->sid = g_strdup(session->sid);
+    data->type_op = arg_type_op;
+    data->occupy = arg_occupy;
+    data->encode = encode;
+
+    //确认类别期间不能再次开始认证
+    session->is_pending = TRUE;
+    class_data = g_new0(CreateStartClassData, 1);
+    class_data->data = data;
+    class_data->username = g_strdup(arg_username);
+    auth_session_verify_class(service, session, auth_class, create_and_start_class_verified, class_data);
+
+    return TRUE;
+}
+
+static gboolean
+kiran_auth_service_handle_stop_auth(KiranAuthenticationGen *object,
+                                    GDBusMethodInvocation *invocation,
+                                    const gchar *arg_sid)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *session = NULL;
+
+    dzlog_debug("Handle stop auth with sid: %s", arg_sid);
+
+    session = find_auth_session_by_sid(service, arg_sid);
+    if (session == NULL)
+    {
+        //不存在对应的会话
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "The auth session id %s not existed",
+                                              arg_sid);
+        return TRUE;
+    }
+
+    auth_session_stop(service, session);
+
+    kiran_authentication_gen_complete_stop_auth(object, invocation);
+
+    return TRUE;
+}
+
+static gboolean
+kiran_auth_service_handle_watch_session(KiranAuthenticationGen *object,
+                                        GDBusMethodInvocation *invocation,
+                                        const gchar *arg_sid)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *session = NULL;
+    const gchar *sender;
+    guint i;
+
+    session = find_auth_session_by_sid(service, arg_sid);
+    if (session == NULL)
+    {
+        //不存在对应的会话
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "The auth session id %s not existed",
+                                              arg_sid);
+        return TRUE;
+    }
+
+    sender = g_dbus_method_invocation_get_sender(invocation);
+    if (sender && g_strcmp0(sender, session->sender) != 0)
+    {
+        g_mutex_lock(&priv->watchers_mutex);
+        if (session->watchers == NULL)
+        {
+            session->watchers = g_ptr_array_new_with_free_func(g_free);
+        }
+
+        for (i = 0; i < session->watchers->len; i++)
+        {
+            if (g_strcmp0(g_ptr_array_index(session->watchers, i), sender) == 0)
+                break;
+        }
+
+        if (i == session->watchers->len)
+        {
+            g_ptr_array_add(session->watchers, g_strdup(sender));
+        }
+        g_mutex_unlock(&priv->watchers_mutex);
+    }
+
+    kiran_authentication_gen_complete_watch_session(object, invocation);
+
+    //关注前认证已经结束，结果在应答之后补发，否则关注者会一直等到超时
+    if (sender && g_strcmp0(sender, session->sender) != 0 && session->have_final_status)
+    {
+        g_dbus_connection_emit_signal(priv->connection,
+                                      sender,
+                                      AUTH_SERVICE_OBJECT_PATH,
+                                      kiran_authentication_gen_interface_info()->name,
+                                      "AuthStatus",
+                                      g_variant_new("(sis)",
+                                                    session->final_username ? session->final_username : "",
+                                                    session->final_state,
+                                                    session->sid),
+                                      NULL);
+    }
+
+    return TRUE;
+}
+
+typedef struct _SetAuthClassData
+{
+    GDBusMethodInvocation *invocation;
+    gchar *sid;
+} SetAuthClassData;
+
+static void
+set_auth_class_verified(KiranAuthService *service,
+                        gint auth_class,
+                        gpointer user_data)
+{
+    SetAuthClassData *data = user_data;
+    AuthSession *session = find_auth_session_by_sid(service, data->sid);
+
+    if (session == NULL)
+    {
+        g_dbus_method_invocation_return_error(data->invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "The auth session id %s not existed",
+                                              data->sid);
+    }
+    else if (session->is_start || session->is_pending)
+    {
+        //已经开始的会话不再重新排队
+        g_dbus_method_invocation_return_error_literal(data->invocation,
+                                                      G_DBUS_ERROR,
+                                                      G_DBUS_ERROR_FAILED,
+                                                      "The auth session is already started");
+    }
+    else
+    {
+        session->auth_class = auth_class;
+        kiran_authentication_gen_complete_set_auth_class(KIRAN_AUTHENTICATION_GEN(service), data->invocation);
+    }
+
+    g_free(data->sid);
+    g_free(data);
+}
+
+static gboolean
+kiran_auth_service_handle_set_auth_class(KiranAuthenticationGen *object,
+                                         GDBusMethodInvocation *invocation,
+                                         const gchar *arg_sid,
+                                         gint arg_auth_class)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    AuthSession *session = NULL;
+    SetAuthClassData *data;
+
+    session = find_auth_session_by_sid(service, arg_sid);
+    if (session == NULL)
+    {
+        //不存在对应的会话
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "The auth session id %s not existed",
+                                              arg_sid);
+        return TRUE;
+    }
+
+    if (arg_auth_class < SESSION_AUTH_CLASS_DEFAULT ||
+        arg_auth_class >= SESSION_AUTH_CLASS_LAST)
+    {
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "Invalid auth class %d",
+                                              arg_auth_class);
+        return TRUE;
+    }
+
+    //只有会话的创建者可以设置类别，避免其它连接提高会话的优先级
+    if (g_strcmp0(g_dbus_method_invocation_get_sender(invocation), session->sender) != 0)
+    {
+        g_dbus_method_invocation_return_error_literal(invocation,
+                                                      G_DBUS_ERROR,
+                                                      G_DBUS_ERROR_ACCESS_DENIED,
+                                                      "Only the creator of the auth session can set its class");
+        return TRUE;
+    }
+
+    data = g_new0(SetAuthClassData, 1);
+    data->invocation = invocation;
+    data->sid = g_strdup(arg_sid);
+    auth_session_verify_class(service, session, arg_auth_class, set_auth_class_verified, data);
+
+    return TRUE;
+}
+
+static gboolean
+kiran_auth_service_handle_set_message_batch(KiranAuthenticationGen *object,
+                                            GDBusMethodInvocation *invocation,
+                                            const gchar *arg_sid,
+                                            gboolean arg_enabled)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    AuthSession *session = NULL;
+
+    session = find_auth_session_by_sid(service, arg_sid);
+    if (session == NULL)
+    {
+        //不存在对应的会话
+        g_dbus_method_invocation_return_error(invocation,
+                                              G_DBUS_ERROR,
+                                              G_DBUS_ERROR_INVALID_ARGS,
+                                              "The auth session id %s not existed",
+                                              arg_sid);
+        return TRUE;
+    }
+
+    //认证线程只在开始前读取，避免对话中途切换应答方式
+    if (session->is_start || session->is_pending)
+    {
+        g_dbus_method_invocation_return_error_literal(invocation,
+                                                      G_DBUS_ERROR,
+                                                      G_DBUS_ERROR_FAILED,
+                                                      "The auth session is already started");
+        return TRUE;
+    }
+
+    session->message_batch = arg_enabled;
+    kiran_authentication_gen_complete_set_message_batch(object, invocation);
+
+    return TRUE;
+}
+
+/*
+ * 解码并解密应答消息，返回明文，失败返回NULL
+ * 常见长度的消息在栈上完成解码和解密，X25519方式下更长的消息使用堆内存
+ */
+static gchar *
+decrypt_response_message(AuthSession *session,
+                         const gchar *message)
+{
+    guchar decode_buffer[RESPONSE_BUFFER_LEN];
+    gchar decrypt_buffer[RESPONSE_BUFFER_LEN];
+    guchar *decode_message = decode_buffer;
+    gchar *decrypted = decrypt_buffer;
+    gsize message_len = strlen(message);
+    gsize decode_len = (message_len / 4) * 3 + 3;
+    gsize out_len = 0;
+    gint state = 0;
+    guint save = 0;
+    gchar *result = NULL;
+    int len;
+
+    if (message_len == 0)
+    {
+        return NULL;
+    }
+
+    //解码，base64解码后的长度不超过(message_len / 4) * 3 + 3
+    if (decode_len > sizeof(decode_buffer))
+    {
+        if (kiran_authentication_key_get_transport(session->key) == AUTH_TRANSPORT_RSA)
+        {
+            return NULL;
+        }
+
+        decode_message = g_malloc(decode_len);
+        decrypted = g_malloc(decode_len);
+    }
+
+    out_len = g_base64_decode_step(message, message_len, decode_message, &state, &save);
+
+    //数据解密
+    len = kiran_authentication_key_decrypt(session->key,
+                                           decode_message,
+                                           out_len,
+                                           decrypted,
+                                           MAX(decode_len, sizeof(decrypt_buffer)));
+    if (len >= 0)
+    {
+        result = g_strndup(decrypted, len);
+        memset(decrypted, 0, len);
+    }
+
+    if (decode_message != decode_buffer)
+    {
+        g_free(decode_message);
+        g_free(decrypted);
+    }
+
+    return result;
+}
+
+static gboolean
+kiran_auth_service_handle_response_message(KiranAuthenticationGen *object,
+                                           GDBusMethodInvocation *invocation,
+                                           const gchar *arg_message,
+                                           const gchar *arg_sid)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *session = NULL;
+
+    dzlog_debug("Handle response message  with sid: %s", arg_sid);
+
+    session = find_auth_session_by_sid(service, arg_sid);
+    if (session != NULL)
+    {
+        gchar *decrypted = NULL;
+
+        decrypted = decrypt_response_message(session, arg_message);
+        if (decrypted)
+        {
+            auth_session_post_event(session, AUTH_EVENT_RESPONSE, decrypted);
+        }
+        else
+        {
+            dzlog_error("Decrypted response message failed with sid: %s", arg_sid);
+        }
+    }
+
+    kiran_authentication_gen_complete_response_message(object, invocation);
+
+    return TRUE;
+}
+
+static gboolean
+kiran_auth_service_handle_response_messages(KiranAuthenticationGen *object,
+                                            GDBusMethodInvocation *invocation,
+                                            const gchar *const *arg_messages,
+                                            const gchar *arg_sid)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    AuthSession *session = NULL;
+    gint n_messages = g_strv_length((gchar **)arg_messages);
+    gchar **responses;
+    gint i;
+
+    dzlog_debug("Handle %d response messages with sid: %s", n_messages, arg_sid);
+
+    session = find_auth_session_by_sid(service, arg_sid);
+    if (session != NULL && n_messages > 0)
+    {
+        responses = g_new0(gchar *, n_messages + 1);
+
+        //非提示消息的应答为空字符串
+        for (i = 0; i < n_messages; i++)
+        {
+            responses[i] = arg_messages[i][0] ? decrypt_response_message(session, arg_messages[i]) : g_strdup("");
+            if (responses[i] == NULL)
+            {
+                dzlog_error("Decrypted response message %d failed with sid: %s", i, arg_sid);
+                auth_responses_free(responses, i);
+                responses = NULL;
+                break;
+            }
+        }
+
+        if (responses)
+        {
+            AuthEvent *event = g_new0(AuthEvent, 1);
+
+            event->type = AUTH_EVENT_RESPONSES;
+            event->responses = responses;
+            g_async_queue_push(session->events, event);
+        }
+    }
+
+    kiran_authentication_gen_complete_response_messages(object, invocation);
+
+    return TRUE;
+}
+
+/*
+ * 所有指纹读取器的统计之和，armed表示有读取器正在运行
+ */
+static void
+fprint_readers_get_stats(KiranAuthService *service,
+                         KiranAuthFprintArbiterStats *stats)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    KiranAuthFprintArbiterStats reader_stats;
+    guint i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < priv->fprint_readers->len; i++)
+    {
+        FprintReader *reader = g_ptr_array_index(priv->fprint_readers, i);
+
+        kiran_auth_fprint_arbiter_get_stats(reader->arbiter, &reader_stats);
+        stats->waiting += reader_stats.waiting;
+        stats->grants += reader_stats.grants;
+        stats->preemptions += reader_stats.preemptions;
+        stats->handoffs += reader_stats.handoffs;
+        stats->armed |= reader_stats.armed;
+        stats->arms += reader_stats.arms;
+        stats->lease_reuses += reader_stats.lease_reuses;
+        stats->idle_stops += reader_stats.idle_stops;
+    }
+}
+
+static gboolean
+kiran_auth_service_handle_get_statistics(KiranAuthenticationGen *object,
+                                         GDBusMethodInvocation *invocation)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
+    KiranAuthServicePrivate *priv = service->priv;
+    KiranAuthKeyPoolStats pool_stats;
+    KiranAuthFprintArbiterStats arbiter_stats;
+    GVariantBuilder builder;
+    gint running;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+
+    g_variant_builder_add(&builder, "{sv}", "sessions",
+                          g_variant_new_uint32(kiran_auth_registry_size(priv->auth_registry)));
+    g_variant_builder_add(&builder, "{sv}", "sessions-reaped", g_variant_new_uint64(priv->sessions_reaped));
+
+    kiran_authentication_key_pool_get_stats(priv->key_pool, &pool_stats);
+    g_variant_builder_add(&builder, "{sv}", "key-pool-available", g_variant_new_int32(pool_stats.available));
+    g_variant_builder_add(&builder, "{sv}", "key-pool-generating", g_variant_new_int32(pool_stats.generating));
+    g_variant_builder_add(&builder, "{sv}", "key-pool-generated", g_variant_new_uint64(pool_stats.generated));
+    g_variant_builder_add(&builder, "{sv}", "key-pool-hits", g_variant_new_uint64(pool_stats.hits));
+    g_variant_builder_add(&builder, "{sv}", "key-pool-misses", g_variant_new_uint64(pool_stats.misses));
+    g_variant_builder_add(&builder, "{sv}", "key-pool-refills", g_variant_new_uint64(pool_stats.refills));
+    g_variant_builder_add(&builder, "{sv}", "key-pool-failures", g_variant_new_uint64(pool_stats.failures));
+
+    running = g_atomic_int_get(&priv->auth_running);
+    g_variant_builder_add(&builder, "{sv}", "auth-threads", g_variant_new_int32(priv->auth_threads));
+    g_variant_builder_add(&builder, "{sv}", "auth-threads-running", g_variant_new_int32(running));
+    g_variant_builder_add(&builder, "{sv}", "auth-threads-idle", g_variant_new_int32(MAX(priv->auth_threads - running, 0)));
+    g_variant_builder_add(&builder, "{sv}", "auth-queued", g_variant_new_uint32(g_thread_pool_unprocessed(priv->auth_thread_pool)));
+    g_variant_builder_add(&builder, "{sv}", "auth-queue-limit", g_variant_new_int32(priv->auth_queue_limit));
+    g_variant_builder_add(&builder, "{sv}", "auth-rejected", g_variant_new_uint64(priv->auth_rejected));
+    g_variant_builder_add(&builder, "{sv}", "auth-background", g_variant_new_int32(g_atomic_int_get(&priv->auth_background)));
+
+    g_variant_builder_add(&builder, "{sv}", "auth-methods", g_variant_new_int32(kiran_auth_modules_get_methods(priv->auth_modules)));
+    g_variant_builder_add(&builder, "{sv}", "auth-modules-loaded", g_variant_new_uint32(kiran_auth_modules_get_loaded(priv->auth_modules)));
+
+    fprint_readers_get_stats(service, &arbiter_stats);
+    g_variant_builder_add(&builder, "{sv}", "fprint-readers", g_variant_new_uint32(priv->fprint_readers->len));
+    g_variant_builder_add(&builder, "{sv}", "fprint-waiting", g_variant_new_uint32(arbiter_stats.waiting));
+    g_variant_builder_add(&builder, "{sv}", "fprint-grants", g_variant_new_uint64(arbiter_stats.grants));
+    g_variant_builder_add(&builder, "{sv}", "fprint-preemptions", g_variant_new_uint64(arbiter_stats.preemptions));
+    g_variant_builder_add(&builder, "{sv}", "fprint-handoffs", g_variant_new_uint64(arbiter_stats.handoffs));
+    g_variant_builder_add(&builder, "{sv}", "fprint-armed", g_variant_new_boolean(arbiter_stats.armed));
+    g_variant_builder_add(&builder, "{sv}", "fprint-device-starts", g_variant_new_uint64(arbiter_stats.arms));
+    g_variant_builder_add(&builder, "{sv}", "fprint-lease-reuses", g_variant_new_uint64(arbiter_stats.lease_reuses));
+    g_variant_builder_add(&builder, "{sv}", "fprint-idle-stops", g_variant_new_uint64(arbiter_stats.idle_stops));
+
+    kiran_auth_fprint_arbiter_get_stats(priv->face_arbiter, &arbiter_stats);
+    g_variant_builder_add(&builder, "{sv}", "face-waiting", g_variant_new_uint32(arbiter_stats.waiting));
+    g_variant_builder_add(&builder, "{sv}", "face-grants", g_variant_new_uint64(arbiter_stats.grants));
+    g_variant_builder_add(&builder, "{sv}", "face-preemptions", g_variant_new_uint64(arbiter_stats.preemptions));
+    g_variant_builder_add(&builder, "{sv}", "face-handoffs", g_variant_new_uint64(arbiter_stats.handoffs));
+
+    if (priv->pam_pool)
+    {
+        KiranAuthPamPoolStats pam_stats;
+
+        kiran_auth_pam_pool_get_stats(priv->pam_pool, &pam_stats);
+        g_variant_builder_add(&builder, "{sv}", "pam-standby-available", g_variant_new_uint32(pam_stats.available));
+        g_variant_builder_add(&builder, "{sv}", "pam-standby-hits", g_variant_new_uint64(pam_stats.hits));
+        g_variant_builder_add(&builder, "{sv}", "pam-standby-misses", g_variant_new_uint64(pam_stats.misses));
+        g_variant_builder_add(&builder, "{sv}", "pam-standby-failures", g_variant_new_uint64(pam_stats.failures));
+    }
+
+    if (priv->pam_helper_pool)
+    {
+        KiranAuthPamHelperStats helper_stats;
+
+        kiran_auth_pam_helper_pool_get_stats(priv->pam_helper_pool, &helper_stats);
+        g_variant_builder_add(&builder, "{sv}", "pam-helpers-idle", g_variant_new_uint32(helper_stats.idle));
+        g_variant_builder_add(&builder, "{sv}", "pam-helpers-busy", g_variant_new_uint32(helper_stats.busy));
+        g_variant_builder_add(&builder, "{sv}", "pam-helpers-spawned", g_variant_new_uint64(helper_stats.spawned));
+        g_variant_builder_add(&builder, "{sv}", "pam-helpers-retired", g_variant_new_uint64(helper_stats.retired));
+        g_variant_builder_add(&builder, "{sv}", "pam-helpers-failures", g_variant_new_uint64(helper_stats.failures));
+    }
+
+    if (priv->user_cache)
+    {
+        KiranAuthUserCacheStats cache_stats;
+
+        kiran_auth_user_cache_get_stats(priv->user_cache, &cache_stats);
+        g_variant_builder_add(&builder, "{sv}", "user-cache-size", g_variant_new_uint32(cache_stats.size));
+        g_variant_builder_add(&builder, "{sv}", "user-cache-hits", g_variant_new_uint64(cache_stats.hits));
+        g_variant_builder_add(&builder, "{sv}", "user-cache-misses", g_variant_new_uint64(cache_stats.misses));
+        g_variant_builder_add(&builder, "{sv}", "user-cache-invalidations", g_variant_new_uint64(cache_stats.invalidations));
+        g_variant_builder_add(&builder, "{sv}", "fprint-index-size", g_variant_new_uint32(cache_stats.fprint_size));
+        g_variant_builder_add(&builder, "{sv}", "fprint-index-hits", g_variant_new_uint64(cache_stats.fprint_hits));
+        g_variant_builder_add(&builder, "{sv}", "fprint-index-misses", g_variant_new_uint64(cache_stats.fprint_misses));
+        g_variant_builder_add(&builder, "{sv}", "face-index-size", g_variant_new_uint32(cache_stats.face_size));
+        g_variant_builder_add(&builder, "{sv}", "face-index-hits", g_variant_new_uint64(cache_stats.face_hits));
+        g_variant_builder_add(&builder, "{sv}", "face-index-misses", g_variant_new_uint64(cache_stats.face_misses));
+    }
+
+    kiran_authentication_gen_complete_get_statistics(object,
+                                                     invocation,
+                                                     g_variant_builder_end(&builder));
+
+    return TRUE;
+}
+
+static void
+kiran_authentication_gen_init(KiranAuthenticationGenIface *iface)
+{
+    iface->handle_create_auth = kiran_auth_service_handle_create_auth;
+    iface->handle_create_auth_with_transport = kiran_auth_service_handle_create_auth_with_transport;
+    iface->handle_start_auth = kiran_auth_service_handle_start_auth;
+    iface->handle_create_and_start_auth = kiran_auth_service_handle_create_and_start_auth;
+    iface->handle_prepare_user = kiran_auth_service_handle_prepare_user;
+    iface->handle_stop_auth = kiran_auth_service_handle_stop_auth;
+    iface->handle_set_auth_class = kiran_auth_service_handle_set_auth_class;
+    iface->handle_watch_session = kiran_auth_service_handle_watch_session;
+    iface->handle_set_message_batch = kiran_auth_service_handle_set_message_batch;
+    iface->handle_response_message = kiran_auth_service_handle_response_message;
+    iface->handle_response_messages = kiran_auth_service_handle_response_messages;
+    iface->handle_get_statistics = kiran_auth_service_handle_get_statistics;
+}
+
+/*
+ * 等待用户对提示的应答，会话停止或者超时时返回NULL
+ *
+ * @param[in] types AUTH_EVENT_RESPONSE和AUTH_EVENT_RESPONSES的组合
+ */
+static AuthEvent *
+auth_session_wait_response(AuthSession *session,
+                           guint types)
+{
+    AuthEvent *event;
+
+    event = auth_session_wait_event(session,
+                                    types,
+                                    auth_session_wait_timeout(session));
+    if (event == NULL)
+    {
+        //超时后pam对话失败，认证线程发送认证失败的状态并结束
+        dzlog_info("Session %s conversation timeout", session->sid);
+        auth_session_emit_auth_messages(session->service,
+                                        session,
+                                        _("Authentication timed out!"),
+                                        PAM_ERROR_MSG);
+        return NULL;
+    }
+
+    if (event->type == AUTH_EVENT_CANCEL)
+    {
+        dzlog_debug("Session %s conversation cancelled", session->sid);
+        auth_event_free(event);
+        return NULL;
+    }
+
+    return event;
+}
+
+static gboolean
+auth_message_is_prompt(int msg_style)
+{
+    return msg_style == PAM_PROMPT_ECHO_ON || msg_style == PAM_PROMPT_ECHO_OFF;
+}
+
+/*
+ * 进行一次对话，发送所有消息并等待提示的应答，
+ * 成功时responses中提示消息对应的位置为应答明文，其余为NULL
+ */
+static gboolean
+auth_session_converse(AuthSession *session,
+                      gint n_messages,
+                      const struct pam_message **msg,
+                      gchar **responses)
+{
+    KiranAuthService *service = session->service;
+    AuthEvent *event;
+    gint n_prompts = 0;
+    gint i;
+
+    if (!session->message_batch)
+    {
+        //逐条发送，每个提示等待一次ResponseMessage
+        for (i = 0; i < n_messages; i++)
+        {
+            auth_session_emit_auth_messages(service,
+                                            session,
+                                            msg[i]->msg,
+                                            msg[i]->msg_style);
+
+            if (!auth_message_is_prompt(msg[i]->msg_style))
+                continue;
+
+            event = auth_session_wait_response(session, AUTH_EVENT_RESPONSE);
+            if (event == NULL)
+                return FALSE;
+
+            responses[i] = event->data;
+            event->data = NULL;
+            auth_event_free(event);
+        }
+
+        return TRUE;
+    }
+
+    for (i = 0; i < n_messages; i++)
+    {
+        n_prompts += auth_message_is_prompt(msg[i]->msg_style);
+    }
+
+    auth_session_emit_auth_message_batch(service, session, n_messages, msg);
+    if (n_prompts == 0)
+        return TRUE;
+
+    event = auth_session_wait_response(session, AUTH_EVENT_RESPONSE | AUTH_EVENT_RESPONSES);
+    if (event == NULL)
+        return FALSE;
+
+    //只有一个提示时也接受ResponseMessage
+    if (event->type == AUTH_EVENT_RESPONSE && n_prompts == 1)
+    {
+        for (i = 0; i < n_messages; i++)
+        {
+            if (auth_message_is_prompt(msg[i]->msg_style))
+            {
+                responses[i] = event->data;
+                event->data = NULL;
+            }
+        }
+    }
+    else if (event->type == AUTH_EVENT_RESPONSES &&
+             g_strv_length(event->responses) == (guint)n_messages)
+    {
+        for (i = 0; i < n_messages; i++)
+        {
+            if (auth_message_is_prompt(msg[i]->msg_style))
+            {
+                responses[i] = g_strdup(event->responses[i]);
+            }
+        }
+    }
+    else
+    {
+        dzlog_error("Session %s responses do not match %d messages", session->sid, n_messages);
+        auth_event_free(event);
+        return FALSE;
+    }
+    auth_event_free(event);
+
+    return TRUE;
+}
+
+static int
+pam_conv_cb(int msg_length,
+            const struct pam_message **msg,
+            struct pam_response **resp,
+            void *app_data)
+{
+    AuthSession *session = app_data;
+    struct pam_response *response;
+    gchar **responses;
+    int i;
+
+    if (session->stop_auth || msg_length <= 0)
+        return PAM_CONV_ERR;
+
+    //会话停止或者超时时结束对话
+    responses = g_new0(gchar *, msg_length);
+    if (!auth_session_converse(session, msg_length, msg, responses))
+    {
+        auth_responses_free(responses, msg_length);
+        return PAM_CONV_ERR;
+    }
+
+    //pam使用free释放应答
+    response = calloc(msg_length, sizeof(struct pam_response));
+    for (i = 0; i < msg_length; i++)
+    {
+        if (responses[i])
+        {
+            response[i].resp = strdup(responses[i]);
+            response[i].resp_retcode = 0;
+        }
+    }
+    auth_responses_free(responses, msg_length);
+
+    *resp = response;
+
+    return PAM_SUCCESS;
+}
+
+/*
+ * 等待辅助进程的报文，会话停止超过一定时间或者对话超时时返回FALSE
+ */
+static gboolean
+pam_helper_wait_readable(AuthSession *session,
+                         int fd)
+{
+    gint64 deadline = g_get_monotonic_time() + auth_session_wait_timeout(session);
+    gint64 stop_deadline = 0;
+
+    while (TRUE)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        gint64 now;
+        int ret;
+
+        ret = poll(&pfd, 1, PAM_HELPER_POLL_INTERVAL);
+        if (ret > 0)
+            return TRUE;
+
+        if (ret < 0 && errno != EINTR)
+            return FALSE;
+
+        now = g_get_monotonic_time();
+        if (session->stop_auth)
+        {
+            if (stop_deadline == 0)
+                stop_deadline = now + PAM_HELPER_STOP_GRACE * G_USEC_PER_SEC;
+            if (now >= stop_deadline)
+                return FALSE;
+        }
+
+        if (now >= deadline)
+            return FALSE;
+    }
+}
+
+static void
+pam_message_free(gpointer data)
+{
+    struct pam_message *m = data;
+
+    g_free((gchar *)m->msg);
+    g_free(m);
+}
+
+/*
+ * 将辅助进程的一次对话转发给客户端，并按顺序回送提示的应答
+ */
+static gboolean
+pam_helper_relay_conversation(AuthSession *session,
+                              int fd,
+                              GPtrArray *messages)
+{
+    const struct pam_message **msg = (const struct pam_message **)messages->pdata;
+    gchar **responses = g_new0(gchar *, messages->len);
+    gboolean sent = TRUE;
+    guint i;
+
+    if (!auth_session_converse(session, messages->len, msg, responses))
+    {
+        //取消时辅助进程结束对话，仍然会返回认证结果
+        sent = kiran_auth_pam_proto_send(fd, KIRAN_AUTH_PAM_PROTO_RESPONSE, -1, NULL, 0);
+    }
+    else
+    {
+        for (i = 0; sent && i < messages->len; i++)
+        {
+            if (!auth_message_is_prompt(msg[i]->msg_style))
+                continue;
+
+            sent = kiran_auth_pam_proto_send(fd,
+                                             KIRAN_AUTH_PAM_PROTO_RESPONSE,
+                                             0,
+                                             responses[i],
+                                             strlen(responses[i]));
+        }
+    }
+    auth_responses_free(responses, messages->len);
+
+    return sent;
+}
+
+/*
+ * 在pam辅助进程中执行认证，认证线程只负责转发对话
+ */
+static void
+do_session_passwd_auth_in_helper(KiranAuthService *service,
+                                 AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    gchar payload[KIRAN_AUTH_PAM_PROTO_MAX_PAYLOAD + 1];
+    KiranAuthPamProtoHeader header;
+    KiranAuthPamHelper *helper;
+    GPtrArray *messages;
+    GString *start;
+    gchar *user = NULL;
+    gboolean finished = FALSE;
+    int state = SESSION_AUTH_FAIL;
+    int fd;
+
+    helper = kiran_auth_pam_helper_pool_acquire(priv->pam_helper_pool);
+    if (helper == NULL)
+    {
+        dzlog_error("Session %s has no available pam helper", session->sid);
+        kiran_auth_race_report(session->race, SESSION_AUTH_METHOD_PASSWORD, FALSE, NULL);
+        return;
+    }
+    fd = kiran_auth_pam_helper_get_fd(helper);
+    messages = g_ptr_array_new_with_free_func(pam_message_free);
+
+    //负载为"服务名\0用户名"
+    start = g_string_new(SERVICE);
+    g_string_append_c(start, '\0');
+    g_string_append(start, session->username ? session->username : "");
+    if (!kiran_auth_pam_proto_send(fd, KIRAN_AUTH_PAM_PROTO_START, 0, start->str, start->len))
+    {
+        dzlog_error("Session %s failed to start pam helper", session->sid);
+    }
+    else
+    {
+        while (pam_helper_wait_readable(session, fd) &&
+               kiran_auth_pam_proto_recv(fd, &header, payload, NULL))
+        {
+            if (header.type == KIRAN_AUTH_PAM_PROTO_RESULT)
+            {
+                if (header.arg == PAM_SUCCESS)
+                {
+                    state = SESSION_AUTH_SUCCESS;
+                }
+                else
+                {
+                    dzlog_error("Failed to PAM authenticate: %s", pam_strerror(NULL, header.arg));
+                }
+                user = g_strdup(payload);
+                finished = TRUE;
+                break;
+            }
+
+            if (header.type == KIRAN_AUTH_PAM_PROTO_PROMPT)
+            {
+                struct pam_message *m = g_new0(struct pam_message, 1);
+
+                //收集到PROMPT_END后一起转发
+                m->msg_style = header.arg;
+                m->msg = g_strdup(payload);
+                g_ptr_array_add(messages, m);
+            }
+            else if (header.type == KIRAN_AUTH_PAM_PROTO_PROMPT_END)
+            {
+                gboolean sent = messages->len > 0 ? pam_helper_relay_conversation(session, fd, messages) : TRUE;
+
+                g_ptr_array_set_size(messages, 0);
+                if (!sent)
+                    break;
+            }
+        }
+    }
+    g_string_free(start, TRUE);
+    g_ptr_array_unref(messages);
+
+    if (!finished)
+    {
+        dzlog_warn("Session %s pam helper did not finish, kill it", session->sid);
+    }
+    kiran_auth_pam_helper_pool_release(priv->pam_helper_pool, helper, finished);
+
+    //认证结果由调度统一发送
+    kiran_auth_race_report(session->race,
+                           SESSION_AUTH_METHOD_PASSWORD,
+                           state == SESSION_AUTH_SUCCESS,
+                           user && user[0] ? user : session->username);
+    g_free(user);
+}
+
+static void
+do_session_passwd_auth(KiranAuthService *service,
+                       AuthSession *session)
+{
+    struct pam_conv conversation = {pam_conv_cb, session};
+    int ret, state;
+    const void *user;
+
+    if (service->priv->pam_helper_pool)
+    {
+        do_session_passwd_auth_in_helper(service, session);
+        return;
+    }
+
+    if (service->priv->pam_pool)
+    {
+        ret = kiran_auth_pam_pool_acquire(service->priv->pam_pool,
+                                          session->username,
+                                          &conversation,
+                                          &session->pam_handle);
+    }
+    else
+    {
+        ret = pam_start(SERVICE, session->username, &conversation, &session->pam_handle);
+    }
+
+    if (ret != PAM_SUCCESS)
+    {
+        dzlog_error("Failed to start PAM: %s", pam_strerror(NULL, ret));
+        kiran_auth_race_report(session->race, SESSION_AUTH_METHOD_PASSWORD, FALSE, NULL);
+        return;
+    }
+
+    ret = pam_authenticate(session->pam_handle, 0);
+    if (ret != PAM_SUCCESS)
+    {
+        //认证失败
+        state = SESSION_AUTH_FAIL;
+        dzlog_error("Failed to PAM authenticate: %s", pam_strerror(NULL, ret));
+    }
+    else
+    {
+        //认证成功
+        state = SESSION_AUTH_SUCCESS;
+    }
+
+    //认证结果由调度统一发送
+    pam_get_item(session->pam_handle, PAM_USER, &user);
+    kiran_auth_race_report(session->race,
+                           SESSION_AUTH_METHOD_PASSWORD,
+                           state == SESSION_AUTH_SUCCESS,
+                           user);
+
+    pam_end(session->pam_handle, 0);
+    session->pam_handle = NULL;
+}
+
+/*
+ * 会话使用指纹和人脸设备的优先级
+ */
+static gint
+auth_session_device_priority(AuthSession *session)
+{
+    //未指定类别的会话按授权认证排队
+    if (session->auth_class == SESSION_AUTH_CLASS_DEFAULT)
+    {
+        return SESSION_AUTH_CLASS_AUTHORIZATION;
+    }
+
+    return session->auth_class;
+}
+
+static gboolean
+fprint_reader_acquire(FprintReader *reader,
+                      AuthSession *session)
+{
+    KiranAuthFprintAcquireResult result;
+
+    result = kiran_auth_fprint_arbiter_acquire(reader->arbiter,
+                                               session,
+                                               auth_session_device_priority(session),
+                                               session->occupy);
+
+    return result != KIRAN_AUTH_FPRINT_FAILED;
+}
+
+static gboolean
+do_session_fingerprint_auth(KiranAuthService *service,
+                            AuthSession *session)
+{
+    FprintReader *reader = g_atomic_pointer_get(&session->fprint_reader);
+
+    if (reader == NULL)
+    {
+        g_atomic_int_set(&session->fprint_deferred, TRUE);
+
+        //设置标记期间座席查询可能已经结束
+        reader = g_atomic_pointer_get(&session->fprint_reader);
+        if (reader == NULL ||
+            !g_atomic_int_compare_and_exchange(&session->fprint_deferred, TRUE, FALSE))
+        {
+            return TRUE;
+        }
+    }
+
+    return fprint_reader_acquire(reader, session);
+}
+
+/*
+ * 人脸比对需要给定模板，只有已知用户开启了人脸认证并绑定了模板时才能进行
+ */
+static gboolean
+auth_session_can_face_auth(KiranAuthService *service,
+                           AuthSession *session)
+{
+    return service->priv->support_face &&
+           (session->user_auth_mode & ACCOUNTS_AUTH_MODE_FACE) &&
+           session->face_ids != NULL &&
+           g_hash_table_size(session->face_ids) > 0;
+}
+
+static gboolean
+do_session_face_auth(KiranAuthService *service,
+                     AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    KiranAuthFprintAcquireResult result;
+
+    result = kiran_auth_fprint_arbiter_acquire(priv->face_arbiter,
+                                               session,
+                                               auth_session_device_priority(session),
+                                               session->occupy);
+
+    return result != KIRAN_AUTH_FPRINT_FAILED;
+}
+
+/*
+ * 认证线程只执行pam认证，指纹和人脸认证在主循环中进行，不占用线程
+ */
+static void
+do_authentication(gpointer data,
+                  gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *session = data;
+
+    g_atomic_int_inc(&priv->auth_running);
+
+    dzlog_debug("Start password authentication with sid: %s, username:%s, class:%d, queued:%" G_GINT64_FORMAT "ms",
+                session->sid, session->username, session->auth_class,
+                (g_get_monotonic_time() - session->queue_time) / 1000);
+
+    //排队期间其它认证方式已经成功或者会话已经停止
+    if (!session->stop_auth)
+    {
+        do_session_passwd_auth(service, session);
+    }
+
+    if (session->background_job)
+    {
+        session->background_job = FALSE;
+        g_atomic_int_add(&priv->auth_background, -1);
+    }
+    auth_session_unref(session);
+    g_atomic_int_add(&priv->auth_running, -1);
+}
+
+static gboolean
+password_backend_start(gpointer data,
+                       gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    KiranAuthServicePrivate *priv = service->priv;
+    AuthSession *session = data;
+    GError *error = NULL;
+
+    auth_session_set_queue_deadline(service, session);
+
+    //只有占用认证线程的非交互式认证计入后台认证数，指纹和人脸认证不占用线程
+    session->background_job = !auth_session_is_interactive(session);
+    if (session->background_job)
+    {
+        g_atomic_int_inc(&priv->auth_background);
+    }
+
+    //认证线程持有一个引用，在do_authentication结束时释放
+    if (!g_thread_pool_push(priv->auth_thread_pool,
+                            auth_session_ref(session),
+                            &error))
+    {
+        dzlog_error("Push to auth thread pool failed: %s", error->message);
+        g_error_free(error);
+        if (session->background_job)
+        {
+            session->background_job = FALSE;
+            g_atomic_int_add(&priv->auth_background, -1);
+        }
+        auth_session_unref(session);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+password_backend_cancel(gpointer data,
+                        gpointer user_data)
+{
+    //唤醒等待应答的pam对话，还在排队的会话出队后直接结束
+    auth_session_cancel(data, NULL);
+}
+
+/*
+ * 并行认证时只要设备支持即可，指定用户的认证只使用该用户开启的指纹认证
+ */
+static gboolean
+fprint_backend_available(gpointer data,
+                         gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    AuthSession *session = data;
+
+    if (session->session_auth_type == SESSION_AUTH_TYPE_TOGETHER)
+    {
+        return service->priv->support_finger;
+    }
+
+    return (session->user_auth_mode & ACCOUNTS_AUTH_MODE_FINGERPRINT) != 0;
+}
+
+static gboolean
+fprint_backend_start(gpointer data,
+                     gpointer user_data)
+{
+    return do_session_fingerprint_auth(KIRAN_AUTH_SERVICE(user_data), data);
+}
+
+static void
+fprint_backend_cancel(gpointer data,
+                      gpointer user_data)
+{
+    AuthSession *session = data;
+    FprintReader *reader;
+
+    g_atomic_int_set(&session->fprint_deferred, FALSE);
+    reader = g_atomic_pointer_get(&session->fprint_reader);
+    if (reader)
+    {
+        kiran_auth_fprint_arbiter_release(reader->arbiter, session);
+    }
+}
+
+static gboolean
+face_backend_available(gpointer data,
+                       gpointer user_data)
+{
+    return auth_session_can_face_auth(KIRAN_AUTH_SERVICE(user_data), data);
+}
+
+static gboolean
+face_backend_start(gpointer data,
+                   gpointer user_data)
+{
+    return do_session_face_auth(KIRAN_AUTH_SERVICE(user_data), data);
+}
+
+static void
+face_backend_cancel(gpointer data,
+                    gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+
+    kiran_auth_fprint_arbiter_release(service->priv->face_arbiter, data);
+}
+
+/*
+ * 内置模块，模块数据为服务对象。指纹和人脸通过生物认证服务进行，
+ * 模块目录中提供相同认证方式的模块会替换它们
+ */
+static const KiranAuthBackendModule builtin_modules[] = {
+    {KIRAN_AUTH_BACKEND_ABI_VERSION,
+     "pam",
+     SESSION_AUTH_METHOD_PASSWORD,
+     NULL,
+     NULL,
+     NULL,
+     password_backend_start,
+     password_backend_cancel},
+    {KIRAN_AUTH_BACKEND_ABI_VERSION,
+     "biometrics-fingerprint",
+     SESSION_AUTH_METHOD_FINGERPRINT,
+     NULL,
+     NULL,
+     fprint_backend_available,
+     fprint_backend_start,
+     fprint_backend_cancel},
+    {KIRAN_AUTH_BACKEND_ABI_VERSION,
+     "biometrics-face",
+     SESSION_AUTH_METHOD_FACE,
+     NULL,
+     NULL,
+     face_backend_available,
+     face_backend_start,
+     face_backend_cancel},
+};
+
+static void
+backend_host_report(gpointer handle,
+                    gint method,
+                    gboolean success,
+                    const gchar *username)
+{
+    AuthSession *session = handle;
+
+    kiran_auth_race_report(session->race, method, success, username);
+}
+
+static void
+backend_host_message(gpointer handle,
+                     const gchar *message,
+                     gint type)
+{
+    AuthSession *session = handle;
+
+    auth_session_emit_auth_messages(session->service, session, message, type);
+}
+
+static const gchar *
+backend_host_get_sid(gpointer handle)
+{
+    return ((AuthSession *)handle)->sid;
+}
+
+static const gchar *
+backend_host_get_username(gpointer handle)
+{
+    return ((AuthSession *)handle)->username;
+}
+
+static const KiranAuthBackendHost backend_host = {
+    KIRAN_AUTH_BACKEND_ABI_VERSION,
+    backend_host_report,
+    backend_host_message,
+    backend_host_get_sid,
+    backend_host_get_username,
+};
+
+/*
+ * 注册内置模块并加载模块目录中的模块，再为每个模块生成调度后端
+ */
+static void
+init_auth_modules(KiranAuthService *service)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+#ifdef AUTH_ENABLE_TEST_MODULES
+    const gchar *test_module_dir;
+#endif
+    gint methods;
+    gint method;
+    guint i;
+
+    priv->auth_modules = kiran_auth_modules_new(&backend_host);
+    for (i = 0; i < G_N_ELEMENTS(builtin_modules); i++)
+    {
+        kiran_auth_modules_add(priv->auth_modules, &builtin_modules[i], service);
+    }
+
+    if (priv->enable_auth_modules)
+    {
+        kiran_auth_modules_load_dir(priv->auth_modules, AUTH_MODULE_DIR);
+    }
+
+#ifdef AUTH_ENABLE_TEST_MODULES
+    //测试用的模块不安装到模块目录，只在测试构建中显式指定目录加载，正式构建不从环境变量加载模块
+    test_module_dir = g_getenv(AUTH_TEST_MODULE_DIR_ENV);
+    if (test_module_dir && test_module_dir[0])
+    {
+        dzlog_warn("Load auth modules for tests from %s", test_module_dir);
+        kiran_auth_modules_load_dir(priv->auth_modules, test_module_dir);
+    }
+#endif
+
+    priv->auth_backends = g_array_new(FALSE, TRUE, sizeof(KiranAuthRaceBackend));
+    methods = kiran_auth_modules_get_methods(priv->auth_modules);
+    for (method = 1; method > 0 && method <= methods; method <<= 1)
+    {
+        KiranAuthRaceBackend backend = {method};
+        const KiranAuthBackendModule *module;
+
+        module = kiran_auth_modules_lookup(priv->auth_modules, method, &backend.user_data);
+        if (module == NULL)
+            continue;
+
+        backend.start = module->start;
+        backend.cancel = module->cancel;
+        g_array_append_val(priv->auth_backends, backend);
+    }
+}
+
+/*
+ * 可以为会话进行的认证方式
+ */
+static gint
+auth_session_available_methods(KiranAuthService *service,
+                               AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    gint methods = 0;
+    guint i;
+
+    for (i = 0; i < priv->auth_backends->len; i++)
+    {
+        KiranAuthRaceBackend *backend = &g_array_index(priv->auth_backends, KiranAuthRaceBackend, i);
+        const KiranAuthBackendModule *module;
+
+        module = kiran_auth_modules_lookup(priv->auth_modules, backend->method, NULL);
+        if (module->available == NULL || module->available(session, backend->user_data))
+        {
+            methods |= backend->method;
+        }
+    }
+
+    return methods;
+}
+
+static void
+auth_race_step(gpointer data,
+               gint methods,
+               gint passed,
+               gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    AuthSession *session = data;
+
+    auth_session_emit_auth_method_changed(service, session, methods);
+
+    //串行认证中指纹通过，继续下一种认证方式
+    if (passed & SESSION_AUTH_METHOD_FINGERPRINT)
+    {
+        auth_session_emit_auth_messages(service,
+                                        session,
+                                        _("Fingerprint auth successed!"),
+                                        PAM_TEXT_INFO);
+    }
+}
+
+/*
+ * 所有认证方式结束，统一发送认证结果
+ */
+static void
+auth_race_finish(gpointer data,
+                 KiranAuthRaceResult result,
+                 const gchar *username,
+                 gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    AuthSession *session = data;
+
+    dzlog_debug("Session %s finished with result %d", session->sid, result);
+
+    session->auth_completed = TRUE;
+
+    //没有指定用户的会话必须由认证方式给出通过的用户，否则不能确定认证的是谁
+    if (result == KIRAN_AUTH_RACE_SUCCESS && username == NULL && session->username == NULL)
+    {
+        dzlog_warn("Session %s passed without a username, treat it as failed", session->sid);
+        result = KIRAN_AUTH_RACE_FAIL;
+    }
+
+    switch (result)
+    {
+    case KIRAN_AUTH_RACE_SUCCESS:
+        auth_session_emit_auth_status(service,
+                                      session,
+                                      username ? username : session->username,
+                                      SESSION_AUTH_SUCCESS);
+        break;
+    case KIRAN_AUTH_RACE_TIMEOUT:
+        auth_session_emit_auth_messages(service,
+                                        session,
+                                        _("Authentication timed out!"),
+                                        PAM_ERROR_MSG);
+        //fallthrough
+    case KIRAN_AUTH_RACE_FAIL:
+        auth_session_emit_auth_status(service,
+                                      session,
+                                      session->username,
+                                      SESSION_AUTH_FAIL);
+        break;
+    default:
+        //会话被停止，不发送认证结果
+        break;
+    }
+
+    session->last_active = g_get_monotonic_time();
+    g_atomic_int_set(&session->finished, TRUE);
+}
+
+static void
+auth_race_session_ref(gpointer data)
+{
+    auth_session_ref(data);
+}
+
+static const KiranAuthRaceFuncs auth_race_funcs = {
+    auth_race_step,
+    auth_race_finish,
+    auth_race_session_ref,
+    auth_session_unref,
+};
+
+/*
+ * 按会话认证类型生成认证策略并开始认证
+ */
+static void
+auth_session_start_race(KiranAuthService *service,
+                        AuthSession *session)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    gint methods;
+    gint fprint_timeout = priv->conversation_timeout;
+
+    dzlog_debug("Start authentication with sid: %s, username:%s, authmode:%d, session_auth_type:%d, occupy:%d, fprint_ids:%p, face_ids:%p, class:%d",
+                session->sid, session->username, session->user_auth_mode,
+                session->session_auth_type, session->occupy, session->fprint_ids,
+                session->face_ids, session->auth_class);
+
+    session->last_active = g_get_monotonic_time();
+    if (priv->session_timeout > 0)
+    {
+        session->auth_deadline = session->last_active + (gint64)priv->session_timeout * G_USEC_PER_SEC;
+        fprint_timeout = MIN(fprint_timeout, priv->session_timeout);
+    }
+
+    session->race = kiran_auth_race_new((const KiranAuthRaceBackend *)priv->auth_backends->data,
+                                        priv->auth_backends->len,
+                                        &auth_race_funcs,
+                                        session,
+                                        service);
+
+    //各模块自己判断能否为该会话认证，例如人脸比对需要已知用户的模板
+    methods = auth_session_available_methods(service, session);
+
+    switch (session->session_auth_type)
+    {
+    case SESSION_AUTH_TYPE_TOGETHER:
+    case SESSION_AUTH_TYPE_TOGETHER_WITH_USER:
+        //任意一种认证方式通过即可，密码认证失败时整个认证失败
+        kiran_auth_race_add_step(session->race,
+                                 methods,
+                                 1,
+                                 SESSION_AUTH_METHOD_PASSWORD,
+                                 FALSE,
+                                 priv->session_timeout);
+        break;
+
+    default:
+        //串行认证，先指纹后密码，开启了密码认证时指纹认证超时后继续密码认证，其它认证方式不参与
+        if ((session->user_auth_mode & ACCOUNTS_AUTH_MODE_FINGERPRINT) &&
+            (methods & SESSION_AUTH_METHOD_FINGERPRINT))
+        {
+            kiran_auth_race_add_step(session->race,
+                                     SESSION_AUTH_METHOD_FINGERPRINT,
+                                     1,
+                                     0,
+                                     (session->user_auth_mode & ACCOUNTS_AUTH_MODE_PASSWORD) != 0,
+                                     fprint_timeout);
+        }
+
+        if (session->user_auth_mode & ACCOUNTS_AUTH_MODE_PASSWORD)
+        {
+            kiran_auth_race_add_step(session->race,
+                                     SESSION_AUTH_METHOD_PASSWORD,
+                                     1,
+                                     SESSION_AUTH_METHOD_PASSWORD,
+                                     FALSE,
+                                     0);
+        }
+    }
+
+    kiran_auth_race_start(session->race);
+}
+
+typedef struct _ReapData
+{
+    gint64 idle_before;
+    GList *sessions;
+} ReapData;
+
+static void
+collect_idle_session(gpointer data,
+                     gpointer user_data)
+{
+    AuthSession *session = data;
+    ReapData *reap = user_data;
+    gboolean running;
+
+    //正在排队或者认证的会话由认证超时结束
+    running = session->is_pending ||
+              (session->is_start && !g_atomic_int_get(&session->finished));
+    if (running)
+        return;
+
+    if (session->last_active > reap->idle_before)
+        return;
+
+    reap->sessions = g_list_prepend(reap->sessions, auth_session_ref(session));
+}
+
+/*
+ * 回收CreateAuth后一直没有开始认证，以及认证结束后没有StopAuth的会话，释放其私钥
+ */
+static gboolean
+session_reaper_cb(gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    KiranAuthServicePrivate *priv = service->priv;
+    ReapData reap = {0};
+    GList *iter;
+
+    //遍历时不能删除会话，先收集再停止
+    reap.idle_before = g_get_monotonic_time() - (gint64)priv->idle_session_timeout * G_USEC_PER_SEC;
+    kiran_auth_registry_foreach(priv->auth_registry, collect_idle_session, &reap);
+
+    for (iter = reap.sessions; iter; iter = iter->next)
+    {
+        AuthSession *session = iter->data;
+
+        dzlog_info("Session %s is idle for a long time, reap it", session->sid);
+        priv->sessions_reaped++;
+        if (kiran_auth_registry_lookup_sid(priv->auth_registry, session->sid) == session)
+        {
+            auth_session_stop(service, session);
+        }
+        auth_session_unref(session);
+    }
+    g_list_free(reap.sessions);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/*
+ * GThreadPool不支持设置线程栈大小，创建认证线程池前临时修改进程默认线程属性，
+ * 独占线程池在创建时启动所有线程，创建后立即通过restore_default_thread_attr恢复，
+ * 之后创建的其它线程（公私钥池、pam备用句柄和glib内部线程）仍使用原来的栈大小
+ *
+ * @return 修改了默认线程属性并保存了原来的属性时返回TRUE
+ */
+static gboolean
+set_auth_thread_stack_size(int size_kb,
+                           pthread_attr_t *saved)
+{
+#ifdef __GLIBC__
+    pthread_attr_t attr;
+    int ret;
+
+    if (size_kb <= 0)
+        return FALSE;
+
+    ret = pthread_getattr_default_np(saved);
+    if (ret != 0)
     {
-        session->session_auth_type = arg_type_op;
-    }
-    else
-    {  //使用默认的认证方式
-        session->session_auth_type = priv->default_session_auth_type;
+        dzlog_error("Get default thread attributes failed: %s", g_strerror(ret));
+        return FALSE;
     }
 
-    session->occupy = arg_occupy;
-    session->stop_auth = FALSE;
-    session->service = service;
-    session->auth_completed = FALSE;
-
-    g_mutex_init(&session->prompt_mutex);
-    g_cond_init(&session->prompt_cond);
-    g_mutex_init(&session->stop_mutex);
-    g_cond_init(&session->stop_cond);
-    g_mutex_init(&session->auth_mutex);
-    g_cond_init(&session->auth_cond);
-
-    ret = g_thread_pool_push(priv->auth_thread_pool,
-                             session,
-                             &error);
-    if (!ret)
+    pthread_attr_init(&attr);
+    ret = pthread_attr_setstacksize(&attr, MAX((size_t)size_kb * 1024, (size_t)PTHREAD_STACK_MIN));
+    if (ret == 0)
     {
-        g_dbus_method_invocation_return_error(invocation,
-                                              G_DBUS_ERROR,
-                                              G_DBUS_ERROR_INVALID_ARGS,
-                                              "Push to auth thread pool failed: %s",
-                                              error->message);
-        dzlog_error("ush to auth thread pool failed: %s", error->message);
-        g_error_free(error);
+        ret = pthread_setattr_default_np(&attr);
     }
+    pthread_attr_destroy(&attr);
 
-    kiran_authentication_gen_complete_start_auth(object, invocation);
+    if (ret != 0)
+    {
+        dzlog_error("Set auth thread stack size %dKB failed: %s", size_kb, g_strerror(ret));
+        pthread_attr_destroy(saved);
+        return FALSE;
+    }
 
     return TRUE;
+#else
+    if (size_kb > 0)
+    {
+        dzlog_warn("AuthThreadStackSize is not supported on this platform");
+    }
+    return FALSE;
+#endif
 }
 
-static gboolean
-kiran_auth_service_handle_stop_auth(KiranAuthenticationGen *object,
-                                    GDBusMethodInvocation *invocation,
-                                    const gchar *arg_sid)
+static void
+restore_default_thread_attr(pthread_attr_t *saved)
 {
-    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
-    KiranAuthServicePrivate *priv = service->priv;
-    AuthSession *session = NULL;
-
-    dzlog_debug("Handle stop auth with sid: %s", arg_sid);
+#ifdef __GLIBC__
+    int ret;
 
-    session = find_auth_session_by_sid(service, arg_sid);
-    if (session == NULL)
+    ret = pthread_setattr_default_np(saved);
+    if (ret != 0)
     {
-        //不存在对应的会话
-        g_dbus_method_invocation_return_error(invocation,
-                                              G_DBUS_ERROR,
-                                              G_DBUS_ERROR_INVALID_ARGS,
-                                              "The auth session id %s not existed",
-                                              arg_sid);
-        return TRUE;
+        dzlog_error("Restore default thread attributes failed: %s", g_strerror(ret));
     }
+    pthread_attr_destroy(saved);
+#endif
+}
 
-    auth_session_stop(service, session);
+typedef struct _ReportFailureData
+{
+    AuthSession *session;
+    gint method;
+} ReportFailureData;
 
-    kiran_authentication_gen_complete_stop_auth(object, invocation);
+static gboolean
+report_failure_idle_cb(gpointer user_data)
+{
+    ReportFailureData *data = user_data;
 
-    return TRUE;
+    kiran_auth_race_report(data->session->race, data->method, FALSE, NULL);
+    auth_session_unref(data->session);
+    g_free(data);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * 仲裁回调中不能再调用仲裁接口，报告结果可能会取消其它认证方式而再次使用仲裁，回到主循环后再报告
+ */
+static void
+auth_session_report_failure_idle(AuthSession *session,
+                                 gint method)
+{
+    ReportFailureData *data = g_new0(ReportFailureData, 1);
+
+    data->session = auth_session_ref(session);
+    data->method = method;
+    g_idle_add(report_failure_idle_cb, data);
 }
 
+/*
+ * 设备的识别操作由仲裁在会话之间保持，识别结果按当前使用者分发
+ */
 static gboolean
-kiran_auth_service_handle_response_message(KiranAuthenticationGen *object,
-                                           GDBusMethodInvocation *invocation,
-                                           const gchar *arg_message,
-                                           const gchar *arg_sid)
+fprint_arbiter_arm(gpointer data,
+                   gboolean handoff,
+                   gpointer user_data)
 {
-    KiranAuthService *service = KIRAN_AUTH_SERVICE(object);
-    KiranAuthServicePrivate *priv = service->priv;
-    AuthSession *session = NULL;
+    FprintReader *reader = user_data;
+    AuthSession *session = data;
+    GError *error = NULL;
 
-    dzlog_debug("Handle response message  with sid: %s", arg_sid);
+    if (reader->proxy)
+    {
+        kiran_biometrics_call_verify_fprint_start_sync(reader->proxy,
+                                                       NULL,
+                                                       &error);
+    }
+    else
+    {
+        g_set_error(&error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN, "No biometrics proxy");
+    }
 
-    session = find_auth_session_by_sid(service, arg_sid);
-    if (session != NULL)
+    if (error != NULL)
     {
-        guchar *decode_message = NULL;
-        gchar *decrypted = NULL;
-        gsize out_len = 0;
+        dzlog_error("call verify fprint start on %s failed: %s", reader->object_path, error->message);
+        g_error_free(error);
 
-        //解码
-        decode_message = g_base64_decode(arg_message, &out_len);
-        if (decode_message)
-        {
-            //数据解密
-            kiran_authentication_rsa_private_decrypt(decode_message,
-                                                     out_len,
-                                                     session->key,
-                                                     &decrypted);
-            if (decrypted)
-            {
-                g_mutex_lock(&session->prompt_mutex);
-                g_free(session->respons_msg);
-                session->respons_msg = g_strdup(decrypted);
-                g_cond_signal(&session->prompt_cond);
-                g_mutex_unlock(&session->prompt_mutex);
-                g_free(decrypted);
-            }
-            else
-            {
-                dzlog_error("Decrypted response message failed with sid: %s", arg_sid);
-            }
-            g_free(decode_message);
-        }
-        else
+        if (session && handoff)
         {
-            dzlog_error("Decode response message  failed with sid: %s", arg_sid);
+            //排队后获得设备时失败，继续其它认证方式
+            auth_session_report_failure_idle(session, SESSION_AUTH_METHOD_FINGERPRINT);
         }
+        return FALSE;
     }
 
-    kiran_authentication_gen_complete_response_message(object, invocation);
-
     return TRUE;
 }
 
 static void
-kiran_authentication_gen_init(KiranAuthenticationGenIface *iface)
+fprint_arbiter_disarm(gpointer user_data)
 {
-    iface->handle_create_auth = kiran_auth_service_handle_create_auth;
-    iface->handle_start_auth = kiran_auth_service_handle_start_auth;
-    iface->handle_stop_auth = kiran_auth_service_handle_stop_auth;
-    iface->handle_response_message = kiran_auth_service_handle_response_message;
+    FprintReader *reader = user_data;
+
+    if (reader->proxy)
+    {
+        kiran_biometrics_call_verify_fprint_stop_sync(reader->proxy, NULL, NULL);
+    }
 }
 
-static int
-pam_conv_cb(int msg_length,
-            const struct pam_message **msg,
-            struct pam_response **resp,
-            void *app_data)
+static gboolean
+fprint_arbiter_start(gpointer data,
+                     gboolean handoff,
+                     gpointer user_data)
 {
-    AuthSession *session = app_data;
-    KiranAuthService *service = session->service;
-    const struct pam_message *m = msg[0];
-    struct pam_response *response = calloc(1, sizeof(struct pam_response));
-    struct pam_response *r = &response[0];
-
-    if (session->stop_auth)
-        return PAM_CONV_ERR;
-
-    //发送认证消息
-    kiran_authentication_gen_emit_auth_messages(KIRAN_AUTHENTICATION_GEN(service),
-                                                m->msg,
-                                                m->msg_style,
-                                                session->sid);
+    KiranAuthService *service = ((FprintReader *)user_data)->service;
+    AuthSession *session = data;
 
-    if (m->msg_style == PAM_PROMPT_ECHO_ON ||
-        m->msg_style == PAM_PROMPT_ECHO_OFF)
+    if (handoff)
     {
-        //等待请求的消息
-        g_mutex_lock(&session->prompt_mutex);
-        g_cond_wait(&session->prompt_cond, &session->prompt_mutex);
-        r->resp = g_strdup(session->respons_msg);
-        r->resp_retcode = 0;
-        g_mutex_unlock(&session->prompt_mutex);
+        auth_session_emit_auth_messages(service,
+                                        session,
+                                        _("The fingerprint device is ready, place your finger!"),
+                                        PAM_TEXT_INFO);
     }
 
-    *resp = response;
-
-    return PAM_SUCCESS;
+    return TRUE;
 }
 
 static void
-do_session_passwd_auth(KiranAuthService *service,
-                       AuthSession *session)
+fprint_arbiter_stop(gpointer data,
+                    gpointer user_data)
 {
-    struct pam_conv conversation = {pam_conv_cb, session};
-    int ret, state;
-    const void *user;
+    //设备是否停止由仲裁决定，会话之后的识别结果不再交给它
+}
 
-    ret = pam_start(SERVICE, session->username, &conversation, &session->pam_handle);
-    if (ret != PAM_SUCCESS)
-    {
-        dzlog_error("Failed to start PAM: %s", pam_strerror(NULL, ret));
-        return;
-    }
+static void
+fprint_arbiter_waiting(gpointer data,
+                       guint position,
+                       gboolean preempted,
+                       gpointer user_data)
+{
+    KiranAuthService *service = ((FprintReader *)user_data)->service;
+    AuthSession *session = data;
+    gchar *msg;
 
-    ret = pam_authenticate(session->pam_handle, 0);
-    if (ret != PAM_SUCCESS)
+    if (preempted)
     {
-        //认证失败
-        state = SESSION_AUTH_FAIL;
-        dzlog_error("Failed to PAM authenticate: %s", pam_strerror(NULL, ret));
+        msg = g_strdup_printf(_("The fingerprint device is taken by a higher priority authentication, waiting for device (position %u)..."),
+                              position);
     }
     else
     {
-        //认证成功
-        state = SESSION_AUTH_SUCCESS;
+        msg = g_strdup_printf(_("The fingerprint device is busy, waiting for device (position %u)..."),
+                              position);
     }
 
-    if (!session->auth_completed)
-    {
-        pam_get_item(session->pam_handle, PAM_USER, &user);
-        kiran_authentication_gen_emit_auth_status(KIRAN_AUTHENTICATION_GEN(service),
-                                                  user,
-                                                  state,
-                                                  session->sid);
-    }
+    auth_session_emit_auth_messages(service,
+                                    session,
+                                    msg,
+                                    PAM_TEXT_INFO);
+    g_free(msg);
+}
 
-    pam_end(session->pam_handle, 0);
-    session->pam_handle = NULL;
-    g_mutex_lock(&session->stop_mutex);
-    g_cond_signal(&session->stop_cond);
-    g_mutex_unlock(&session->stop_mutex);
+static const KiranAuthFprintArbiterFuncs fprint_arbiter_funcs = {
+    fprint_arbiter_start,
+    fprint_arbiter_stop,
+    fprint_arbiter_waiting,
+    fprint_arbiter_arm,
+    fprint_arbiter_disarm,
+};
+
+static FprintReader *
+fprint_reader_new(KiranAuthService *service,
+                  const gchar *object_path)
+{
+    FprintReader *reader = g_new0(FprintReader, 1);
+
+    reader->service = service;
+    reader->object_path = g_strdup(object_path);
+    reader->arbiter = kiran_auth_fprint_arbiter_new(&fprint_arbiter_funcs, reader);
+    kiran_auth_fprint_arbiter_set_idle_grace(reader->arbiter, service->priv->fprint_lease_grace);
+
+    return reader;
 }
 
-static gboolean
-do_session_fingerprint_auth(KiranAuthService *service,
-                            AuthSession *session)
+/*
+ * 仲裁释放时停止仍在运行的设备，需要在释放代理之前
+ */
+static void
+fprint_reader_free(gpointer data)
 {
-    KiranAuthServicePrivate *priv = service->priv;
-    GError *error = NULL;
+    FprintReader *reader = data;
 
-    if (session->occupy)
+    kiran_auth_fprint_arbiter_free(reader->arbiter);
+    if (reader->proxy)
     {
-        //抢占该认证
-        kiran_biometrics_call_verify_fprint_stop_sync(priv->biometrics, NULL, NULL);
+        g_signal_handlers_disconnect_by_data(reader->proxy, reader);
+        g_object_unref(reader->proxy);
     }
+    g_free(reader->object_path);
+    g_free(reader);
+}
 
-    kiran_biometrics_call_verify_fprint_start_sync(priv->biometrics,
-                                                   NULL,
-                                                   &error);
+/*
+ * 按配置创建读取器，同一个对象路径只创建一个读取器，可以由多个座席共用
+ */
+static void
+init_fprint_readers(KiranAuthService *service)
+{
+    KiranAuthServicePrivate *priv = service->priv;
+    GHashTableIter iter;
+    gpointer seat;
+    gpointer path;
+    guint i;
 
-    if (error != NULL)
+    priv->fprint_readers = g_ptr_array_new_with_free_func(fprint_reader_free);
+    priv->seat_readers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_ptr_array_add(priv->fprint_readers, fprint_reader_new(service, BIOMETRICS_OBJECT_PATH));
+
+    g_hash_table_iter_init(&iter, priv->fprint_reader_paths);
+    while (g_hash_table_iter_next(&iter, &seat, &path))
     {
-        dzlog_error("call verify fprint start failed: %s", error->message);
-        g_error_free(error);
-        return FALSE;
-    }
+        FprintReader *reader = NULL;
 
-    priv->cur_fprint_session = session;
+        for (i = 0; i < priv->fprint_readers->len; i++)
+        {
+            FprintReader *item = g_ptr_array_index(priv->fprint_readers, i);
 
-    return TRUE;
+            if (g_strcmp0(item->object_path, path) == 0)
+            {
+                reader = item;
+                break;
+            }
+        }
+
+        if (reader == NULL)
+        {
+            reader = fprint_reader_new(service, path);
+            g_ptr_array_add(priv->fprint_readers, reader);
+        }
+
+        g_hash_table_insert(priv->seat_readers, g_strdup(seat), reader);
+    }
+
+    g_hash_table_destroy(priv->fprint_reader_paths);
+    priv->fprint_reader_paths = NULL;
 }
 
-static void
-do_authentication(gpointer data,
-                  gpointer user_data)
+static gboolean
+face_arbiter_start(gpointer data,
+                   gboolean handoff,
+                   gpointer user_data)
 {
     KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
-    KiranAuthServicePrivate *priv = service->priv;
     AuthSession *session = data;
 
-    dzlog_debug("Start authentication with sid: %s, username:%s, authmode:%d, session_auth_type:%d, occupy:%d, fprint_ids:%p",
-                session->sid, session->username, session->user_auth_mode,
-                session->session_auth_type, session->occupy, session->fprint_ids);
-
-    //开启认证
-    session->is_start = TRUE;
-
-    switch (session->session_auth_type)
+    if (!face_verify_next(service, session))
     {
-    case SESSION_AUTH_TYPE_TOGETHER:
-        //并行认证模式
-        //发送认证模式
-        kiran_authentication_gen_emit_auth_method_changed(KIRAN_AUTHENTICATION_GEN(service),
-                                                          SESSION_AUTH_METHOD_PASSWORD | SESSION_AUTH_METHOD_FINGERPRINT,
-                                                          session->sid);
-        //启动指纹认证
-        if (priv->support_finger)
+        if (handoff)
         {
-            do_session_fingerprint_auth(service, session);
+            //排队后获得设备时失败，继续其它认证方式
+            auth_session_report_failure_idle(session, SESSION_AUTH_METHOD_FACE);
         }
+        return FALSE;
+    }
 
-        //启动密码认证
-        do_session_passwd_auth(service, session);
+    if (handoff)
+    {
+        auth_session_emit_auth_messages(service,
+                                        session,
+                                        _("The face device is ready, look at the camera!"),
+                                        PAM_TEXT_INFO);
+    }
 
-        break;
+    return TRUE;
+}
 
-    case SESSION_AUTH_TYPE_TOGETHER_WITH_USER:
-        //并行认证模式, 针对给定用户
-        if (session->user_auth_mode & ACCOUNTS_AUTH_MODE_FINGERPRINT)
-        {
-            //启动指纹认证
-            kiran_authentication_gen_emit_auth_method_changed(KIRAN_AUTHENTICATION_GEN(service),
-                                                              SESSION_AUTH_METHOD_PASSWORD | SESSION_AUTH_METHOD_FINGERPRINT,
-                                                              session->sid);
-            do_session_fingerprint_auth(service, session);
-        }
-        else
-        {
-            kiran_authentication_gen_emit_auth_method_changed(KIRAN_AUTHENTICATION_GEN(service),
-                                                              SESSION_AUTH_METHOD_PASSWORD,
-                                                              session->sid);
-        }
+static void
+face_arbiter_stop(gpointer data,
+                  gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    AuthSession *session = data;
 
-        //启动密码认证
-        do_session_passwd_auth(service, session);
+    kiran_biometrics_call_verify_face_stop_sync(service->priv->biometrics, NULL, NULL);
 
-        break;
+    //重新获得设备时从第一个模板开始比对
+    g_list_free(session->face_pending);
+    session->face_pending = NULL;
+    session->face_id = NULL;
+}
 
-    default:
-        //串行认证模式
-        if (session->user_auth_mode & ACCOUNTS_AUTH_MODE_FINGERPRINT)
-        {
-            //启动指纹认证
-            kiran_authentication_gen_emit_auth_method_changed(KIRAN_AUTHENTICATION_GEN(service),
-                                                              SESSION_AUTH_METHOD_FINGERPRINT,
-                                                              session->sid);
-            do_session_fingerprint_auth(service, session);
-
-            //等待指纹认证完成
-            g_mutex_lock(&session->auth_mutex);
-            g_cond_wait(&session->auth_cond, &session->auth_mutex);
-            g_mutex_unlock(&session->auth_mutex);
-        }
+static void
+face_arbiter_waiting(gpointer data,
+                     guint position,
+                     gboolean preempted,
+                     gpointer user_data)
+{
+    KiranAuthService *service = KIRAN_AUTH_SERVICE(user_data);
+    AuthSession *session = data;
+    gchar *msg;
 
-        if ((session->user_auth_mode & ACCOUNTS_AUTH_MODE_PASSWORD) && !session->auth_completed)
-        {
-            //启动密码认证
-            do_session_passwd_auth(service, session);
-        }
+    if (preempted)
+    {
+        msg = g_strdup_printf(_("The face device is taken by a higher priority authentication, waiting for device (position %u)..."),
+                              position);
+    }
+    else
+    {
+        msg = g_strdup_printf(_("The face device is busy, waiting for device (position %u)..."),
+                              position);
     }
+
+    auth_session_emit_auth_messages(service,
+                                    session,
+                                    msg,
+                                    PAM_TEXT_INFO);
+    g_free(msg);
 }
 
+static const KiranAuthFprintArbiterFuncs face_arbiter_funcs = {
+    face_arbiter_start,
+    face_arbiter_stop,
+    face_arbiter_waiting,
+};
+
 static void
 kiran_auth_service_init(KiranAuthService *self)
 {
     KiranAuthServicePrivate *priv;
     static guint id;
     GError *error = NULL;
+    pthread_attr_t default_thread_attr;
+    gboolean stack_size_set;
 
     priv = self->priv = KIRAN_AUTH_SERVICE_GET_PRIVATE(self);
-    priv->auth_list = NULL;
+    priv->auth_registry = kiran_auth_registry_new(auth_session_unref);
+    priv->fprint_reader_paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    priv->face_arbiter = kiran_auth_fprint_arbiter_new(&face_arbiter_funcs, self);
+    priv->broadcast_signals = FALSE;
+    g_mutex_init(&priv->watchers_mutex);
     priv->biometrics = NULL;
-    priv->cur_fprint_session = NULL;
     priv->support_finger = FALSE;
     priv->support_face = FALSE;
+    priv->key_pool_low_watermark = DEFAULT_KEY_POOL_LOW_WATERMARK;
+    priv->key_pool_high_watermark = DEFAULT_KEY_POOL_HIGH_WATERMARK;
+    priv->key_pool_threads = DEFAULT_KEY_POOL_THREADS;
+    priv->auth_threads = DEFAULT_AUTH_THREADS;
+    priv->auth_queue_limit = DEFAULT_AUTH_QUEUE_LIMIT;
+    priv->auth_thread_stack_size = 0;
+    priv->auth_reserved_threads = DEFAULT_AUTH_RESERVED_THREADS;
+    priv->auth_priority_aging = DEFAULT_AUTH_PRIORITY_AGING;
+    priv->conversation_timeout = DEFAULT_CONVERSATION_TIMEOUT;
+    priv->session_timeout = DEFAULT_SESSION_TIMEOUT;
+    priv->idle_session_timeout = DEFAULT_IDLE_SESSION_TIMEOUT;
+    priv->pam_helper_pool = NULL;
+    priv->pam_helpers = 0;
+    priv->pam_helper_max_uses = DEFAULT_PAM_HELPER_MAX_USES;
+    priv->pam_pool = NULL;
+    priv->pam_standby_handles = DEFAULT_PAM_STANDBY_HANDLES;
+    priv->enable_auth_modules = TRUE;
+    priv->fprint_lease_grace = DEFAULT_FPRINT_LEASE_GRACE;
 
     init_bio_support(self);
 
     default_session_auth_setting(self);
+
+    init_fprint_readers(self);
+
+    init_auth_modules(self);
+
+    if (priv->auth_threads <= 0)
+    {
+        priv->auth_threads = DEFAULT_AUTH_THREADS;
+    }
+    priv->auth_reserved_threads = CLAMP(priv->auth_reserved_threads, 0, priv->auth_threads - 1);
+
+    if (priv->conversation_timeout <= 0)
+    {
+        priv->conversation_timeout = DEFAULT_CONVERSATION_TIMEOUT;
+    }
+
+    if (priv->idle_session_timeout > 0)
+    {
+        priv->session_reaper_id = g_timeout_add_seconds(MIN(priv->idle_session_timeout, SESSION_REAPER_INTERVAL),
+                                                        session_reaper_cb,
+                                                        self);
+    }
+
+    if (priv->pam_helpers > 0)
+    {
+        priv->pam_helper_pool = kiran_auth_pam_helper_pool_new(PAM_HELPER_PATH,
+                                                               priv->pam_helpers,
+                                                               priv->pam_helper_max_uses);
+    }
+    else if (priv->pam_standby_handles > 0)
+    {
+        //辅助进程中各自调用pam_start，备用句柄只用于在认证线程中执行的认证
+        priv->pam_pool = kiran_auth_pam_pool_new(SERVICE, priv->pam_standby_handles);
+    }
+
+    priv->key_pool = kiran_authentication_key_pool_new(priv->key_pool_low_watermark,
+                                                       priv->key_pool_high_watermark,
+                                                       priv->key_pool_threads);
+
+    //只有认证线程使用配置的栈大小
+    stack_size_set = set_auth_thread_stack_size(priv->auth_thread_stack_size, &default_thread_attr);
     priv->auth_thread_pool = g_thread_pool_new(do_authentication,
                                                self,
-                                               MAX_THREAD_NUM,
+                                               priv->auth_threads,
                                                TRUE,
                                                &error);
+    if (stack_size_set)
+    {
+        restore_default_thread_attr(&default_thread_attr);
+    }
 
     if (priv->auth_thread_pool == NULL)
     {
         dzlog_error("Failed ceate thread pool: %s", error->message);
         g_error_free(error);
     }
+    else
+    {
+        g_thread_pool_set_sort_function(priv->auth_thread_pool,
+                                        auth_session_queue_compare,
+                                        NULL);
+    }
 
     //向DBus守护程序请求拥有DBus
     priv->bus_name_id = g_bus_own_name(G_BUS_TYPE_SYSTEM,
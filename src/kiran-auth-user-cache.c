@@ -0,0 +1,803 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+#include "kiran-auth-user-cache.h"
+#include <json-glib/json-glib.h>
+#include <kiran-cc-daemon/kiran-system-daemon/accounts-i.h>
+#ifdef ENABLE_ZLOG_EX
+#include <zlog_ex.h>
+#else
+#include <zlog.h>
+#endif
+
+#define ACCOUNTS_USER_INTERFACE_NAME "com.kylinsec.Kiran.SystemDaemon.Accounts.User"
+#define PROPERTIES_INTERFACE_NAME "org.freedesktop.DBus.Properties"
+
+typedef struct _LoadData LoadData;
+
+struct _KiranAuthUserCache
+{
+    GDBusConnection *connection;
+    GDBusProxy *accounts;
+    //缓存释放时取消所有后台加载
+    GCancellable *cancellable;
+
+    //用户名 -> KiranAuthUserProfile
+    GHashTable *by_name;
+    //用户对象路径 -> KiranAuthUserProfile，不持有
+    GHashTable *by_path;
+    //指纹模板id -> KiranAuthUserProfile，不持有，key为profile->fprint_ids中的字符串
+    GHashTable *by_fprint;
+    //人脸模板id -> KiranAuthUserProfile，不持有，key为profile->face_ids中的字符串
+    GHashTable *by_face;
+
+    guint generation;
+    guint auth_item_changed_id;
+    guint properties_changed_id;
+    gulong accounts_signal_id;
+
+    guint64 hits;
+    guint64 misses;
+    guint64 invalidations;
+    guint64 fprint_hits;
+    guint64 fprint_misses;
+    guint64 face_hits;
+    guint64 face_misses;
+};
+
+/*
+ * 后台加载一个用户的认证信息：Properties.GetAll -> GetAuthItems(指纹) -> GetAuthItems(人脸)，
+ * 用户未开启人脸认证时不查询人脸模板
+ */
+struct _LoadData
+{
+    KiranAuthUserCache *cache;
+    GCancellable *cancellable;
+    gchar *object_path;
+    guint generation;
+    gchar *username;
+    gint auth_modes;
+    GHashTable *fprint_ids;
+    KiranAuthUserCacheLoadCallback callback;
+    gpointer user_data;
+};
+
+static void
+profile_free(gpointer data)
+{
+    KiranAuthUserProfile *profile = data;
+
+    g_free(profile->username);
+    g_free(profile->object_path);
+    if (profile->fprint_ids)
+        g_hash_table_unref(profile->fprint_ids);
+    if (profile->face_ids)
+        g_hash_table_unref(profile->face_ids);
+    g_free(profile);
+}
+
+static void
+index_ids(GHashTable *index,
+          GHashTable *ids,
+          KiranAuthUserProfile *profile)
+{
+    GHashTableIter iter;
+    gchar *id;
+
+    if (ids == NULL)
+        return;
+
+    g_hash_table_iter_init(&iter, ids);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&id, NULL))
+    {
+        g_hash_table_insert(index, id, profile);
+    }
+}
+
+static void
+unindex_ids(GHashTable *index,
+            GHashTable *ids,
+            KiranAuthUserProfile *profile)
+{
+    GHashTableIter iter;
+    gchar *id;
+
+    if (ids == NULL)
+        return;
+
+    g_hash_table_iter_init(&iter, ids);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&id, NULL))
+    {
+        if (g_hash_table_lookup(index, id) == profile)
+        {
+            g_hash_table_remove(index, id);
+        }
+    }
+}
+
+static void
+profile_index(KiranAuthUserCache *cache,
+              KiranAuthUserProfile *profile)
+{
+    index_ids(cache->by_fprint, profile->fprint_ids, profile);
+    index_ids(cache->by_face, profile->face_ids, profile);
+}
+
+static void
+profile_unindex(KiranAuthUserCache *cache,
+                KiranAuthUserProfile *profile)
+{
+    unindex_ids(cache->by_fprint, profile->fprint_ids, profile);
+    unindex_ids(cache->by_face, profile->face_ids, profile);
+}
+
+/*
+ * 从所有索引中移除并释放
+ */
+static void
+profile_drop(KiranAuthUserCache *cache,
+             KiranAuthUserProfile *profile)
+{
+    profile_unindex(cache, profile);
+    g_hash_table_remove(cache->by_path, profile->object_path);
+    g_hash_table_remove(cache->by_name, profile->username);
+}
+
+static void
+profile_remove(KiranAuthUserCache *cache,
+               KiranAuthUserProfile *profile)
+{
+    dzlog_debug("Invalidate cached profile of user %s", profile->username);
+
+    profile_drop(cache, profile);
+    cache->invalidations++;
+}
+
+GHashTable *
+kiran_auth_user_cache_parse_auth_items(const gchar *data)
+{
+    JsonParser *jparse = json_parser_new();
+    JsonNode *root;
+    JsonReader *reader;
+    GHashTable *ids = NULL;
+    GError *error = NULL;
+    gboolean ret;
+
+    ret = json_parser_load_from_data(jparse,
+                                     data,
+                                     -1,
+                                     &error);
+    if (!ret)
+    {
+        dzlog_error("Error with parse json data: %s", error->message);
+        g_error_free(error);
+        g_object_unref(jparse);
+        return NULL;
+    }
+
+    ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    root = json_parser_get_root(jparse);
+    if (json_node_get_node_type(root) == JSON_NODE_ARRAY)
+    {
+        JsonArray *array = json_node_get_array(root);
+        GList *list = json_array_get_elements(array);
+        GList *iter;
+
+        reader = json_reader_new(NULL);
+        for (iter = list; iter; iter = iter->next)
+        {
+            const gchar *data_id;
+
+            json_reader_set_root(reader, iter->data);
+            json_reader_read_member(reader, "data_id");
+            data_id = json_reader_get_string_value(reader);
+            if (data_id)
+            {
+                g_hash_table_add(ids, g_strdup(data_id));
+            }
+        }
+        g_object_unref(reader);
+        g_list_free(list);
+    }
+
+    g_object_unref(jparse);
+
+    return ids;
+}
+
+static void
+load_data_free(LoadData *data)
+{
+    g_object_unref(data->cancellable);
+    g_free(data->object_path);
+    g_free(data->username);
+    if (data->fprint_ids)
+        g_hash_table_unref(data->fprint_ids);
+    g_free(data);
+}
+
+/*
+ * 加载结束，cancelled为TRUE时缓存已经释放，不能再访问
+ */
+static void
+load_data_finish(LoadData *data,
+                 gboolean cancelled)
+{
+    if (!cancelled && data->callback)
+    {
+        data->callback(data->username, data->auth_modes, data->user_data);
+    }
+    load_data_free(data);
+}
+
+/*
+ * 所有模板都已查询，缓存加载结果
+ */
+static void
+load_data_insert(LoadData *data,
+                 GHashTable *face_ids)
+{
+    KiranAuthUserCache *cache = data->cache;
+
+    if (data->generation == cache->generation)
+    {
+        kiran_auth_user_cache_insert(cache,
+                                     data->username,
+                                     data->object_path,
+                                     data->auth_modes,
+                                     data->fprint_ids,
+                                     face_ids,
+                                     data->generation);
+    }
+    else
+    {
+        //加载期间用户信息发生变化，重新加载
+        kiran_auth_user_cache_load_path(cache, data->object_path, NULL, NULL);
+    }
+
+    load_data_finish(data, FALSE);
+}
+
+/*
+ * 获取GetAuthItems的结果，失败时结束加载并返回NULL
+ */
+static GVariant *
+load_get_auth_items_finish(LoadData *data,
+                           GObject *source_object,
+                           GAsyncResult *res)
+{
+    GVariant *result;
+    GError *error = NULL;
+
+    result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+    if (result == NULL)
+    {
+        gboolean cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+        if (!cancelled)
+        {
+            dzlog_error("Error with getting the auth item of %s: %s", data->object_path, error->message);
+            g_clear_pointer(&data->username, g_free);
+        }
+        g_error_free(error);
+        load_data_finish(data, cancelled);
+    }
+
+    return result;
+}
+
+static void
+load_get_face_items_cb(GObject *source_object,
+                       GAsyncResult *res,
+                       gpointer user_data)
+{
+    LoadData *data = user_data;
+    GHashTable *face_ids = NULL;
+    GVariant *result;
+    const gchar *auth_items = NULL;
+
+    result = load_get_auth_items_finish(data, source_object, res);
+    if (result == NULL)
+        return;
+
+    g_variant_get(result, "(&s)", &auth_items);
+    face_ids = kiran_auth_user_cache_parse_auth_items(auth_items);
+    g_variant_unref(result);
+
+    if (face_ids == NULL)
+    {
+        //解析失败时按加载失败回调，与dbus调用失败相同
+        dzlog_error("Error with parsing the auth items of %s", data->object_path);
+        g_clear_pointer(&data->username, g_free);
+        load_data_finish(data, FALSE);
+        return;
+    }
+
+    load_data_insert(data, face_ids);
+    g_hash_table_unref(face_ids);
+}
+
+static void
+load_get_auth_items_cb(GObject *source_object,
+                       GAsyncResult *res,
+                       gpointer user_data)
+{
+    LoadData *data = user_data;
+    GVariant *result;
+    const gchar *auth_items = NULL;
+
+    result = load_get_auth_items_finish(data, source_object, res);
+    if (result == NULL)
+        return;
+
+    g_variant_get(result, "(&s)", &auth_items);
+    data->fprint_ids = kiran_auth_user_cache_parse_auth_items(auth_items);
+    g_variant_unref(result);
+
+    if (data->fprint_ids == NULL)
+    {
+        //解析失败时按加载失败回调，与dbus调用失败相同
+        dzlog_error("Error with parsing the auth items of %s", data->object_path);
+        g_clear_pointer(&data->username, g_free);
+        load_data_finish(data, FALSE);
+        return;
+    }
+
+    if (!(data->auth_modes & ACCOUNTS_AUTH_MODE_FACE))
+    {
+        load_data_insert(data, NULL);
+        return;
+    }
+
+    g_dbus_connection_call(data->cache->connection,
+                           g_dbus_proxy_get_name(data->cache->accounts),
+                           data->object_path,
+                           ACCOUNTS_USER_INTERFACE_NAME,
+                           "GetAuthItems",
+                           g_variant_new("(i)", ACCOUNTS_AUTH_MODE_FACE),
+                           G_VARIANT_TYPE("(s)"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           data->cancellable,
+                           load_get_face_items_cb,
+                           data);
+}
+
+static void
+load_get_all_cb(GObject *source_object,
+                GAsyncResult *res,
+                gpointer user_data)
+{
+    LoadData *data = user_data;
+    GVariant *result;
+    GVariant *properties = NULL;
+    GError *error = NULL;
+
+    result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+    if (result == NULL)
+    {
+        gboolean cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+        if (!cancelled)
+        {
+            dzlog_error("Error with getting the properties of %s: %s", data->object_path, error->message);
+        }
+        g_error_free(error);
+        load_data_finish(data, cancelled);
+        return;
+    }
+
+    g_variant_get(result, "(@a{sv})", &properties);
+    g_variant_lookup(properties, "user_name", "s", &data->username);
+    g_variant_lookup(properties, "auth_modes", "i", &data->auth_modes);
+    g_variant_unref(properties);
+    g_variant_unref(result);
+
+    if (data->username == NULL)
+    {
+        load_data_finish(data, FALSE);
+        return;
+    }
+
+    g_dbus_connection_call(data->cache->connection,
+                           g_dbus_proxy_get_name(data->cache->accounts),
+                           data->object_path,
+                           ACCOUNTS_USER_INTERFACE_NAME,
+                           "GetAuthItems",
+                           g_variant_new("(i)", ACCOUNTS_AUTH_MODE_FINGERPRINT),
+                           G_VARIANT_TYPE("(s)"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           data->cancellable,
+                           load_get_auth_items_cb,
+                           data);
+}
+
+void kiran_auth_user_cache_load_path(KiranAuthUserCache *cache,
+                                     const gchar *object_path,
+                                     KiranAuthUserCacheLoadCallback callback,
+                                     gpointer user_data)
+{
+    LoadData *data = g_new0(LoadData, 1);
+
+    data->cache = cache;
+    data->cancellable = g_object_ref(cache->cancellable);
+    data->object_path = g_strdup(object_path);
+    data->generation = cache->generation;
+    data->callback = callback;
+    data->user_data = user_data;
+
+    g_dbus_connection_call(cache->connection,
+                           g_dbus_proxy_get_name(cache->accounts),
+                           object_path,
+                           PROPERTIES_INTERFACE_NAME,
+                           "GetAll",
+                           g_variant_new("(s)", ACCOUNTS_USER_INTERFACE_NAME),
+                           G_VARIANT_TYPE("(a{sv})"),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           data->cancellable,
+                           load_get_all_cb,
+                           data);
+}
+
+static void
+warm_up_cb(GObject *source_object,
+           GAsyncResult *res,
+           gpointer user_data)
+{
+    KiranAuthUserCache *cache = user_data;
+    GVariant *result;
+    GVariantIter *iter = NULL;
+    GError *error = NULL;
+    const gchar *object_path;
+
+    result = g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object), res, &error);
+    if (result == NULL)
+    {
+        //缓存已经释放时不能再访问cache
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+            dzlog_error("Error with getting non system users: %s", error->message);
+        }
+        g_error_free(error);
+        return;
+    }
+
+    g_variant_get(result, "(ao)", &iter);
+    while (g_variant_iter_loop(iter, "&o", &object_path))
+    {
+        kiran_auth_user_cache_load_path(cache, object_path, NULL, NULL);
+    }
+    g_variant_iter_free(iter);
+    g_variant_unref(result);
+}
+
+void kiran_auth_user_cache_warm_up(KiranAuthUserCache *cache)
+{
+    g_dbus_proxy_call(cache->accounts,
+                      "GetNonSystemUsers",
+                      NULL,
+                      G_DBUS_CALL_FLAGS_NONE,
+                      -1,
+                      cache->cancellable,
+                      warm_up_cb,
+                      cache);
+}
+
+void kiran_auth_user_cache_invalidate_path(KiranAuthUserCache *cache,
+                                           const gchar *object_path)
+{
+    KiranAuthUserProfile *profile;
+
+    //查询中的结果可能已经过期
+    cache->generation++;
+
+    profile = g_hash_table_lookup(cache->by_path, object_path);
+    if (profile)
+    {
+        profile_remove(cache, profile);
+    }
+}
+
+static void
+on_auth_item_changed(GDBusConnection *connection,
+                     const gchar *sender_name,
+                     const gchar *object_path,
+                     const gchar *interface_name,
+                     const gchar *signal_name,
+                     GVariant *parameters,
+                     gpointer user_data)
+{
+    KiranAuthUserCache *cache = user_data;
+    gint mode = ACCOUNTS_AUTH_MODE_NONE;
+
+    if (g_variant_is_of_type(parameters, G_VARIANT_TYPE("(i)")))
+    {
+        g_variant_get(parameters, "(i)", &mode);
+    }
+
+    //只缓存了指纹和人脸模板，其它认证项的变化不影响缓存
+    if (mode == ACCOUNTS_AUTH_MODE_FINGERPRINT ||
+        mode == ACCOUNTS_AUTH_MODE_FACE)
+    {
+        kiran_auth_user_cache_invalidate_path(cache, object_path);
+        //重新加载，保持模板反向索引完整
+        kiran_auth_user_cache_load_path(cache, object_path, NULL, NULL);
+    }
+}
+
+static void
+on_properties_changed(GDBusConnection *connection,
+                      const gchar *sender_name,
+                      const gchar *object_path,
+                      const gchar *interface_name,
+                      const gchar *signal_name,
+                      GVariant *parameters,
+                      gpointer user_data)
+{
+    KiranAuthUserCache *cache = user_data;
+    KiranAuthUserProfile *profile;
+    GVariant *changed = NULL;
+    const gchar **invalidated = NULL;
+    gint auth_modes;
+    gboolean drop = FALSE;
+
+    if (!g_variant_is_of_type(parameters, G_VARIANT_TYPE("(sa{sv}as)")))
+    {
+        return;
+    }
+
+    g_variant_get(parameters, "(&s@a{sv}^a&s)", NULL, &changed, &invalidated);
+
+    if (g_variant_lookup(changed, "user_name", "&s", NULL) ||
+        (invalidated && g_strv_contains(invalidated, "user_name")) ||
+        (invalidated && g_strv_contains(invalidated, "auth_modes")))
+    {
+        drop = TRUE;
+    }
+
+    profile = g_hash_table_lookup(cache->by_path, object_path);
+    if (drop)
+    {
+        kiran_auth_user_cache_invalidate_path(cache, object_path);
+        kiran_auth_user_cache_load_path(cache, object_path, NULL, NULL);
+    }
+    else if (g_variant_lookup(changed, "auth_modes", "i", &auth_modes))
+    {
+        cache->generation++;
+        if (profile && ((profile->auth_modes ^ auth_modes) & ACCOUNTS_AUTH_MODE_FACE))
+        {
+            //开启人脸认证前没有查询人脸模板，重新加载
+            profile_remove(cache, profile);
+            kiran_auth_user_cache_load_path(cache, object_path, NULL, NULL);
+        }
+        else if (profile)
+        {
+            dzlog_debug("Update cached auth modes of user %s: %d", profile->username, auth_modes);
+            profile->auth_modes = auth_modes;
+        }
+    }
+
+    g_variant_unref(changed);
+    g_free(invalidated);
+}
+
+static void
+on_accounts_signal(GDBusProxy *proxy,
+                   const gchar *sender_name,
+                   const gchar *signal_name,
+                   GVariant *parameters,
+                   gpointer user_data)
+{
+    KiranAuthUserCache *cache = user_data;
+    const gchar *object_path = NULL;
+
+    if (g_strcmp0(signal_name, "UserAdded") != 0 &&
+        g_strcmp0(signal_name, "UserDeleted") != 0)
+    {
+        return;
+    }
+
+    if (!g_variant_is_of_type(parameters, G_VARIANT_TYPE("(o)")))
+    {
+        return;
+    }
+
+    g_variant_get(parameters, "(&o)", &object_path);
+    kiran_auth_user_cache_invalidate_path(cache, object_path);
+
+    if (g_strcmp0(signal_name, "UserAdded") == 0)
+    {
+        kiran_auth_user_cache_load_path(cache, object_path, NULL, NULL);
+    }
+}
+
+KiranAuthUserCache *
+kiran_auth_user_cache_new(GDBusConnection *connection,
+                          GDBusProxy *accounts)
+{
+    KiranAuthUserCache *cache = g_new0(KiranAuthUserCache, 1);
+    const gchar *accounts_name = g_dbus_proxy_get_name(accounts);
+
+    cache->connection = g_object_ref(connection);
+    cache->accounts = g_object_ref(accounts);
+    cache->cancellable = g_cancellable_new();
+    cache->by_name = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, profile_free);
+    cache->by_path = g_hash_table_new(g_str_hash, g_str_equal);
+    cache->by_fprint = g_hash_table_new(g_str_hash, g_str_equal);
+    cache->by_face = g_hash_table_new(g_str_hash, g_str_equal);
+
+    cache->auth_item_changed_id = g_dbus_connection_signal_subscribe(connection,
+                                                                     accounts_name,
+                                                                     ACCOUNTS_USER_INTERFACE_NAME,
+                                                                     "AuthItemChanged",
+                                                                     NULL,
+                                                                     NULL,
+                                                                     G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                     on_auth_item_changed,
+                                                                     cache,
+                                                                     NULL);
+
+    cache->properties_changed_id = g_dbus_connection_signal_subscribe(connection,
+                                                                      accounts_name,
+                                                                      PROPERTIES_INTERFACE_NAME,
+                                                                      "PropertiesChanged",
+                                                                      NULL,
+                                                                      ACCOUNTS_USER_INTERFACE_NAME,
+                                                                      G_DBUS_SIGNAL_FLAGS_NONE,
+                                                                      on_properties_changed,
+                                                                      cache,
+                                                                      NULL);
+
+    cache->accounts_signal_id = g_signal_connect(accounts,
+                                                 "g-signal",
+                                                 G_CALLBACK(on_accounts_signal),
+                                                 cache);
+
+    return cache;
+}
+
+void kiran_auth_user_cache_free(KiranAuthUserCache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    g_cancellable_cancel(cache->cancellable);
+    g_object_unref(cache->cancellable);
+
+    g_dbus_connection_signal_unsubscribe(cache->connection, cache->auth_item_changed_id);
+    g_dbus_connection_signal_unsubscribe(cache->connection, cache->properties_changed_id);
+    g_signal_handler_disconnect(cache->accounts, cache->accounts_signal_id);
+
+    g_hash_table_destroy(cache->by_face);
+    g_hash_table_destroy(cache->by_fprint);
+    g_hash_table_destroy(cache->by_path);
+    g_hash_table_destroy(cache->by_name);
+    g_object_unref(cache->accounts);
+    g_object_unref(cache->connection);
+    g_free(cache);
+}
+
+const KiranAuthUserProfile *
+kiran_auth_user_cache_lookup(KiranAuthUserCache *cache,
+                             const gchar *username)
+{
+    KiranAuthUserProfile *profile;
+
+    profile = g_hash_table_lookup(cache->by_name, username);
+    if (profile)
+        cache->hits++;
+    else
+        cache->misses++;
+
+    return profile;
+}
+
+guint kiran_auth_user_cache_get_generation(KiranAuthUserCache *cache)
+{
+    return cache->generation;
+}
+
+void kiran_auth_user_cache_insert(KiranAuthUserCache *cache,
+                                  const gchar *username,
+                                  const gchar *object_path,
+                                  gint auth_modes,
+                                  GHashTable *fprint_ids,
+                                  GHashTable *face_ids,
+                                  guint generation)
+{
+    KiranAuthUserProfile *profile;
+
+    if (generation != cache->generation)
+    {
+        dzlog_debug("Accounts changed while looking up user %s, not cached", username);
+        return;
+    }
+
+    profile = g_hash_table_lookup(cache->by_name, username);
+    if (profile)
+    {
+        profile_drop(cache, profile);
+    }
+
+    profile = g_hash_table_lookup(cache->by_path, object_path);
+    if (profile)
+    {
+        //用户已改名
+        profile_drop(cache, profile);
+    }
+
+    profile = g_new0(KiranAuthUserProfile, 1);
+    profile->username = g_strdup(username);
+    profile->object_path = g_strdup(object_path);
+    profile->auth_modes = auth_modes;
+    profile->fprint_ids = fprint_ids ? g_hash_table_ref(fprint_ids) : NULL;
+    profile->face_ids = face_ids ? g_hash_table_ref(face_ids) : NULL;
+
+    g_hash_table_insert(cache->by_name, profile->username, profile);
+    g_hash_table_insert(cache->by_path, profile->object_path, profile);
+    profile_index(cache, profile);
+}
+
+const KiranAuthUserProfile *
+kiran_auth_user_cache_lookup_fprint(KiranAuthUserCache *cache,
+                                    const gchar *fprint_id)
+{
+    KiranAuthUserProfile *profile;
+
+    if (fprint_id == NULL)
+        return NULL;
+
+    profile = g_hash_table_lookup(cache->by_fprint, fprint_id);
+    if (profile)
+        cache->fprint_hits++;
+    else
+        cache->fprint_misses++;
+
+    return profile;
+}
+
+const KiranAuthUserProfile *
+kiran_auth_user_cache_lookup_face(KiranAuthUserCache *cache,
+                                  const gchar *face_id)
+{
+    KiranAuthUserProfile *profile;
+
+    if (face_id == NULL)
+        return NULL;
+
+    profile = g_hash_table_lookup(cache->by_face, face_id);
+    if (profile)
+        cache->face_hits++;
+    else
+        cache->face_misses++;
+
+    return profile;
+}
+
+void kiran_auth_user_cache_get_stats(KiranAuthUserCache *cache,
+                                     KiranAuthUserCacheStats *stats)
+{
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->invalidations = cache->invalidations;
+    stats->size = g_hash_table_size(cache->by_name);
+    stats->fprint_hits = cache->fprint_hits;
+    stats->fprint_misses = cache->fprint_misses;
+    stats->fprint_size = g_hash_table_size(cache->by_fprint);
+    stats->face_hits = cache->face_hits;
+    stats->face_misses = cache->face_misses;
+    stats->face_size = g_hash_table_size(cache->by_face);
+}
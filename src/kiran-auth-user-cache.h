@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file kiran-auth-user-cache.h
+ *@brief 用户认证信息缓存，由accounts服务的信号精确失效，
+ *       同时维护指纹和人脸模板id到用户的反向索引
+ *@author wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ *@copyright(c) 2021 KylinSec.All rights reserved.
+ */
+#ifndef __KIRAN_AUTH_USER_CACHE_H__
+#define __KIRAN_AUTH_USER_CACHE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _KiranAuthUserCache KiranAuthUserCache;
+typedef struct _KiranAuthUserProfile KiranAuthUserProfile;
+
+/*
+ * 用户认证信息
+ */
+struct _KiranAuthUserProfile
+{
+    gchar *username;
+    //accounts服务中的用户对象路径
+    gchar *object_path;
+    //用户开启的认证模式
+    gint auth_modes;
+    //绑定的指纹模板id集合，引用计数，可以被会话共享
+    GHashTable *fprint_ids;
+    //绑定的人脸模板id集合，未开启人脸认证时为NULL
+    GHashTable *face_ids;
+};
+
+typedef struct _KiranAuthUserCacheStats
+{
+    guint64 hits;
+    guint64 misses;
+    guint64 invalidations;
+    guint size;
+    //指纹模板反向索引
+    guint64 fprint_hits;
+    guint64 fprint_misses;
+    guint fprint_size;
+    //人脸模板反向索引
+    guint64 face_hits;
+    guint64 face_misses;
+    guint face_size;
+} KiranAuthUserCacheStats;
+
+/**
+ * @brief 用户信息加载完成回调
+ *
+ * @param[in] username 用户名，加载失败时为NULL
+ * @param[in] auth_modes 用户开启的认证模式
+ */
+typedef void (*KiranAuthUserCacheLoadCallback)(const gchar *username,
+                                               gint auth_modes,
+                                               gpointer user_data);
+
+/**
+ * @brief 创建用户认证信息缓存，并订阅accounts服务的用户变化信号
+ *
+ * @param[in] connection 系统总线连接
+ * @param[in] accounts accounts服务代理，用于接收UserAdded和UserDeleted信号
+ */
+KiranAuthUserCache *kiran_auth_user_cache_new(GDBusConnection *connection,
+                                              GDBusProxy *accounts);
+
+void kiran_auth_user_cache_free(KiranAuthUserCache *cache);
+
+/**
+ * @brief 查找用户认证信息，并统计命中次数
+ *
+ * @return 未缓存时返回NULL，返回的信息在下一次回到主循环前有效
+ */
+const KiranAuthUserProfile *kiran_auth_user_cache_lookup(KiranAuthUserCache *cache,
+                                                         const gchar *username);
+
+/**
+ * @brief 当前缓存的版本号，每次失效都会增加
+ *
+ * 异步查询用户信息前记录版本号，插入时版本号不一致则说明查询期间
+ * 用户信息可能发生了变化，查询结果不会被缓存
+ */
+guint kiran_auth_user_cache_get_generation(KiranAuthUserCache *cache);
+
+/**
+ * @brief 缓存查询到的用户认证信息
+ *
+ * @param[in] fprint_ids 指纹模板id集合，缓存增加一个引用
+ * @param[in] face_ids 人脸模板id集合，可以为NULL，缓存增加一个引用
+ * @param[in] generation 开始查询时的版本号
+ */
+void kiran_auth_user_cache_insert(KiranAuthUserCache *cache,
+                                  const gchar *username,
+                                  const gchar *object_path,
+                                  gint auth_modes,
+                                  GHashTable *fprint_ids,
+                                  GHashTable *face_ids,
+                                  guint generation);
+
+/**
+ * @brief 按指纹模板id查找绑定的用户
+ *
+ * @return 未找到时返回NULL，返回的信息在下一次回到主循环前有效
+ */
+const KiranAuthUserProfile *kiran_auth_user_cache_lookup_fprint(KiranAuthUserCache *cache,
+                                                                const gchar *fprint_id);
+
+/**
+ * @brief 按人脸模板id查找绑定的用户
+ *
+ * @return 未找到时返回NULL，返回的信息在下一次回到主循环前有效
+ */
+const KiranAuthUserProfile *kiran_auth_user_cache_lookup_face(KiranAuthUserCache *cache,
+                                                              const gchar *face_id);
+
+/**
+ * @brief 在后台加载所有非系统用户的认证信息，建立模板反向索引
+ */
+void kiran_auth_user_cache_warm_up(KiranAuthUserCache *cache);
+
+/**
+ * @brief 在后台加载给定对象路径的用户认证信息并缓存
+ *
+ * @param[in] callback 加载完成回调，可以为NULL，缓存释放时未完成的加载不再回调
+ */
+void kiran_auth_user_cache_load_path(KiranAuthUserCache *cache,
+                                     const gchar *object_path,
+                                     KiranAuthUserCacheLoadCallback callback,
+                                     gpointer user_data);
+
+/**
+ * @brief 解析GetAuthItems返回的json数据，返回模板id集合
+ *
+ * @return 解析失败时返回NULL
+ */
+GHashTable *kiran_auth_user_cache_parse_auth_items(const gchar *data);
+
+/**
+ * @brief 使给定对象路径的用户信息失效
+ */
+void kiran_auth_user_cache_invalidate_path(KiranAuthUserCache *cache,
+                                           const gchar *object_path);
+
+void kiran_auth_user_cache_get_stats(KiranAuthUserCache *cache,
+                                     KiranAuthUserCacheStats *stats);
+
+G_END_DECLS
+
+#endif /* __KIRAN_AUTH_USER_CACHE_H__ */
@@ -15,19 +15,42 @@
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
+#include <openssl/kdf.h>
 #include <openssl/pem.h>
+#include <openssl/rand.h>
 #include <openssl/rsa.h>
 #include <openssl/ssl.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "authentication_i.h"
 
 #define KEY_LEN 2048
 #define RSA_BUFFER_LEN 4096
+#define AEAD_KEY_LEN 32
+#define HKDF_INFO "kiran-authentication-x25519"
+//密钥池生成失败后的重试间隔，连续失败时从最小值开始加倍，单位毫秒
+#define KEY_POOL_RETRY_MIN_MS 100
+#define KEY_POOL_RETRY_MAX_MS 30000
 
-RSA *create_RSA(unsigned char *key,
-                int public)
+struct _KiranAuthKey
+{
+    int transport;
+    //rsa密钥
+    RSA *rsa;
+    int is_public;
+    //X25519私钥及对应的原始公钥
+    EVP_PKEY *pkey;
+    unsigned char raw_public[X25519_KEY_LEN];
+};
+
+static RSA *
+create_RSA(const char *key,
+           int public)
 {
     RSA *rsa = NULL;
     BIO *keybio;
@@ -47,26 +70,416 @@ RSA *create_RSA(unsigned char *key,
         rsa = PEM_read_bio_RSAPrivateKey(keybio, &rsa, NULL, NULL);
     }
 
+    BIO_free(keybio);
+
     return rsa;
 }
 
+static KiranAuthKey *
+key_new(const char *key,
+        int public)
+{
+    KiranAuthKey *auth_key;
+    RSA *rsa;
+
+    if (key == NULL)
+    {
+        return NULL;
+    }
+
+    rsa = create_RSA(key, public);
+    if (rsa == NULL)
+    {
+        return NULL;
+    }
+
+    auth_key = calloc(1, sizeof(KiranAuthKey));
+    if (auth_key == NULL)
+    {
+        RSA_free(rsa);
+        return NULL;
+    }
+
+    auth_key->transport = AUTH_TRANSPORT_RSA;
+    auth_key->rsa = rsa;
+    auth_key->is_public = public;
+
+    return auth_key;
+}
+
+KiranAuthKey *
+kiran_authentication_key_new_private(const char *key)
+{
+    return key_new(key, 0);
+}
+
+KiranAuthKey *
+kiran_authentication_key_new_public(const char *key)
+{
+    return key_new(key, 1);
+}
+
+static const EVP_CIPHER *
+transport_cipher(int transport)
+{
+    switch (transport)
+    {
+    case AUTH_TRANSPORT_X25519_CHACHA20_POLY1305:
+        return EVP_chacha20_poly1305();
+    case AUTH_TRANSPORT_X25519_AES_256_GCM:
+        return EVP_aes_256_gcm();
+    default:
+        return NULL;
+    }
+}
+
+KiranAuthKey *
+kiran_authentication_key_new_x25519(int transport)
+{
+    KiranAuthKey *auth_key = NULL;
+    EVP_PKEY_CTX *evp_ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+    size_t len = X25519_KEY_LEN;
+
+    if (transport_cipher(transport) == NULL)
+    {
+        return NULL;
+    }
+
+    evp_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+    if (evp_ctx == NULL)
+    {
+        return NULL;
+    }
+
+    if (EVP_PKEY_keygen_init(evp_ctx) <= 0 ||
+        EVP_PKEY_keygen(evp_ctx, &pkey) <= 0)
+    {
+        EVP_PKEY_CTX_free(evp_ctx);
+        return NULL;
+    }
+    EVP_PKEY_CTX_free(evp_ctx);
+
+    auth_key = calloc(1, sizeof(KiranAuthKey));
+    if (auth_key == NULL ||
+        EVP_PKEY_get_raw_public_key(pkey, auth_key->raw_public, &len) <= 0)
+    {
+        free(auth_key);
+        EVP_PKEY_free(pkey);
+        return NULL;
+    }
+
+    auth_key->transport = transport;
+    auth_key->pkey = pkey;
+
+    return auth_key;
+}
+
+int kiran_authentication_key_get_transport(KiranAuthKey *key)
+{
+    return key ? key->transport : -1;
+}
+
+int kiran_authentication_key_get_raw_public(KiranAuthKey *key,
+                                            unsigned char *public_key,
+                                            int public_key_size)
+{
+    if (key == NULL || key->pkey == NULL || public_key_size < X25519_KEY_LEN)
+    {
+        return -1;
+    }
+
+    memcpy(public_key, key->raw_public, X25519_KEY_LEN);
+
+    return X25519_KEY_LEN;
+}
+
+/*
+ * 由ECDH共享密钥导出对称密钥，info中带上双方公钥，
+ * 使导出的密钥与本次密钥交换绑定
+ */
+static int
+derive_aead_key(EVP_PKEY *own_key,
+                EVP_PKEY *peer_key,
+                const unsigned char *client_public,
+                const unsigned char *server_public,
+                unsigned char *aead_key)
+{
+    EVP_PKEY_CTX *ctx = NULL;
+    unsigned char secret[X25519_KEY_LEN];
+    unsigned char info[sizeof(HKDF_INFO) - 1 + X25519_KEY_LEN * 2];
+    size_t secret_len = sizeof(secret);
+    size_t key_len = AEAD_KEY_LEN;
+    int ret = -1;
+
+    ctx = EVP_PKEY_CTX_new(own_key, NULL);
+    if (ctx == NULL ||
+        EVP_PKEY_derive_init(ctx) <= 0 ||
+        EVP_PKEY_derive_set_peer(ctx, peer_key) <= 0 ||
+        EVP_PKEY_derive(ctx, secret, &secret_len) <= 0)
+    {
+        EVP_PKEY_CTX_free(ctx);
+        return -1;
+    }
+    EVP_PKEY_CTX_free(ctx);
+
+    memcpy(info, HKDF_INFO, sizeof(HKDF_INFO) - 1);
+    memcpy(info + sizeof(HKDF_INFO) - 1, client_public, X25519_KEY_LEN);
+    memcpy(info + sizeof(HKDF_INFO) - 1 + X25519_KEY_LEN, server_public, X25519_KEY_LEN);
+
+    ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    if (ctx != NULL &&
+        EVP_PKEY_derive_init(ctx) > 0 &&
+        EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) > 0 &&
+        EVP_PKEY_CTX_set1_hkdf_key(ctx, secret, secret_len) > 0 &&
+        EVP_PKEY_CTX_add1_hkdf_info(ctx, info, sizeof(info)) > 0 &&
+        EVP_PKEY_derive(ctx, aead_key, &key_len) > 0)
+    {
+        ret = 0;
+    }
+
+    EVP_PKEY_CTX_free(ctx);
+    OPENSSL_cleanse(secret, sizeof(secret));
+
+    return ret;
+}
+
+/*
+ * AEAD加解密，encrypt为1时加密并把认证标签写入tag，
+ * 为0时解密并校验tag
+ */
+static int
+aead_crypt(int transport,
+           int encrypt,
+           const unsigned char *aead_key,
+           const unsigned char *nonce,
+           const unsigned char *in,
+           int in_len,
+           unsigned char *out,
+           unsigned char *tag)
+{
+    EVP_CIPHER_CTX *ctx;
+    int len = 0;
+    int out_len = 0;
+    int ret = -1;
+
+    ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL)
+    {
+        return -1;
+    }
+
+    if (EVP_CipherInit_ex(ctx, transport_cipher(transport), NULL, NULL, NULL, encrypt) <= 0 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, AEAD_NONCE_LEN, NULL) <= 0 ||
+        EVP_CipherInit_ex(ctx, NULL, NULL, aead_key, nonce, encrypt) <= 0)
+    {
+        goto out;
+    }
+
+    if (!encrypt &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AEAD_TAG_LEN, tag) <= 0)
+    {
+        goto out;
+    }
+
+    if (in_len > 0 &&
+        EVP_CipherUpdate(ctx, out, &len, in, in_len) <= 0)
+    {
+        goto out;
+    }
+    out_len = len;
+
+    if (EVP_CipherFinal_ex(ctx, out + out_len, &len) <= 0)
+    {
+        goto out;
+    }
+    out_len += len;
+
+    if (encrypt &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AEAD_TAG_LEN, tag) <= 0)
+    {
+        goto out;
+    }
+
+    ret = out_len;
+
+out:
+    EVP_CIPHER_CTX_free(ctx);
+
+    return ret;
+}
+
+int kiran_authentication_aead_encrypt(int transport,
+                                      const char *data,
+                                      int data_len,
+                                      const unsigned char *public_key,
+                                      int key_len,
+                                      unsigned char **encrypted)
+{
+    KiranAuthKey *client_key = NULL;
+    EVP_PKEY *server_key = NULL;
+    unsigned char aead_key[AEAD_KEY_LEN];
+    unsigned char *ptr = NULL;
+    int result = -1;
+
+    *encrypted = NULL;
+
+    if (data_len < 0 || key_len != X25519_KEY_LEN)
+    {
+        return -1;
+    }
+
+    client_key = kiran_authentication_key_new_x25519(transport);
+    if (client_key == NULL)
+    {
+        return -1;
+    }
+
+    server_key = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, public_key, key_len);
+    ptr = malloc(data_len + AEAD_OVERHEAD_LEN);
+    if (server_key == NULL || ptr == NULL ||
+        derive_aead_key(client_key->pkey, server_key, client_key->raw_public, public_key, aead_key) != 0)
+    {
+        goto out;
+    }
+
+    memcpy(ptr, client_key->raw_public, X25519_KEY_LEN);
+    if (RAND_bytes(ptr + X25519_KEY_LEN, AEAD_NONCE_LEN) <= 0)
+    {
+        goto out;
+    }
+
+    if (aead_crypt(transport, 1, aead_key,
+                   ptr + X25519_KEY_LEN,
+                   (const unsigned char *)data, data_len,
+                   ptr + X25519_KEY_LEN + AEAD_NONCE_LEN,
+                   ptr + X25519_KEY_LEN + AEAD_NONCE_LEN + data_len) != data_len)
+    {
+        goto out;
+    }
+
+    result = data_len + AEAD_OVERHEAD_LEN;
+    *encrypted = ptr;
+    ptr = NULL;
+
+out:
+    OPENSSL_cleanse(aead_key, sizeof(aead_key));
+    free(ptr);
+    EVP_PKEY_free(server_key);
+    kiran_authentication_key_free(client_key);
+
+    return result;
+}
+
+static int
+key_aead_decrypt(KiranAuthKey *key,
+                 const unsigned char *enc_data,
+                 int data_len,
+                 char *decrypted,
+                 int decrypted_size)
+{
+    EVP_PKEY *client_key = NULL;
+    unsigned char aead_key[AEAD_KEY_LEN];
+    unsigned char tag[AEAD_TAG_LEN];
+    int text_len = data_len - AEAD_OVERHEAD_LEN;
+    int result = -1;
+
+    if (text_len < 0 || decrypted_size < text_len)
+    {
+        return -1;
+    }
+
+    client_key = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, enc_data, X25519_KEY_LEN);
+    if (client_key == NULL)
+    {
+        return -1;
+    }
+
+    if (derive_aead_key(key->pkey, client_key, enc_data, key->raw_public, aead_key) == 0)
+    {
+        memcpy(tag, enc_data + X25519_KEY_LEN + AEAD_NONCE_LEN + text_len, AEAD_TAG_LEN);
+        result = aead_crypt(key->transport, 0, aead_key,
+                            enc_data + X25519_KEY_LEN,
+                            enc_data + X25519_KEY_LEN + AEAD_NONCE_LEN, text_len,
+                            (unsigned char *)decrypted,
+                            tag);
+    }
+
+    OPENSSL_cleanse(aead_key, sizeof(aead_key));
+    EVP_PKEY_free(client_key);
+
+    return result;
+}
+
+int kiran_authentication_key_encrypt(KiranAuthKey *key,
+                                     const char *data,
+                                     int data_len,
+                                     unsigned char *encrypted,
+                                     int encrypted_size)
+{
+    if (key == NULL || key->rsa == NULL || encrypted_size < RSA_size(key->rsa))
+    {
+        return -1;
+    }
+
+    return RSA_public_encrypt(data_len, (const unsigned char *)data, encrypted, key->rsa, RSA_PKCS1_PADDING);
+}
+
+int kiran_authentication_key_decrypt(KiranAuthKey *key,
+                                     const unsigned char *enc_data,
+                                     int data_len,
+                                     char *decrypted,
+                                     int decrypted_size)
+{
+    if (key == NULL)
+    {
+        return -1;
+    }
+
+    if (key->pkey != NULL)
+    {
+        return key_aead_decrypt(key, enc_data, data_len, decrypted, decrypted_size);
+    }
+
+    if (key->is_public || decrypted_size < RSA_size(key->rsa))
+    {
+        return -1;
+    }
+
+    return RSA_private_decrypt(data_len, enc_data, (unsigned char *)decrypted, key->rsa, RSA_PKCS1_PADDING);
+}
+
+void kiran_authentication_key_free(KiranAuthKey *key)
+{
+    if (key == NULL)
+    {
+        return;
+    }
+
+    RSA_free(key->rsa);
+    EVP_PKEY_free(key->pkey);
+    free(key);
+}
+
 int kiran_authentication_rsa_public_encrypt(char *data,
                                             int data_len,
                                             unsigned char *key,
                                             unsigned char **encrypted)
 {
-    RSA *rsa = NULL;
+    KiranAuthKey *auth_key = NULL;
     unsigned char buf[RSA_BUFFER_LEN] = {0};
     unsigned char *ptr = NULL;
     int result = -1;
 
-    rsa = create_RSA(key, 1);
-    if (rsa == NULL)
+    *encrypted = NULL;
+
+    auth_key = kiran_authentication_key_new_public((const char *)key);
+    if (auth_key == NULL)
     {
         return -1;
     }
 
-    result = RSA_public_encrypt(data_len, data, buf, rsa, RSA_PKCS1_PADDING);
+    result = kiran_authentication_key_encrypt(auth_key, data, data_len, buf, sizeof(buf));
     if (result > 0)
     {
         ptr = malloc(result);
@@ -77,6 +490,7 @@ int kiran_authentication_rsa_public_encrypt(char *data,
     }
 
     *encrypted = ptr;
+    kiran_authentication_key_free(auth_key);
 
     return result;
 }
@@ -86,18 +500,20 @@ int kiran_authentication_rsa_private_decrypt(unsigned char *enc_data,
                                              unsigned char *key,
                                              char **decrypted)
 {
-    RSA *rsa = NULL;
-    unsigned char buf[RSA_BUFFER_LEN] = {0};
-    unsigned char *ptr = NULL;
+    KiranAuthKey *auth_key = NULL;
+    char buf[RSA_BUFFER_LEN] = {0};
+    char *ptr = NULL;
     int result = -1;
 
-    rsa = create_RSA(key, 0);
-    if (rsa == NULL)
+    *decrypted = NULL;
+
+    auth_key = kiran_authentication_key_new_private((const char *)key);
+    if (auth_key == NULL)
     {
         return -1;
     }
 
-    result = RSA_private_decrypt(data_len, enc_data, buf, rsa, RSA_PKCS1_PADDING);
+    result = kiran_authentication_key_decrypt(auth_key, enc_data, data_len, buf, sizeof(buf));
     if (result > 0)
     {
         ptr = malloc(result);
@@ -108,11 +524,18 @@ int kiran_authentication_rsa_private_decrypt(unsigned char *enc_data,
     }
 
     *decrypted = ptr;
+    OPENSSL_cleanse(buf, sizeof(buf));
+    kiran_authentication_key_free(auth_key);
 
     return result;
 }
 
 int kiran_authentication_rsa_key_gen(char **public_key, char **private_key)
+{
+    return kiran_authentication_rsa_key_gen_with_bits(KEY_LEN, public_key, private_key);
+}
+
+int kiran_authentication_rsa_key_gen_with_bits(int bits, char **public_key, char **private_key)
 {
     EVP_PKEY_CTX *evp_ctx = NULL;
     EVP_PKEY *ppkey = NULL;
@@ -130,7 +553,7 @@ int kiran_authentication_rsa_key_gen(char **public_key, char **private_key)
     }
 
     EVP_PKEY_keygen_init(evp_ctx);
-    EVP_PKEY_CTX_set_rsa_keygen_bits(evp_ctx, KEY_LEN);
+    EVP_PKEY_CTX_set_rsa_keygen_bits(evp_ctx, bits);
 
     EVP_PKEY_keygen(evp_ctx, &ppkey);
     if (ppkey == NULL)
@@ -146,7 +569,8 @@ int kiran_authentication_rsa_key_gen(char **public_key, char **private_key)
         BIO_get_mem_ptr(bio, &pub_buf);
         if (pub_buf)
         {
-            *public_key = strdup(pub_buf->data);
+            //BUF_MEM中的数据不以'\0'结尾
+            *public_key = strndup(pub_buf->data, pub_buf->length);
         }
         BIO_free(bio);
     }
@@ -156,9 +580,9 @@ int kiran_authentication_rsa_key_gen(char **public_key, char **private_key)
     {
         PEM_write_bio_PrivateKey(bio, ppkey, NULL, NULL, 0, 0, NULL);
         BIO_get_mem_ptr(bio, &pri_buf);
-        if (&pri_buf)
+        if (pri_buf)
         {
-            *private_key = strdup(pub_buf->data);
+            *private_key = strndup(pri_buf->data, pri_buf->length);
         }
         BIO_free(bio);
     }
@@ -186,3 +610,283 @@ int kiran_authentication_rsa_key_gen(char **public_key, char **private_key)
 
     return 0;
 }
+
+typedef struct _KeyPair KeyPair;
+
+struct _KeyPair
+{
+    char *public_key;
+    char *private_key;
+};
+
+struct _KiranAuthKeyPool
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t refill_cond;
+
+    int low_watermark;
+    int high_watermark;
+
+    //环形队列，容量为high_watermark
+    KeyPair *pairs;
+    int head;
+    int count;
+
+    //是否处于补充状态，低于低水位时置位，达到高水位时清除
+    int refilling;
+    int stopping;
+    //连续生成失败的次数
+    int failed_in_row;
+
+    pthread_t *threads;
+    int n_threads;
+
+    KiranAuthKeyPoolStats stats;
+};
+
+/*
+ * 生成失败后等待一段时间再重试，避免一直失败时占满cpu，停止时立即返回
+ */
+static void
+key_pool_backoff_locked(KiranAuthKeyPool *pool)
+{
+    struct timespec deadline;
+    long delay_ms = KEY_POOL_RETRY_MIN_MS;
+    int i;
+
+    for (i = 1; i < pool->failed_in_row && delay_ms < KEY_POOL_RETRY_MAX_MS; i++)
+    {
+        delay_ms *= 2;
+    }
+    if (delay_ms > KEY_POOL_RETRY_MAX_MS)
+    {
+        delay_ms = KEY_POOL_RETRY_MAX_MS;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += delay_ms / 1000;
+    deadline.tv_nsec += (delay_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    //补充请求也会唤醒等待，未到时间时继续等待
+    while (!pool->stopping)
+    {
+        if (pthread_cond_timedwait(&pool->refill_cond, &pool->mutex, &deadline) == ETIMEDOUT)
+            break;
+    }
+}
+
+static void *
+key_pool_worker(void *data)
+{
+    KiranAuthKeyPool *pool = data;
+    char *public_key;
+    char *private_key;
+    int ret;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;)
+    {
+        while (!pool->stopping &&
+               !(pool->refilling && pool->count + pool->stats.generating < pool->high_watermark))
+        {
+            pthread_cond_wait(&pool->refill_cond, &pool->mutex);
+        }
+
+        if (pool->stopping)
+            break;
+
+        pool->stats.generating++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        ret = kiran_authentication_rsa_key_gen(&public_key, &private_key);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->stats.generating--;
+
+        if (ret != 0)
+        {
+            pool->stats.failures++;
+            pool->failed_in_row++;
+            key_pool_backoff_locked(pool);
+            continue;
+        }
+
+        pool->failed_in_row = 0;
+        pool->stats.generated++;
+        if (pool->count < pool->high_watermark)
+        {
+            KeyPair *pair = &pool->pairs[(pool->head + pool->count) % pool->high_watermark];
+
+            pair->public_key = public_key;
+            pair->private_key = private_key;
+            pool->count++;
+        }
+        else
+        {
+            free(public_key);
+            free(private_key);
+        }
+
+        if (pool->count >= pool->high_watermark)
+        {
+            pool->refilling = 0;
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+KiranAuthKeyPool *
+kiran_authentication_key_pool_new(int low_watermark,
+                                  int high_watermark,
+                                  int n_threads)
+{
+    KiranAuthKeyPool *pool;
+    int i;
+
+    pool = calloc(1, sizeof(KiranAuthKeyPool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->refill_cond, NULL);
+
+    if (high_watermark <= 0 || n_threads <= 0)
+    {
+        //不启用后台生成，每次同步生成
+        return pool;
+    }
+
+    if (low_watermark < 0)
+        low_watermark = 0;
+    if (low_watermark > high_watermark)
+        low_watermark = high_watermark;
+
+    pool->low_watermark = low_watermark;
+    pool->high_watermark = high_watermark;
+    pool->refilling = 1;
+    pool->pairs = calloc(high_watermark, sizeof(KeyPair));
+    pool->threads = calloc(n_threads, sizeof(pthread_t));
+    if (pool->pairs == NULL || pool->threads == NULL)
+    {
+        kiran_authentication_key_pool_free(pool);
+        return NULL;
+    }
+
+    pool->stats.refills = 1;
+    for (i = 0; i < n_threads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, key_pool_worker, pool) != 0)
+        {
+            break;
+        }
+        pool->n_threads++;
+    }
+
+    return pool;
+}
+
+int kiran_authentication_key_pool_pop(KiranAuthKeyPool *pool,
+                                      char **public_key,
+                                      char **private_key)
+{
+    KeyPair *pair;
+
+    *public_key = NULL;
+    *private_key = NULL;
+
+    if (pool == NULL)
+    {
+        return kiran_authentication_rsa_key_gen(public_key, private_key);
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->count > 0)
+    {
+        pair = &pool->pairs[pool->head];
+        *public_key = pair->public_key;
+        *private_key = pair->private_key;
+        pair->public_key = NULL;
+        pair->private_key = NULL;
+        pool->head = (pool->head + 1) % pool->high_watermark;
+        pool->count--;
+        pool->stats.hits++;
+    }
+    else
+    {
+        pool->stats.misses++;
+    }
+
+    if (pool->n_threads > 0 && !pool->refilling && pool->count < pool->low_watermark)
+    {
+        pool->refilling = 1;
+        pool->stats.refills++;
+        pthread_cond_broadcast(&pool->refill_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (*public_key == NULL)
+    {
+        //池为空时同步生成
+        return kiran_authentication_rsa_key_gen(public_key, private_key);
+    }
+
+    return 0;
+}
+
+void kiran_authentication_key_pool_get_stats(KiranAuthKeyPool *pool,
+                                             KiranAuthKeyPoolStats *stats)
+{
+    memset(stats, 0, sizeof(KiranAuthKeyPoolStats));
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    *stats = pool->stats;
+    stats->available = pool->count;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void kiran_authentication_key_pool_free(KiranAuthKeyPool *pool)
+{
+    int i;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->refill_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->n_threads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (i = 0; i < pool->count; i++)
+    {
+        KeyPair *pair = &pool->pairs[(pool->head + i) % pool->high_watermark];
+
+        free(pair->public_key);
+        free(pair->private_key);
+    }
+
+    pthread_cond_destroy(&pool->refill_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool->pairs);
+    free(pool);
+}
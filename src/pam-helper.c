@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2020 ~ 2021 KylinSec Co., Ltd.
+ * kiran-cc-daemon is licensed under Mulan PSL v2.
+ * You can use this software according to the terms and conditions of the Mulan PSL v2.
+ * You may obtain a copy of Mulan PSL v2 at:
+ *          http://license.coscl.org.cn/MulanPSL2
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PSL v2 for more details.
+ *
+ * Author:     wangxiaoqing <wangxiaoqing@kylinos.com.cn>
+ */
+
+/**
+ *@file pam-helper.c
+ *@brief pam辅助进程，由认证服务预先创建，在独立的进程中执行pam认证，
+ *       每次认证的对话通过KIRAN_AUTH_PAM_PROTO_FD与认证服务交互
+ */
+#include <security/pam_appl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "kiran-auth-pam-proto.h"
+
+static int
+helper_conv_cb(int msg_length,
+               const struct pam_message **msg,
+               struct pam_response **resp,
+               void *app_data)
+{
+    int fd = GPOINTER_TO_INT(app_data);
+    struct pam_response *response;
+    gchar payload[KIRAN_AUTH_PAM_PROTO_MAX_PAYLOAD + 1];
+    KiranAuthPamProtoHeader header;
+    gsize len;
+    int i;
+
+    if (msg_length <= 0)
+        return PAM_CONV_ERR;
+
+    response = calloc(msg_length, sizeof(struct pam_response));
+    if (response == NULL)
+        return PAM_BUF_ERR;
+
+    //一次发送所有消息，认证服务可以在一个信号中转发给客户端
+    for (i = 0; i < msg_length; i++)
+    {
+        const struct pam_message *m = msg[i];
+
+        if (!kiran_auth_pam_proto_send(fd,
+                                       KIRAN_AUTH_PAM_PROTO_PROMPT,
+                                       m->msg_style,
+                                       m->msg,
+                                       m->msg ? strlen(m->msg) : 0))
+        {
+            goto failed;
+        }
+    }
+
+    if (!kiran_auth_pam_proto_send(fd, KIRAN_AUTH_PAM_PROTO_PROMPT_END, msg_length, NULL, 0))
+        goto failed;
+
+    for (i = 0; i < msg_length; i++)
+    {
+        const struct pam_message *m = msg[i];
+
+        if (m->msg_style != PAM_PROMPT_ECHO_ON &&
+            m->msg_style != PAM_PROMPT_ECHO_OFF)
+        {
+            continue;
+        }
+
+        if (!kiran_auth_pam_proto_recv(fd, &header, payload, &len) ||
+            header.type != KIRAN_AUTH_PAM_PROTO_RESPONSE ||
+            header.arg < 0)
+        {
+            goto failed;
+        }
+
+        response[i].resp = strndup(payload, len);
+        response[i].resp_retcode = 0;
+        memset(payload, 0, len);
+    }
+
+    *resp = response;
+
+    return PAM_SUCCESS;
+
+failed:
+    for (i = 0; i < msg_length; i++)
+    {
+        if (response[i].resp)
+        {
+            memset(response[i].resp, 0, strlen(response[i].resp));
+            free(response[i].resp);
+        }
+    }
+    free(response);
+
+    return PAM_CONV_ERR;
+}
+
+/*
+ * 执行一次认证，返回FALSE时与认证服务的连接已经不可用
+ */
+static gboolean
+run_authentication(int fd,
+                   const gchar *service,
+                   const gchar *username)
+{
+    struct pam_conv conversation = {helper_conv_cb, GINT_TO_POINTER(fd)};
+    pam_handle_t *pamh = NULL;
+    const void *user = NULL;
+    gboolean sent;
+    int ret;
+
+    ret = pam_start(service, username[0] ? username : NULL, &conversation, &pamh);
+    if (ret != PAM_SUCCESS)
+    {
+        return kiran_auth_pam_proto_send(fd, KIRAN_AUTH_PAM_PROTO_RESULT, ret, NULL, 0);
+    }
+
+    ret = pam_authenticate(pamh, 0);
+    pam_get_item(pamh, PAM_USER, &user);
+    sent = kiran_auth_pam_proto_send(fd,
+                                     KIRAN_AUTH_PAM_PROTO_RESULT,
+                                     ret,
+                                     user,
+                                     user ? strlen(user) : 0);
+    pam_end(pamh, ret);
+
+    return sent;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = KIRAN_AUTH_PAM_PROTO_FD;
+    gchar payload[KIRAN_AUTH_PAM_PROTO_MAX_PAYLOAD + 1];
+    KiranAuthPamProtoHeader header;
+    gsize len;
+
+#ifdef __linux__
+    //认证服务退出时随之退出
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+    signal(SIGPIPE, SIG_IGN);
+
+    while (kiran_auth_pam_proto_recv(fd, &header, payload, &len))
+    {
+        const gchar *service = payload;
+        const gchar *username;
+
+        if (header.type != KIRAN_AUTH_PAM_PROTO_START)
+        {
+            //没有进行中的对话，忽略过期的应答
+            continue;
+        }
+
+        username = memchr(payload, '\0', len) ? payload + strlen(payload) + 1 : "";
+        if (!run_authentication(fd, service, username))
+        {
+            break;
+        }
+    }
+
+    close(fd);
+
+    return 0;
+}
@@ -162,6 +162,15 @@ verify_user(pam_handle_t *pamh)
                      G_CALLBACK(auth_status_cb),
                      data);
 
+    //会话信号默认只发送给会话创建者，需要关注后才能收到认证结果
+    error = NULL;
+    if (!kiran_authentication_gen_call_watch_session_sync(auth, data->sid, NULL, &error))
+    {
+        //服务配置为广播信号或者版本较旧时仍然可以收到
+        pam_syslog(pamh, LOG_DEBUG, "Watch auth session failed: %s", error->message);
+        g_error_free(error);
+    }
+
     source = g_timeout_source_new_seconds(120);
     g_source_attach(source, g_main_loop_get_context(data->loop));
     g_source_set_callback(source, verify_timeout_cb, data, NULL);